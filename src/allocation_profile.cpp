@@ -0,0 +1,241 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#include "allocation_profile.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+
+
+namespace
+{
+
+struct phase_counters
+{
+    std::atomic<std::uint64_t> allocations = 0;
+    std::atomic<std::uint64_t> bytes = 0;
+    std::atomic<std::uint64_t> deallocations = 0;
+};
+
+constexpr std::array<const char*, 4> phaseNames = {
+    "startup",
+    "step",
+    "observers",
+    "teardown",
+};
+
+// Zero-initialized before any dynamic initialization, so they are safe
+// to use from allocations made by static constructors.
+std::atomic<bool> profiling = false;
+std::atomic<allocation_phase> currentPhase = allocation_phase::startup;
+std::array<phase_counters, phaseNames.size()> counters;
+
+std::uint64_t in_step_allocations() noexcept
+{
+    return counters[static_cast<std::size_t>(allocation_phase::step)].allocations +
+        counters[static_cast<std::size_t>(allocation_phase::observers)].allocations;
+}
+
+} // namespace
+
+
+bool allocation_profiling_enabled() noexcept
+{
+    return profiling.load(std::memory_order_relaxed);
+}
+
+
+allocation_profile::allocation_profile()
+{
+    if (profiling.exchange(true)) {
+        throw std::logic_error("An allocation profile is already being recorded");
+    }
+    for (auto& c : counters) {
+        c.allocations = 0;
+        c.bytes = 0;
+        c.deallocations = 0;
+    }
+    currentPhase = allocation_phase::startup;
+}
+
+
+allocation_profile::~allocation_profile() noexcept
+{
+    // Stop counting first, since the report allocates.
+    profiling = false;
+    try {
+        std::cout << std::left << std::setw(10) << "phase" << "  "
+                  << std::right << std::setw(12) << "allocations" << "  "
+                  << std::setw(14) << "bytes" << "  "
+                  << std::setw(14) << "deallocations" << '\n';
+        for (std::size_t i = 0; i < counters.size(); ++i) {
+            std::cout << std::left << std::setw(10) << phaseNames[i] << "  "
+                      << std::right << std::setw(12) << counters[i].allocations << "  "
+                      << std::setw(14) << counters[i].bytes << "  "
+                      << std::setw(14) << counters[i].deallocations << '\n';
+        }
+        if (steps_ > 0) {
+            const auto& step = counters[static_cast<std::size_t>(allocation_phase::step)];
+            const auto& observers = counters[static_cast<std::size_t>(allocation_phase::observers)];
+            std::cout << std::fixed << std::setprecision(1)
+                      << "Allocations per macro step: "
+                      << static_cast<double>(step.allocations) / steps_ << " in the step, "
+                      << static_cast<double>(observers.allocations) / steps_ << " in observers; "
+                      << "at most " << maxStepAllocations_ << " in one step\n"
+                      << std::defaultfloat
+                      << stepsWithAllocations_ << " of " << steps_
+                      << " macro steps allocated memory\n";
+        }
+    } catch (...) {
+        // Nothing sensible to do about failing output in a destructor.
+    }
+}
+
+
+void allocation_profile::simulation_started() noexcept
+{
+    currentPhase = allocation_phase::step;
+    allocationsAtLastStep_ = in_step_allocations();
+}
+
+
+void allocation_profile::step_complete() noexcept
+{
+    const auto allocations = in_step_allocations();
+    const auto stepAllocations = allocations - allocationsAtLastStep_;
+    allocationsAtLastStep_ = allocations;
+    ++steps_;
+    if (stepAllocations > 0) ++stepsWithAllocations_;
+    if (stepAllocations > maxStepAllocations_) maxStepAllocations_ = stepAllocations;
+}
+
+
+void allocation_profile::simulation_finished() noexcept
+{
+    currentPhase = allocation_phase::teardown;
+}
+
+
+allocation_phase_scope::allocation_phase_scope(allocation_phase phase) noexcept
+    : active_(allocation_profiling_enabled())
+    , previous_(currentPhase.load(std::memory_order_relaxed))
+{
+    if (active_) currentPhase = phase;
+}
+
+
+allocation_phase_scope::~allocation_phase_scope() noexcept
+{
+    if (active_) currentPhase = previous_;
+}
+
+
+#ifdef COSIM_ALLOCATION_PROFILER
+
+namespace
+{
+
+phase_counters& current_counters() noexcept
+{
+    return counters[static_cast<std::size_t>(currentPhase.load(std::memory_order_relaxed))];
+}
+
+void* counted_allocation(std::size_t size, bool nothrow)
+{
+    if (size == 0) size = 1;
+    void* memory;
+    while ((memory = std::malloc(size)) == nullptr) {
+        const auto handler = std::get_new_handler();
+        if (!handler) {
+            if (nothrow) return nullptr;
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+    if (profiling.load(std::memory_order_relaxed)) {
+        auto& c = current_counters();
+        c.allocations.fetch_add(1, std::memory_order_relaxed);
+        c.bytes.fetch_add(size, std::memory_order_relaxed);
+    }
+    return memory;
+}
+
+void counted_deallocation(void* memory) noexcept
+{
+    if (!memory) return;
+    if (profiling.load(std::memory_order_relaxed)) {
+        current_counters().deallocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    std::free(memory);
+}
+
+} // namespace
+
+
+void* operator new(std::size_t size)
+{
+    return counted_allocation(size, false);
+}
+
+void* operator new[](std::size_t size)
+{
+    return counted_allocation(size, false);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    try {
+        return counted_allocation(size, true);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    try {
+        return counted_allocation(size, true);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void operator delete(void* memory) noexcept
+{
+    counted_deallocation(memory);
+}
+
+void operator delete[](void* memory) noexcept
+{
+    counted_deallocation(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept
+{
+    counted_deallocation(memory);
+}
+
+void operator delete[](void* memory, std::size_t) noexcept
+{
+    counted_deallocation(memory);
+}
+
+void operator delete(void* memory, const std::nothrow_t&) noexcept
+{
+    counted_deallocation(memory);
+}
+
+void operator delete[](void* memory, const std::nothrow_t&) noexcept
+{
+    counted_deallocation(memory);
+}
+
+#endif // COSIM_ALLOCATION_PROFILER
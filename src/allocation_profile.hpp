@@ -0,0 +1,100 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#ifndef COSIM_ALLOCATION_PROFILE_HPP
+#define COSIM_ALLOCATION_PROFILE_HPP
+
+#include <cstdint>
+
+
+/*
+ *  Allocation profiling.
+ *
+ *  When the program is built with the `COSIM_ALLOCATION_PROFILER` CMake
+ *  option, the global `operator new` and `operator delete` are replaced
+ *  with versions that count allocations while an `allocation_profile`
+ *  exists.  Allocations are attributed to the phase of the run that the
+ *  application thread is in, also when they are made by worker threads.
+ *  Over-aligned allocations are not counted.
+ */
+
+
+/// The phases of a run, for which allocations are counted separately.
+enum class allocation_phase
+{
+    /// Loading, instantiation and initialization.
+    startup,
+
+    /// Macro steps, excluding observers.
+    step,
+
+    /// Observers, output and progress reporting.
+    observers,
+
+    /// Everything after the last step.
+    teardown,
+};
+
+
+/// Returns whether allocations are currently being counted.
+bool allocation_profiling_enabled() noexcept;
+
+
+/**
+ *  Counts allocations for the lifetime of the object, and prints a
+ *  report to standard output when it is destroyed.
+ *
+ *  Counting starts in the `startup` phase.  Only one profile may exist at
+ *  a time, and its member functions must be called from the application
+ *  thread.
+ */
+class allocation_profile
+{
+public:
+    allocation_profile();
+
+    allocation_profile(const allocation_profile&) = delete;
+    allocation_profile& operator=(const allocation_profile&) = delete;
+
+    ~allocation_profile() noexcept;
+
+    /// Enters the `step` phase.  Called when the simulation is initialized.
+    void simulation_started() noexcept;
+
+    /// Records the allocations made during a macro step and its observers.
+    void step_complete() noexcept;
+
+    /// Enters the `teardown` phase.
+    void simulation_finished() noexcept;
+
+private:
+    std::uint64_t steps_ = 0;
+    std::uint64_t stepsWithAllocations_ = 0;
+    std::uint64_t maxStepAllocations_ = 0;
+    std::uint64_t allocationsAtLastStep_ = 0;
+};
+
+
+/**
+ *  Attributes allocations to a different phase for the lifetime of the
+ *  object.  Does nothing if no profile is being recorded.
+ */
+class allocation_phase_scope
+{
+public:
+    explicit allocation_phase_scope(allocation_phase phase) noexcept;
+
+    allocation_phase_scope(const allocation_phase_scope&) = delete;
+    allocation_phase_scope& operator=(const allocation_phase_scope&) = delete;
+
+    ~allocation_phase_scope() noexcept;
+
+private:
+    bool active_;
+    allocation_phase previous_;
+};
+
+
+#endif
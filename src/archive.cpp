@@ -0,0 +1,95 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#include "archive.hpp"
+
+#include "parallel.hpp"
+
+#include <cosim/log/logger.hpp>
+#include <cosim/utility/zip.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+namespace
+{
+
+struct file_entry
+{
+    cosim::utility::zip::entry_index index;
+    cosim::filesystem::path targetDir;
+};
+
+} // namespace
+
+
+void extract_archive(
+    const cosim::filesystem::path& archivePath,
+    const cosim::filesystem::path& targetDir)
+{
+    const auto startTime = std::chrono::steady_clock::now();
+
+    // Create the directory tree and make a list of the files to extract.
+    std::vector<file_entry> files;
+    {
+        const auto archive = cosim::utility::zip::archive(archivePath);
+        const auto entryCount = archive.entry_count();
+        cosim::filesystem::create_directories(targetDir);
+        for (cosim::utility::zip::entry_index i = 0; i < entryCount; ++i) {
+            const auto entryPath = targetDir / archive.entry_name(i);
+            if (archive.is_dir_entry(i)) {
+                cosim::filesystem::create_directories(entryPath);
+            } else {
+                cosim::filesystem::create_directories(entryPath.parent_path());
+                files.push_back({i, entryPath.parent_path()});
+            }
+        }
+    }
+
+    // Extract the files.  The threads pick files from the list one by one,
+    // so a few large files don't leave the other threads idle.
+    const auto threadCount = std::max<std::size_t>(
+        1,
+        std::min<std::size_t>(thread_count_or_default(0), files.size()));
+    std::atomic<std::uintmax_t> totalBytes = 0;
+    parallel_for_with_state(
+        files.size(),
+        thread_count_or_default(0),
+        [&]() { return cosim::utility::zip::archive(archivePath); },
+        [&](const cosim::utility::zip::archive& archive, std::size_t i) {
+            const auto extracted = archive.extract_file_to(files[i].index, files[i].targetDir);
+            totalBytes += cosim::filesystem::file_size(extracted);
+        });
+
+    const auto seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - startTime).count();
+    const auto megabytes = totalBytes / 1.0e6;
+    BOOST_LOG_SEV(cosim::log::logger(), cosim::log::info)
+        << "Extracted " << files.size() << " files (" << megabytes
+        << " MB) from " << archivePath << " in " << seconds << " s ("
+        << (seconds > 0.0 ? megabytes / seconds : 0.0) << " MB/s) using "
+        << threadCount << " threads";
+}
+
+
+cosim::filesystem::path extract_archive_entry(
+    const cosim::filesystem::path& archivePath,
+    const std::string& entryName,
+    const cosim::filesystem::path& targetDir)
+{
+    const auto archive = cosim::utility::zip::archive(archivePath);
+    const auto index = archive.find_entry(entryName);
+    if (index == cosim::utility::zip::invalid_entry_index) {
+        throw std::runtime_error(
+            "'" + archivePath.string() + "' does not contain " + entryName);
+    }
+    return archive.extract_file_to(index, targetDir);
+}
@@ -0,0 +1,63 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#ifndef COSIM_ARCHIVE_HPP
+#define COSIM_ARCHIVE_HPP
+
+#include <cosim/fs_portability.hpp>
+
+#include <string>
+
+
+/**
+ *  Extracts the full contents of a ZIP archive (e.g. an FMU) to a directory.
+ *
+ *  The directory tree is created up front, and the files are then
+ *  extracted in parallel by multiple threads, each of which reads from its
+ *  own handle to the archive.  The achieved throughput is logged at the
+ *  "info" level, so the cold extraction of an FMU can be measured with
+ *
+ *      COSIM_CACHE_PATH=$(mktemp -d) cosim run-single -v -e 0.01 \
+ *          --output-file /dev/null big.fmu
+ *
+ *  Note that `cosim inspect` does not work for this, as it reads the model
+ *  description straight from the archive without unpacking it.
+ *
+ *  \param [in] archivePath
+ *      The path to the archive.
+ *  \param [in] targetDir
+ *      The directory to extract to.  It will be created if it doesn't
+ *      exist already.
+ */
+void extract_archive(
+    const cosim::filesystem::path& archivePath,
+    const cosim::filesystem::path& targetDir);
+
+
+/**
+ *  Extracts a single file from a ZIP archive to a directory.
+ *
+ *  No other entries in the archive are read.
+ *
+ *  \param [in] archivePath
+ *      The path to the archive.
+ *  \param [in] entryName
+ *      The full name of the entry within the archive.
+ *  \param [in] targetDir
+ *      The directory to extract to, which must already exist.
+ *
+ *  \returns
+ *      The path to the extracted file.
+ *
+ *  \throws std::runtime_error
+ *      If the archive does not contain the given entry.
+ */
+cosim::filesystem::path extract_archive_entry(
+    const cosim::filesystem::path& archivePath,
+    const std::string& entryName,
+    const cosim::filesystem::path& targetDir);
+
+
+#endif
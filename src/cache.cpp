@@ -5,13 +5,30 @@
  */
 #include "cache.hpp"
 
+#include "archive.hpp"
+#include "fingerprint.hpp"
+#include "probes.hpp"
+#include "tools.hpp"
+
+#include <boost/interprocess/sync/file_lock.hpp>
 #include <cosim/file_cache.hpp>
+#include <cosim/fmi/importer.hpp>
 #include <cosim/fs_portability.hpp>
 #include <cosim/log/logger.hpp>
 
+#include <algorithm>
+#include <cstdint>
 #include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <mutex>
 #include <optional>
 #include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
 
 namespace
 {
@@ -69,16 +86,537 @@ std::optional<cosim::filesystem::path> cache_directory_path()
     }
 }
 
+
+// Returns the list of read-only, shared cache directories given by the
+// COSIM_SHARED_CACHE_PATH environment variable, in order of precedence.
+// Multiple directories are separated by the platform's path list separator.
+std::vector<cosim::filesystem::path> shared_cache_directory_paths()
+{
+#ifdef _WIN32
+    constexpr char listSeparator = ';';
+#else
+    constexpr char listSeparator = ':';
+#endif
+    std::vector<cosim::filesystem::path> paths;
+    if (const auto sharedCachePath = getenv("COSIM_SHARED_CACHE_PATH")) {
+        std::string_view list = sharedCachePath;
+        while (!list.empty()) {
+            const auto sepPos = std::min(list.find(listSeparator), list.size());
+            if (sepPos > 0) {
+                paths.emplace_back(std::string(list.substr(0, sepPos)));
+            }
+            list.remove_prefix(std::min(sepPos + 1, list.size()));
+        }
+    }
+    return paths;
+}
+
+
+// The cache subdirectories that hold unpacked FMUs and other archives, and
+// the names of the files/directories inside each entry.
+constexpr auto fmuCacheSubdir = "fmus";
+constexpr auto archiveCacheSubdir = "archives";
+constexpr auto entryFingerprintFile = "fingerprint";
+constexpr auto entryContentSubdir = "content";
+
+
+// Returns the inode number of `file`, or an empty object if it doesn't
+// exist.  Always zero on platforms without inode numbers.
+std::optional<std::uint64_t> file_inode(const cosim::filesystem::path& file)
+{
+    try {
+        return fingerprint_file(file).inode;
+    } catch (const std::exception&) {
+        if (!cosim::filesystem::exists(file)) return std::nullopt;
+        throw;
+    }
+}
+
+
+// A lock on the cache entry in `entryDir`, in a file which is created if
+// necessary.  The lock file lives next to the entry directory rather than
+// inside it, so the entry can be removed while the lock is held.
+//
+// `clean_unpacked_entries()` removes the lock file along with the entry, while it
+// holds an exclusive lock.  A process which opened the file before that
+// would then hold a lock that no other process sees, so the locking
+// functions check that the file is still in place afterwards.  If it is
+// not, they return false without holding the lock, and the caller must
+// start over with a new object.
+class entry_lock
+{
+public:
+    explicit entry_lock(const cosim::filesystem::path& entryDir)
+        : file_(cosim::filesystem::path(entryDir).concat(".lock"))
+    {
+        for (;;) {
+            if (!cosim::filesystem::exists(file_)) {
+                std::ofstream stream(file_.string(), std::ios::app);
+                if (!stream) {
+                    throw std::runtime_error("Unable to create lock file: " + file_.string());
+                }
+            }
+            // The inode is obtained before the file is opened, so that we
+            // never mistake a replaced file for the one we locked.
+            inode_ = file_inode(file_);
+            if (!inode_) continue;
+            try {
+                lock_ = boost::interprocess::file_lock(file_.string().c_str());
+                return;
+            } catch (const std::exception&) {
+                if (cosim::filesystem::exists(file_)) throw;
+            }
+        }
+    }
+
+    bool lock_sharable()
+    {
+        lock_.lock_sharable();
+        if (is_current()) return true;
+        lock_.unlock_sharable();
+        return false;
+    }
+
+    bool lock()
+    {
+        lock_.lock();
+        if (is_current()) return true;
+        lock_.unlock();
+        return false;
+    }
+
+    bool try_lock()
+    {
+        if (!lock_.try_lock()) return false;
+        if (is_current()) return true;
+        lock_.unlock();
+        return false;
+    }
+
+    void unlock_sharable() { lock_.unlock_sharable(); }
+
+    void unlock() { lock_.unlock(); }
+
+    // Removes the lock file.  Must be called with the exclusive lock held.
+    // On platforms where open files can't be removed, the file is left in
+    // place.
+    void remove_file()
+    {
+        std::error_code errorCode;
+        cosim::filesystem::remove(file_, errorCode);
+    }
+
+private:
+    bool is_current() const { return file_inode(file_) == inode_; }
+
+    cosim::filesystem::path file_;
+    std::optional<std::uint64_t> inode_;
+    boost::interprocess::file_lock lock_;
+};
+
+
+// Returns the name of the cache entry for an archive with the given
+// fingerprint.  It is based on the path, size and modification time, so a
+// changed archive gets a new entry, while the old one may still be in use.
+// The inode number is left out, so that entries in shared caches, which are
+// typically populated on a different machine or as part of a container
+// image build, have the same names as in the user cache.
+std::string entry_name(const file_fingerprint& fingerprint)
+{
+    return hash_string(
+        fingerprint.path + '\n' + std::to_string(fingerprint.size) + '\n' +
+        std::to_string(fingerprint.mtime));
+}
+
+
+// Returns whether a cache entry was unpacked from an archive with the
+// same path, size and modification time as the given one, i.e., whether it
+// matches the archive except perhaps for the inode number.
+bool matches_except_inode(
+    const std::optional<file_fingerprint>& entry,
+    const file_fingerprint& archive)
+{
+    return entry &&
+        entry->path == archive.path &&
+        entry->size == archive.size &&
+        entry->mtime == archive.mtime;
+}
+
+
+// Makes sure that the cache entry in `entryDir` holds the unpacked contents
+// of the archive with the given fingerprint, and returns a shared lock on
+// the entry.  Next to the unpacked files, the entry stores the fingerprint
+// of the archive it was unpacked from.  As long as it matches, the
+// unpacked files are used as-is, without opening the archive at all.
+// Otherwise, the entry is refreshed.
+entry_lock lock_unpacked_entry(
+    const cosim::filesystem::path& archivePath,
+    const cosim::filesystem::path& entryDir,
+    const file_fingerprint& fingerprint)
+{
+    const auto fingerprintFile = entryDir / entryFingerprintFile;
+    for (;;) {
+        entry_lock lock(entryDir);
+        if (!lock.lock_sharable()) continue;
+        const auto entryFingerprint = read_fingerprint_file(fingerprintFile);
+        if (entryFingerprint == fingerprint) {
+            BOOST_LOG_SEV(cosim::log::logger(), cosim::log::debug)
+                << "Fingerprint of " << archivePath << " matches cache entry "
+                << entryDir << "; skipping unpacking";
+            return lock;
+        }
+        lock.unlock_sharable();
+
+        if (matches_except_inode(entryFingerprint, fingerprint)) {
+            // The archive has been replaced by one with the same size and
+            // modification time, e.g. a copy with preserved timestamps.  The
+            // entry may be in use by a long-running process, so rather than
+            // waiting to refresh it, we use it as it is.
+            if (!lock.try_lock()) {
+                if (!lock.lock_sharable()) continue;
+                if (!matches_except_inode(read_fingerprint_file(fingerprintFile), fingerprint)) {
+                    lock.unlock_sharable();
+                    continue;
+                }
+                BOOST_LOG_SEV(cosim::log::logger(), cosim::log::info)
+                    << "Cache entry " << entryDir << " is in use; using it for "
+                    << archivePath << ", which has the same size and modification time";
+                return lock;
+            }
+        } else if (!lock.try_lock()) {
+            // The entry is incomplete, so it is only locked by processes
+            // which are about to unpack the archive themselves.
+            BOOST_LOG_SEV(cosim::log::logger(), cosim::log::info)
+                << "Waiting for another process to unpack " << archivePath;
+            if (!lock.lock()) continue;
+        }
+
+        // Another process may have refreshed the entry while we waited.
+        if (read_fingerprint_file(fingerprintFile) != fingerprint) {
+            BOOST_LOG_SEV(cosim::log::logger(), cosim::log::info)
+                << "Unpacking " << archivePath << " to " << entryDir;
+            COSIM_PROBE1(fmu__unpack__start, archivePath.string().c_str());
+            cosim::filesystem::remove_all(entryDir);
+            extract_archive(archivePath, entryDir / entryContentSubdir);
+            COSIM_PROBE1(fmu__unpack__done, archivePath.string().c_str());
+            // Written last, so an interrupted unpacking is never
+            // mistaken for a complete one.
+            write_fingerprint_file(fingerprintFile, fingerprint);
+        }
+        lock.unlock();
+        if (!lock.lock_sharable()) continue;
+        return lock;
+    }
+}
+
+
+// A model backed by an FMU that has been unpacked into the cache.  For the
+// writable user cache, it holds a shared lock on the cache entry for as long
+// as the model is alive, so that `clean_cache()` won't remove the files from
+// under it.  Entries in read-only shared caches are used without locking.
+class cached_fmu_model : public cosim::model
+{
+public:
+    cached_fmu_model(
+        std::shared_ptr<cosim::fmi::fmu> fmu,
+        std::optional<entry_lock> lock)
+        : fmu_(std::move(fmu))
+        , lock_(std::move(lock))
+    {}
+
+    std::shared_ptr<const cosim::model_description> description() const noexcept override
+    {
+        return fmu_->model_description();
+    }
+
+    std::shared_ptr<cosim::slave> instantiate(std::string_view name) override
+    {
+        return fmu_->instantiate_slave(name);
+    }
+
+private:
+    std::shared_ptr<cosim::fmi::fmu> fmu_;
+    std::optional<entry_lock> lock_;
+};
+
+
+// A sub-resolver for local FMU files which unpacks each FMU into its own
+// cache entry, named with `entry_name()`, with `lock_unpacked_entry()`.
+//
+// Before the (writable) user cache is consulted, the resolver looks for a
+// matching entry in each of the read-only shared caches, in order.  Shared
+// caches have the same layout as the user cache, and entries found there
+// are used in place.
+class fmu_cache_sub_resolver : public cosim::model_uri_sub_resolver
+{
+public:
+    fmu_cache_sub_resolver(
+        const cosim::filesystem::path& cacheRoot,
+        std::vector<cosim::filesystem::path> sharedCacheRoots)
+        : cacheRoot_(cacheRoot)
+        , sharedCacheRoots_(std::move(sharedCacheRoots))
+        , importer_(cosim::fmi::importer::create())
+    {}
+
+    std::shared_ptr<cosim::model> lookup_model(const cosim::uri& modelUri) override
+    {
+        const auto path = local_fmu_path(modelUri);
+        if (!path) return nullptr;
+        COSIM_PROBE1(fmu__lookup__start, path->string().c_str());
+        const auto fingerprint = fingerprint_file(*path);
+
+        std::lock_guard<std::mutex> guard(mutex_);
+
+        // If this process already uses the FMU, we reuse that model unless
+        // the archive has changed in the meantime, in which case the new
+        // archive gets a cache entry of its own.  Like
+        // `lock_unpacked_entry()`, we accept an archive which only differs
+        // in its inode number, since it has the same entry as the old one.
+        auto& loaded = models_[fingerprint.path];
+        if (auto model = loaded.model.lock()) {
+            if (matches_except_inode(loaded.fingerprint, fingerprint)) {
+                COSIM_PROBE1(fmu__lookup__done, path->string().c_str());
+                return model;
+            }
+            BOOST_LOG_SEV(cosim::log::logger(), cosim::log::info)
+                << *path << " has changed since it was loaded; loading it anew";
+        }
+
+        auto model = load(*path, entry_name(fingerprint), fingerprint);
+        loaded = {fingerprint, model};
+        COSIM_PROBE1(fmu__lookup__done, path->string().c_str());
+        return model;
+    }
+
+private:
+    std::shared_ptr<cosim::model> load(
+        const cosim::filesystem::path& fmuPath,
+        const std::string& key,
+        const file_fingerprint& fingerprint)
+    {
+        for (const auto& sharedRoot : sharedCacheRoots_) {
+            const auto sharedEntryDir = sharedRoot / key;
+            const auto sharedFingerprint =
+                read_fingerprint_file(sharedEntryDir / entryFingerprintFile);
+            // Shared caches are typically populated on a different machine,
+            // so inode numbers are not expected to match.
+            if (matches_except_inode(sharedFingerprint, fingerprint)) {
+                BOOST_LOG_SEV(cosim::log::logger(), cosim::log::debug)
+                    << "Using shared cache entry " << sharedEntryDir
+                    << " for " << fmuPath;
+                auto fmu = importer_->import_unpacked(sharedEntryDir / entryContentSubdir);
+                return std::make_shared<cached_fmu_model>(std::move(fmu), std::nullopt);
+            }
+        }
+
+        cosim::filesystem::create_directories(cacheRoot_);
+        const auto entryDir = cacheRoot_ / key;
+        auto lock = lock_unpacked_entry(fmuPath, entryDir, fingerprint);
+        auto fmu = importer_->import_unpacked(entryDir / entryContentSubdir);
+        return std::make_shared<cached_fmu_model>(std::move(fmu), std::move(lock));
+    }
+
+    cosim::filesystem::path cacheRoot_;
+    std::vector<cosim::filesystem::path> sharedCacheRoots_;
+    std::shared_ptr<cosim::fmi::importer> importer_;
+    // A model that has been loaded by this process, and the fingerprint of
+    // the archive it was loaded from.
+    struct loaded_model
+    {
+        file_fingerprint fingerprint;
+        std::weak_ptr<cosim::model> model;
+    };
+
+    std::mutex mutex_;
+    std::unordered_map<std::string, loaded_model> models_;
+};
+
+
+// A sub-resolver that forwards lookups to a full model URI resolver.
+// Used to fall back to libcosim's default resolution mechanisms for
+// URIs that are not handled by our own sub-resolvers.
+class fallback_sub_resolver : public cosim::model_uri_sub_resolver
+{
+public:
+    explicit fallback_sub_resolver(std::shared_ptr<cosim::model_uri_resolver> resolver)
+        : resolver_(std::move(resolver))
+    {}
+
+    std::shared_ptr<cosim::model> lookup_model(const cosim::uri& modelUri) override
+    {
+        return resolver_->lookup_model(modelUri);
+    }
+
+private:
+    std::shared_ptr<cosim::model_uri_resolver> resolver_;
+};
+
+
+// Returns the cache entry that a directory entry in a cache subdirectory
+// belongs to.  This is the directory itself, or, for a lock file whose
+// entry no longer exists, e.g. because unpacking failed, the path the
+// entry would have.  Returns an empty object for anything else, including
+// lock files of existing entries, which are handled along with the entries.
+std::optional<cosim::filesystem::path> locked_entry_path(
+    const cosim::filesystem::directory_entry& entry)
+{
+    // The lock file of an entry may already have been removed along with
+    // the entry itself.
+    if (!cosim::filesystem::exists(entry.path())) return std::nullopt;
+    auto entryDir = entry.path();
+    if (!entry.is_directory()) {
+        if (entryDir.extension() != ".lock") return std::nullopt;
+        entryDir.replace_extension();
+        if (cosim::filesystem::exists(entryDir)) return std::nullopt;
+    }
+    return entryDir;
+}
+
+
+// Removes the cache entry in `entryDir` along with its lock file, unless
+// the entry is in use by some process.
+void remove_unused_entry(const cosim::filesystem::path& entryDir)
+{
+    entry_lock lock(entryDir);
+    if (lock.try_lock()) {
+        cosim::filesystem::remove_all(entryDir);
+        lock.remove_file();
+        lock.unlock();
+    } else {
+        BOOST_LOG_SEV(cosim::log::logger(), cosim::log::debug)
+            << "Cache entry in use; not removing: " << entryDir;
+    }
+}
+
+
+// Removes all entries with unpacked FMUs or other archives which are not
+// in use by some process, along with their lock files.
+void clean_unpacked_entries(const cosim::filesystem::path& cacheRoot)
+{
+    if (!cosim::filesystem::is_directory(cacheRoot)) return;
+    for (const auto& entry : cosim::filesystem::directory_iterator(cacheRoot)) {
+        if (const auto entryDir = locked_entry_path(entry)) remove_unused_entry(*entryDir);
+    }
+}
+
+
+// Removes all memoized simulation results, and all recordings of new
+// results which are not in progress in some process.  Only recordings are
+// locked, since stored results are never modified.
+void clean_memoized_results(const cosim::filesystem::path& resultsRoot)
+{
+    if (!cosim::filesystem::is_directory(resultsRoot)) return;
+    for (const auto& entry : cosim::filesystem::directory_iterator(resultsRoot)) {
+        const auto entryDir = locked_entry_path(entry);
+        if (!entryDir) continue;
+        if (entryDir->extension() == ".recording" || !cosim::filesystem::exists(*entryDir)) {
+            remove_unused_entry(*entryDir);
+        } else {
+            cosim::filesystem::remove_all(*entryDir);
+        }
+    }
+}
+
 } // namespace
 
 
+struct unpacked_archive::lock
+{
+    entry_lock entryLock;
+};
+
+
+struct cache_entry_lock::impl
+{
+    cosim::filesystem::path entryDir;
+    entry_lock lock;
+};
+
+
+cache_entry_lock::cache_entry_lock(const cosim::filesystem::path& entryDir)
+{
+    for (;;) {
+        entry_lock lock(entryDir);
+        if (lock.lock_sharable()) {
+            impl_ = std::make_unique<impl>(impl{entryDir, std::move(lock)});
+            return;
+        }
+    }
+}
+
+
+cache_entry_lock::~cache_entry_lock() noexcept
+{
+    if (!impl_) return;
+    try {
+        auto& lock = impl_->lock;
+        lock.unlock_sharable();
+        // If the entry is gone and no one else uses it, we clean up after
+        // it, so the lock file doesn't have to wait for `clean_cache()`.
+        if (!cosim::filesystem::exists(impl_->entryDir) && lock.try_lock()) {
+            lock.remove_file();
+            lock.unlock();
+        }
+    } catch (...) {
+        // The lock file is left for `clean_cache()`.
+    }
+}
+
+
+cache_entry_lock::cache_entry_lock(cache_entry_lock&&) noexcept = default;
+cache_entry_lock& cache_entry_lock::operator=(cache_entry_lock&&) noexcept = default;
+
+
+unpacked_archive::unpacked_archive(
+    cosim::filesystem::path directory,
+    std::shared_ptr<lock> lock)
+    : directory_(std::move(directory))
+    , lock_(std::move(lock))
+{}
+
+
+const cosim::filesystem::path& unpacked_archive::directory() const noexcept
+{
+    return directory_;
+}
+
+
+std::optional<unpacked_archive> unpack_to_cache(const cosim::filesystem::path& archivePath)
+{
+    const auto cachePath = cache_directory_path();
+    if (!cachePath) return std::nullopt;
+    const auto fingerprint = fingerprint_file(archivePath);
+    const auto cacheRoot = *cachePath / archiveCacheSubdir;
+    cosim::filesystem::create_directories(cacheRoot);
+    const auto entryDir = cacheRoot / entry_name(fingerprint);
+    auto entryLock = lock_unpacked_entry(archivePath, entryDir, fingerprint);
+    return unpacked_archive(
+        entryDir / entryContentSubdir,
+        std::make_shared<unpacked_archive::lock>(unpacked_archive::lock{std::move(entryLock)}));
+}
+
+
 std::shared_ptr<cosim::model_uri_resolver> caching_model_uri_resolver()
 {
     if (const auto cachePath = cache_directory_path()) {
         const auto cache = std::make_shared<cosim::persistent_file_cache>(*cachePath);
         BOOST_LOG_SEV(cosim::log::logger(), cosim::log::info)
             << "Using cache directory: " << *cachePath;
-        return cosim::default_model_uri_resolver(cache);
+        std::vector<cosim::filesystem::path> sharedFMUCachePaths;
+        for (const auto& sharedCachePath : shared_cache_directory_paths()) {
+            BOOST_LOG_SEV(cosim::log::logger(), cosim::log::info)
+                << "Using shared cache directory: " << sharedCachePath;
+            sharedFMUCachePaths.push_back(sharedCachePath / fmuCacheSubdir);
+        }
+        auto resolver = std::make_shared<cosim::model_uri_resolver>();
+        resolver->add_sub_resolver(
+            std::make_shared<fmu_cache_sub_resolver>(
+                *cachePath / fmuCacheSubdir,
+                std::move(sharedFMUCachePaths)));
+        resolver->add_sub_resolver(
+            std::make_shared<fallback_sub_resolver>(
+                cosim::default_model_uri_resolver(cache)));
+        return resolver;
     } else {
         BOOST_LOG_SEV(cosim::log::logger(), cosim::log::warning)
             << "Unable to determine user cache directory; caching is disabled.";
@@ -93,9 +631,45 @@ void clean_cache()
         const auto cache = std::make_shared<cosim::persistent_file_cache>(*cachePath);
         BOOST_LOG_SEV(cosim::log::logger(), cosim::log::info)
             << "Cleaning cache directory: " << *cachePath;
+        clean_unpacked_entries(*cachePath / fmuCacheSubdir);
+        clean_unpacked_entries(*cachePath / archiveCacheSubdir);
+        // Parsed system structures are cheap to recreate, so we simply
+        // remove all of them.
+        cosim::filesystem::remove_all(*system_config_cache_path());
+        clean_memoized_results(*memoized_results_path());
         cache->cleanup();
     } else {
         throw std::runtime_error(
             "Unable to determine user cache directory; cannot delete it.");
     }
 }
+
+
+std::optional<cosim::filesystem::path> model_index_path()
+{
+    if (const auto cachePath = cache_directory_path()) {
+        return *cachePath / "model-index.cbor";
+    } else {
+        return std::nullopt;
+    }
+}
+
+
+std::optional<cosim::filesystem::path> system_config_cache_path()
+{
+    if (const auto cachePath = cache_directory_path()) {
+        return *cachePath / "systems";
+    } else {
+        return std::nullopt;
+    }
+}
+
+
+std::optional<cosim::filesystem::path> memoized_results_path()
+{
+    if (const auto cachePath = cache_directory_path()) {
+        return *cachePath / "results";
+    } else {
+        return std::nullopt;
+    }
+}
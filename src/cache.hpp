@@ -6,17 +6,102 @@
 #ifndef COSIM_CACHE_HPP
 #define COSIM_CACHE_HPP
 
+#include <cosim/fs_portability.hpp>
 #include <cosim/orchestration.hpp>
 
 #include <memory>
+#include <optional>
 
 
 /// Returns a caching model URI resolver.
 std::shared_ptr<cosim::model_uri_resolver> caching_model_uri_resolver();
 
 
+/**
+ *  A shared lock on an entry in the application cache directory, which
+ *  keeps `clean_cache()` from removing the entry while the lock is held.
+ *
+ *  The lock is held in a file next to the entry, named after the entry
+ *  with the extension `.lock`.  If the entry no longer exists when the lock
+ *  is released, the lock file is removed too.
+ */
+class cache_entry_lock
+{
+public:
+    /// Locks the entry in `entryDir`, which need not exist yet.
+    explicit cache_entry_lock(const cosim::filesystem::path& entryDir);
+
+    ~cache_entry_lock() noexcept;
+
+    cache_entry_lock(cache_entry_lock&&) noexcept;
+    cache_entry_lock& operator=(cache_entry_lock&&) noexcept;
+
+    struct impl;
+
+private:
+    std::unique_ptr<impl> impl_;
+};
+
+
+/**
+ *  A ZIP archive, such as an SSP file, which has been unpacked into the
+ *  application cache directory.  The unpacked files stay in place, and are
+ *  not removed by `clean_cache()`, for the lifetime of the object.
+ */
+class unpacked_archive
+{
+public:
+    struct lock;
+
+    unpacked_archive(cosim::filesystem::path directory, std::shared_ptr<lock> lock);
+
+    /// The directory that holds the contents of the archive.
+    const cosim::filesystem::path& directory() const noexcept;
+
+private:
+    cosim::filesystem::path directory_;
+    std::shared_ptr<lock> lock_;
+};
+
+
+/**
+ *  Unpacks an archive into the application cache directory, or reuses an
+ *  earlier unpacking if the archive is unchanged since then.
+ *
+ *  The entry is keyed on the path, size and modification time of the
+ *  archive, so the unpacked files get the same paths every time as long as
+ *  the archive is unchanged.  Returns an empty object if the cache
+ *  directory could not be determined.
+ */
+std::optional<unpacked_archive> unpack_to_cache(const cosim::filesystem::path& archivePath);
+
+
 /// Removes unused data from the application cache directory.
 void clean_cache();
 
 
+/**
+ *  Returns the path to the model index file in the application cache
+ *  directory, or an empty object if the cache directory could not be
+ *  determined.
+ */
+std::optional<cosim::filesystem::path> model_index_path();
+
+
+/**
+ *  Returns the path to the directory in the application cache directory
+ *  where parsed system structures are stored, or an empty object if the
+ *  cache directory could not be determined.
+ */
+std::optional<cosim::filesystem::path> system_config_cache_path();
+
+
+/**
+ *  Returns the path to the directory in the application cache directory
+ *  where memoized simulation results are stored, or an empty object if
+ *  the cache directory could not be determined.
+ */
+std::optional<cosim::filesystem::path> memoized_results_path();
+
+
 #endif // header guard
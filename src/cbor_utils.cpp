@@ -0,0 +1,244 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#include "cbor_utils.hpp"
+
+#include "tools.hpp"
+
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+
+namespace
+{
+
+cbor_item_ptr checked(cbor_item_t* item)
+{
+    if (!item) throw std::bad_alloc();
+    return cbor_item_ptr(item);
+}
+
+[[noreturn]] void throw_type_error(const char* expected)
+{
+    throw std::runtime_error(std::string("Invalid CBOR data: expected ") + expected);
+}
+
+} // namespace
+
+
+cbor_item_ptr make_cbor_map(std::size_t size)
+{
+    return checked(cbor_new_definite_map(size));
+}
+
+
+cbor_item_ptr make_cbor_array(std::size_t size)
+{
+    return checked(cbor_new_definite_array(size));
+}
+
+
+cbor_item_ptr make_cbor_string(std::string_view value)
+{
+    return checked(cbor_build_stringn(value.data(), value.size()));
+}
+
+
+cbor_item_ptr make_cbor_int(std::int64_t value)
+{
+    if (value >= 0) return make_cbor_uint(static_cast<std::uint64_t>(value));
+    // CBOR encodes a negative integer n as -1-n.
+    return checked(cbor_build_negint64(static_cast<std::uint64_t>(-1 - value)));
+}
+
+
+cbor_item_ptr make_cbor_uint(std::uint64_t value)
+{
+    return checked(cbor_build_uint64(value));
+}
+
+
+cbor_item_ptr make_cbor_double(double value)
+{
+    return checked(cbor_build_float8(value));
+}
+
+
+cbor_item_ptr make_cbor_bool(bool value)
+{
+    return checked(cbor_build_bool(value));
+}
+
+
+cbor_item_ptr make_cbor_scalar(const cosim::scalar_value& value)
+{
+    return std::visit(
+        [](const auto& x) -> cbor_item_ptr {
+            using T = std::decay_t<decltype(x)>;
+            if constexpr (std::is_same_v<T, double>) {
+                return make_cbor_double(x);
+            } else if constexpr (std::is_same_v<T, int>) {
+                return make_cbor_int(x);
+            } else if constexpr (std::is_same_v<T, bool>) {
+                return make_cbor_bool(x);
+            } else {
+                return make_cbor_string(x);
+            }
+        },
+        value);
+}
+
+
+cbor_item_ptr share_cbor_item(const cbor_item_t* item)
+{
+    // libcbor's reference counting ignores constness.
+    return cbor_item_ptr(cbor_incref(const_cast<cbor_item_t*>(item)));
+}
+
+
+void add_to_cbor_map(cbor_item_t* map, std::string_view key, cbor_item_ptr value)
+{
+    auto keyItem = make_cbor_string(key);
+    // cbor_map_add() increments the reference counts of the key and value,
+    // and our smart pointers release their own references.
+    if (!cbor_map_add(map, cbor_pair{keyItem.get(), value.get()})) {
+        throw std::bad_alloc();
+    }
+}
+
+
+void append_to_cbor_array(cbor_item_t* array, cbor_item_ptr item)
+{
+    if (!cbor_array_push(array, item.get())) throw std::bad_alloc();
+}
+
+
+const cbor_item_t* find_in_cbor_map(const cbor_item_t* map, std::string_view key)
+{
+    if (!cbor_isa_map(map)) throw_type_error("map");
+    const auto pairs = cbor_map_handle(map);
+    const auto size = cbor_map_size(map);
+    for (std::size_t i = 0; i < size; ++i) {
+        if (cbor_isa_string(pairs[i].key) && get_cbor_string(pairs[i].key) == key) {
+            return pairs[i].value;
+        }
+    }
+    return nullptr;
+}
+
+
+const cbor_item_t* get_from_cbor_map(const cbor_item_t* map, std::string_view key)
+{
+    const auto value = find_in_cbor_map(map, key);
+    if (!value) {
+        throw std::runtime_error(
+            "Invalid CBOR data: missing key '" + std::string(key) + "'");
+    }
+    return value;
+}
+
+
+std::size_t get_cbor_array_size(const cbor_item_t* array)
+{
+    if (!cbor_isa_array(array)) throw_type_error("array");
+    return cbor_array_size(array);
+}
+
+
+const cbor_item_t* get_cbor_array_element(const cbor_item_t* array, std::size_t index)
+{
+    if (index >= get_cbor_array_size(array)) throw_type_error("longer array");
+    return cbor_array_handle(array)[index];
+}
+
+
+std::string get_cbor_string(const cbor_item_t* item)
+{
+    if (!cbor_isa_string(item) || !cbor_string_is_definite(item)) {
+        throw_type_error("definite string");
+    }
+    return std::string(
+        reinterpret_cast<const char*>(cbor_string_handle(item)),
+        cbor_string_length(item));
+}
+
+
+std::int64_t get_cbor_int(const cbor_item_t* item)
+{
+    if (cbor_isa_uint(item)) return static_cast<std::int64_t>(cbor_get_int(item));
+    if (cbor_isa_negint(item)) return -1 - static_cast<std::int64_t>(cbor_get_int(item));
+    throw_type_error("integer");
+}
+
+
+std::uint64_t get_cbor_uint(const cbor_item_t* item)
+{
+    if (!cbor_isa_uint(item)) throw_type_error("unsigned integer");
+    return cbor_get_int(item);
+}
+
+
+double get_cbor_double(const cbor_item_t* item)
+{
+    if (!cbor_isa_float_ctrl(item) || !cbor_is_float(item)) throw_type_error("float");
+    return cbor_float_get_float(item);
+}
+
+
+bool get_cbor_bool(const cbor_item_t* item)
+{
+    if (!cbor_is_bool(item)) throw_type_error("boolean");
+    return cbor_get_bool(item);
+}
+
+
+cosim::scalar_value get_cbor_scalar(const cbor_item_t* item, cosim::variable_type type)
+{
+    switch (type) {
+        case cosim::variable_type::real:
+            return get_cbor_double(item);
+        case cosim::variable_type::integer:
+        case cosim::variable_type::enumeration:
+            return static_cast<int>(get_cbor_int(item));
+        case cosim::variable_type::boolean:
+            return get_cbor_bool(item);
+        case cosim::variable_type::string:
+            return get_cbor_string(item);
+    }
+    throw std::runtime_error("Invalid CBOR data: unknown variable type");
+}
+
+
+void write_cbor_file(const cosim::filesystem::path& file, const cbor_item_t* item)
+{
+    unsigned char* buffer = nullptr;
+    std::size_t bufferSize = 0;
+    const auto length = cbor_serialize_alloc(item, &buffer, &bufferSize);
+    const auto bufferOwner = std::unique_ptr<unsigned char, decltype(&std::free)>(buffer, &std::free);
+    if (length == 0) throw std::bad_alloc();
+    write_file_atomically(
+        file,
+        std::string_view(reinterpret_cast<const char*>(buffer), length));
+}
+
+
+cbor_item_ptr read_cbor_file(const cosim::filesystem::path& file)
+{
+    std::ifstream stream(file.string(), std::ios::binary);
+    if (!stream) return nullptr;
+    const auto data = std::vector<unsigned char>(
+        std::istreambuf_iterator<char>(stream),
+        std::istreambuf_iterator<char>());
+    cbor_load_result result;
+    auto item = cbor_item_ptr(cbor_load(data.data(), data.size(), &result));
+    if (result.error.code != CBOR_ERR_NONE) return nullptr;
+    return item;
+}
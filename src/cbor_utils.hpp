@@ -0,0 +1,101 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#ifndef COSIM_CBOR_UTILS_HPP
+#define COSIM_CBOR_UTILS_HPP
+
+#include <cbor.h>
+#include <cosim/fs_portability.hpp>
+#include <cosim/model_description.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+
+/// Deleter for `cbor_item_ptr`.
+struct cbor_item_deleter
+{
+    void operator()(cbor_item_t* item) const noexcept { cbor_decref(&item); }
+};
+
+/// An owning pointer to a libcbor item.
+using cbor_item_ptr = std::unique_ptr<cbor_item_t, cbor_item_deleter>;
+
+
+/**
+ *  \name Item construction
+ *
+ *  These functions create new CBOR items.  They throw `std::bad_alloc` if
+ *  libcbor fails to allocate memory.
+ */
+///@{
+cbor_item_ptr make_cbor_map(std::size_t size);
+cbor_item_ptr make_cbor_array(std::size_t size);
+cbor_item_ptr make_cbor_string(std::string_view value);
+cbor_item_ptr make_cbor_int(std::int64_t value);
+cbor_item_ptr make_cbor_uint(std::uint64_t value);
+cbor_item_ptr make_cbor_double(double value);
+cbor_item_ptr make_cbor_bool(bool value);
+cbor_item_ptr make_cbor_scalar(const cosim::scalar_value& value);
+
+/// Returns a new reference to an existing item, so it can be added to another one.
+cbor_item_ptr share_cbor_item(const cbor_item_t* item);
+
+/// Adds a key-value pair to a definite map created with `make_cbor_map()`.
+void add_to_cbor_map(cbor_item_t* map, std::string_view key, cbor_item_ptr value);
+
+/// Appends an item to a definite array created with `make_cbor_array()`.
+void append_to_cbor_array(cbor_item_t* array, cbor_item_ptr item);
+///@}
+
+
+/**
+ *  \name Item access
+ *
+ *  These functions extract values from CBOR items.  They throw
+ *  `std::runtime_error` if the item is not of the expected type.
+ */
+///@{
+/// Returns the value with the given key in a map, or null if there is none.
+const cbor_item_t* find_in_cbor_map(const cbor_item_t* map, std::string_view key);
+
+/// Like `find_in_cbor_map()`, but throws if the key is not found.
+const cbor_item_t* get_from_cbor_map(const cbor_item_t* map, std::string_view key);
+
+std::size_t get_cbor_array_size(const cbor_item_t* array);
+const cbor_item_t* get_cbor_array_element(const cbor_item_t* array, std::size_t index);
+std::string get_cbor_string(const cbor_item_t* item);
+std::int64_t get_cbor_int(const cbor_item_t* item);
+std::uint64_t get_cbor_uint(const cbor_item_t* item);
+double get_cbor_double(const cbor_item_t* item);
+bool get_cbor_bool(const cbor_item_t* item);
+
+/// Reads a value written with `make_cbor_scalar()`, which must be of type `type`.
+cosim::scalar_value get_cbor_scalar(const cbor_item_t* item, cosim::variable_type type);
+///@}
+
+
+/**
+ *  Serialises a CBOR item and writes it to a file.
+ *
+ *  The file is replaced atomically, so concurrent readers never see a
+ *  partially written file.
+ */
+void write_cbor_file(const cosim::filesystem::path& file, const cbor_item_t* item);
+
+
+/**
+ *  Reads and parses a CBOR file.
+ *
+ *  Returns null if the file does not exist or does not contain valid CBOR
+ *  data.
+ */
+cbor_item_ptr read_cbor_file(const cosim::filesystem::path& file);
+
+
+#endif
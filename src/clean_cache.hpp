@@ -33,6 +33,8 @@ public:
                "so they don't have to be unpacked over and over for each run.  "
                "This can be a major time saver, "
                "especially when working with large FMUs.  "
+               "The cache also holds simulation results stored by "
+               "'run --memoize'.  "
                "Over time, however, the cache can grow to take up "
                "a significant amount of disk space.\n"
                "\n"
@@ -43,7 +45,18 @@ public:
                "The location of the cache can be set using the environment "
                "variable COSIM_CACHE_PATH.  "
                "If this is not defined, the (platform-specific) default "
-               "application cache path for the current user will be used instead.";
+               "application cache path for the current user will be used instead.\n"
+               "\n"
+               "In addition, one or more read-only, shared caches may be specified "
+               "with the environment variable COSIM_SHARED_CACHE_PATH, "
+               "as a list of directories separated by the platform's path "
+               "list separator.  "
+               "These are consulted before the user cache when looking up "
+               "unpacked FMUs, and they are never modified by this command.  "
+               "A shared cache is populated by running cosim with "
+               "COSIM_CACHE_PATH set to the shared cache directory, "
+               "with the FMUs located at the same paths as where they will "
+               "later be used.";
     }
 
     void setup_options(
@@ -0,0 +1,112 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#include "fingerprint.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+#ifndef _WIN32
+#    include <sys/stat.h>
+#endif
+
+
+bool operator==(const file_fingerprint& a, const file_fingerprint& b) noexcept
+{
+    return a.path == b.path &&
+        a.size == b.size &&
+        a.mtime == b.mtime &&
+        a.inode == b.inode;
+}
+
+
+bool operator!=(const file_fingerprint& a, const file_fingerprint& b) noexcept
+{
+    return !(a == b);
+}
+
+
+file_fingerprint fingerprint_file(const cosim::filesystem::path& path)
+{
+    file_fingerprint fp;
+    fp.path = cosim::filesystem::canonical(path).string();
+    fp.size = cosim::filesystem::file_size(path);
+    fp.mtime = static_cast<std::int64_t>(
+        cosim::filesystem::last_write_time(path).time_since_epoch().count());
+#ifndef _WIN32
+    struct stat st;
+    if (::stat(fp.path.c_str(), &st) != 0) {
+        throw std::runtime_error("Unable to obtain file status: " + fp.path);
+    }
+    fp.inode = static_cast<std::uint64_t>(st.st_ino);
+#endif
+    return fp;
+}
+
+
+void write_fingerprint_file(
+    const cosim::filesystem::path& file,
+    const file_fingerprint& fingerprint)
+{
+    std::ofstream stream;
+    stream.exceptions(std::ofstream::badbit | std::ofstream::failbit);
+    stream.open(file.string(), std::ios::trunc);
+    stream
+        << "path=" << fingerprint.path << '\n'
+        << "size=" << fingerprint.size << '\n'
+        << "mtime=" << fingerprint.mtime << '\n'
+        << "inode=" << fingerprint.inode << '\n';
+}
+
+
+std::optional<file_fingerprint> read_fingerprint_file(
+    const cosim::filesystem::path& file)
+{
+    std::ifstream stream(file.string());
+    if (!stream) return std::nullopt;
+
+    file_fingerprint fp;
+    int fieldsRead = 0;
+    try {
+        for (std::string line; std::getline(stream, line);) {
+            const auto equalsPos = line.find('=');
+            if (equalsPos == std::string::npos) return std::nullopt;
+            const auto key = line.substr(0, equalsPos);
+            const auto value = line.substr(equalsPos + 1);
+            if (key == "path") {
+                fp.path = value;
+            } else if (key == "size") {
+                fp.size = std::stoull(value);
+            } else if (key == "mtime") {
+                fp.mtime = std::stoll(value);
+            } else if (key == "inode") {
+                fp.inode = std::stoull(value);
+            } else {
+                return std::nullopt;
+            }
+            ++fieldsRead;
+        }
+    } catch (const std::logic_error&) {
+        // Thrown by std::stoull()/std::stoll() on invalid input
+        return std::nullopt;
+    }
+    if (fieldsRead != 4) return std::nullopt;
+    return fp;
+}
+
+
+std::string hash_string(std::string_view data)
+{
+    // 64-bit FNV-1a
+    std::uint64_t hash = 0xcbf29ce484222325ull;
+    for (const unsigned char c : data) {
+        hash ^= c;
+        hash *= 0x100000001b3ull;
+    }
+    char hex[17];
+    std::snprintf(hex, sizeof hex, "%016llx", static_cast<unsigned long long>(hash));
+    return hex;
+}
@@ -0,0 +1,71 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#ifndef COSIM_FINGERPRINT_HPP
+#define COSIM_FINGERPRINT_HPP
+
+#include <cosim/fs_portability.hpp>
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+
+/**
+ *  A cheap identification of a particular version of a file.
+ *
+ *  The fingerprint is based on file system metadata only, so it can be
+ *  obtained without reading the file contents.  Two fingerprints compare
+ *  equal if all of their fields are equal.
+ */
+struct file_fingerprint
+{
+    /// The absolute, canonical path to the file.
+    std::string path;
+
+    /// The file size in bytes.
+    std::uintmax_t size = 0;
+
+    /// The last modification time, in ticks of the file system clock.
+    std::int64_t mtime = 0;
+
+    /// The inode number, or zero on platforms where this is not available.
+    std::uint64_t inode = 0;
+};
+
+bool operator==(const file_fingerprint& a, const file_fingerprint& b) noexcept;
+bool operator!=(const file_fingerprint& a, const file_fingerprint& b) noexcept;
+
+
+/// Obtains the fingerprint of the file at `path`.
+file_fingerprint fingerprint_file(const cosim::filesystem::path& path);
+
+
+/// Writes a fingerprint to a (text) file.
+void write_fingerprint_file(
+    const cosim::filesystem::path& file,
+    const file_fingerprint& fingerprint);
+
+
+/**
+ *  Reads a fingerprint from a file written by `write_fingerprint_file()`.
+ *
+ *  Returns an empty object if the file does not exist or could not be
+ *  parsed.
+ */
+std::optional<file_fingerprint> read_fingerprint_file(
+    const cosim::filesystem::path& file);
+
+
+/**
+ *  Returns a hexadecimal string representation of a (non-cryptographic)
+ *  64-bit hash of `data`.  The result is stable across program runs and
+ *  platforms, so it is suitable for use as a persistent key.
+ */
+std::string hash_string(std::string_view data);
+
+
+#endif
@@ -0,0 +1,240 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#include "flight_recorder.hpp"
+
+#include "tools.hpp"
+
+#include <cosim/log/logger.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+
+
+namespace
+{
+
+// Set by the signal handler when the simulation should stop.
+volatile std::sig_atomic_t terminationRequested = 0;
+
+extern "C" void handle_termination_signal(int signal)
+{
+    terminationRequested = 1;
+    // In case the simulation never gets to the end of the macro step.
+    std::signal(signal, SIG_DFL);
+}
+
+// The number of words before the values in a frame: time and step number.
+constexpr std::size_t frameHeaderSize = 2;
+
+std::uint64_t to_word(double value) noexcept
+{
+    std::uint64_t word;
+    std::memcpy(&word, &value, sizeof word);
+    return word;
+}
+
+std::uint64_t to_word(std::int64_t value) noexcept
+{
+    return static_cast<std::uint64_t>(value);
+}
+
+void append_integer(std::string& out, std::uint64_t value, int size)
+{
+    for (int i = 0; i < size; ++i) {
+        out += static_cast<char>((value >> (8 * i)) & 0xFF);
+    }
+}
+
+void append_string(std::string& out, std::string_view str)
+{
+    append_integer(out, str.size(), 4);
+    out += str;
+}
+
+} // namespace
+
+
+flight_recorder::flight_recorder(cosim::duration window)
+    : window_(window)
+{
+    terminationRequested = 0;
+    previousHandler_ = std::signal(SIGTERM, handle_termination_signal);
+    if (previousHandler_ == SIG_ERR) previousHandler_ = SIG_DFL;
+}
+
+
+flight_recorder::~flight_recorder() noexcept
+{
+    std::signal(SIGTERM, previousHandler_);
+}
+
+
+void flight_recorder::dump(const cosim::filesystem::path& file) const noexcept
+{
+    try {
+        std::string out = "COSIMFR1";
+        append_integer(out, simulators_.size(), 4);
+        std::size_t frameCount = 0;
+        for (const auto& [index, s] : simulators_) {
+            append_string(out, s.name);
+            append_integer(out, s.reals.size(), 4);
+            append_integer(out, s.integers.size(), 4);
+            append_integer(out, s.booleans.size(), 4);
+            for (const auto* variables : {&s.reals, &s.integers, &s.booleans}) {
+                for (const auto& v : *variables) {
+                    append_string(out, v.name);
+                    append_integer(out, v.reference, 4);
+                }
+            }
+
+            // Frames that were kept only because there was no newer one
+            // to overwrite them with are left out.
+            const auto capacity = s.count > 0 ? s.frames.size() / s.frameSize : 0;
+            const auto frame = [&](std::size_t i) {
+                return s.frames.data() + ((s.first + i) % capacity) * s.frameSize;
+            };
+            std::size_t skip = 0;
+            if (s.count > 0) {
+                const auto oldest = static_cast<std::int64_t>(frame(s.count - 1)[0]) -
+                    window_.count();
+                while (static_cast<std::int64_t>(frame(skip)[0]) < oldest) ++skip;
+            }
+            append_integer(out, s.count - skip, 8);
+            for (auto i = skip; i < s.count; ++i) {
+                const auto f = frame(i);
+                for (std::size_t w = 0; w < s.frameSize; ++w) append_integer(out, f[w], 8);
+            }
+            frameCount += s.count - skip;
+        }
+        if (file.has_parent_path()) cosim::filesystem::create_directories(file.parent_path());
+        write_file_atomically(file, out);
+        BOOST_LOG_SEV(cosim::log::logger(), cosim::log::info)
+            << "Wrote " << frameCount << " recorded simulator steps to " << file;
+    } catch (const std::exception& e) {
+        BOOST_LOG_SEV(cosim::log::logger(), cosim::log::error)
+            << "Failed to write flight recorder file: " << e.what();
+    }
+}
+
+
+void flight_recorder::simulator_added(
+    cosim::simulator_index index,
+    cosim::observable* observable,
+    cosim::time_point)
+{
+    simulator_record s;
+    s.name = observable->name();
+    s.observable = observable;
+    for (const auto& v : observable->model_description().variables) {
+        switch (v.type) {
+            case cosim::variable_type::real:
+                s.reals.push_back({v.name, v.reference});
+                break;
+            case cosim::variable_type::integer:
+                s.integers.push_back({v.name, v.reference});
+                break;
+            case cosim::variable_type::boolean:
+                s.booleans.push_back({v.name, v.reference});
+                break;
+            default:
+                continue;
+        }
+        observable->expose_for_getting(v.type, v.reference);
+    }
+    s.frameSize = frameHeaderSize + s.reals.size() + s.integers.size() + s.booleans.size();
+    simulators_[index] = std::move(s);
+}
+
+
+void flight_recorder::simulator_removed(cosim::simulator_index index, cosim::time_point)
+{
+    // The values recorded so far are kept.
+    const auto it = simulators_.find(index);
+    if (it != simulators_.end()) it->second.observable = nullptr;
+}
+
+
+void flight_recorder::simulation_initialized(
+    cosim::step_number firstStep,
+    cosim::time_point startTime)
+{
+    for (auto& [index, s] : simulators_) record(s, firstStep, startTime);
+}
+
+
+void flight_recorder::step_complete(
+    cosim::step_number,
+    cosim::duration,
+    cosim::time_point)
+{
+    if (terminationRequested) {
+        throw std::runtime_error("Simulation stopped by termination signal");
+    }
+}
+
+
+void flight_recorder::simulator_step_complete(
+    cosim::simulator_index index,
+    cosim::step_number lastStep,
+    cosim::duration,
+    cosim::time_point currentTime)
+{
+    const auto it = simulators_.find(index);
+    if (it != simulators_.end()) record(it->second, lastStep, currentTime);
+}
+
+
+void flight_recorder::state_restored(cosim::step_number, cosim::time_point)
+{
+    // Logical time may have gone backwards, so the recorded values are
+    // no longer the most recent ones.
+    for (auto& [index, s] : simulators_) s.count = 0;
+}
+
+
+void flight_recorder::record(
+    simulator_record& s,
+    cosim::step_number step,
+    cosim::time_point time)
+{
+    if (!s.observable) return;
+    auto capacity = s.frames.size() / s.frameSize;
+    if (s.count == capacity) {
+        if (capacity > 0 &&
+            static_cast<std::int64_t>(s.frames[s.first * s.frameSize]) <
+                (time - window_).time_since_epoch().count()) {
+            // Overwrite the oldest frame.
+            s.first = (s.first + 1) % capacity;
+            --s.count;
+        } else {
+            // Grow the buffer, leaving the frames in order from the start.
+            std::vector<std::uint64_t> frames(
+                std::max<std::size_t>(16, 2 * capacity) * s.frameSize);
+            const auto split = s.frames.begin() + s.first * s.frameSize;
+            std::copy(s.frames.begin(), split,
+                std::copy(split, s.frames.end(), frames.begin()));
+            s.frames = std::move(frames);
+            s.first = 0;
+            capacity = s.frames.size() / s.frameSize;
+        }
+    }
+
+    auto f = s.frames.data() + ((s.first + s.count) % capacity) * s.frameSize;
+    *f++ = to_word(static_cast<std::int64_t>(time.time_since_epoch().count()));
+    *f++ = to_word(static_cast<std::int64_t>(step));
+    for (const auto& v : s.reals) *f++ = to_word(s.observable->get_real(v.reference));
+    for (const auto& v : s.integers) {
+        *f++ = to_word(static_cast<std::int64_t>(s.observable->get_integer(v.reference)));
+    }
+    for (const auto& v : s.booleans) {
+        *f++ = to_word(static_cast<std::int64_t>(s.observable->get_boolean(v.reference)));
+    }
+    ++s.count;
+}
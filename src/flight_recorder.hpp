@@ -0,0 +1,113 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#ifndef COSIM_FLIGHT_RECORDER_HPP
+#define COSIM_FLIGHT_RECORDER_HPP
+
+#include <cosim/fs_portability.hpp>
+#include <cosim/observer/observer.hpp>
+#include <cosim/time.hpp>
+
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+
+/**
+ *  An observer which keeps the values of all real, integer and boolean
+ *  variables from the most recent part of a simulation in memory, so that
+ *  they can be written to a file if the simulation fails.
+ *
+ *  Values are recorded after every step of every simulator, into one ring
+ *  buffer per simulator.  A buffer only grows until it spans the recording
+ *  window, after which the oldest values are overwritten, so recording
+ *  does not allocate memory in the steady state.
+ *
+ *  While the object exists, SIGTERM makes the simulation stop with an
+ *  exception at the end of the current macro step, instead of terminating
+ *  the program, so that the caller gets a chance to call `dump()`.  A
+ *  second SIGTERM terminates the program immediately.
+ *
+ *  The file written by `dump()` contains, in order, with all numbers in
+ *  little-endian byte order and each string as its length (`uint32`)
+ *  followed by its UTF-8 bytes:
+ *
+ *    - The 8 bytes `COSIMFR1`.
+ *    - The number of simulators (`uint32`), and for each simulator:
+ *        - Its name (string).
+ *        - The number of real, integer and boolean variables (3 `uint32`).
+ *        - The name (string) and value reference (`uint32`) of each
+ *          variable, reals first, then integers, then booleans.
+ *        - The number of recorded steps (`uint64`), and for each step,
+ *          oldest first, the logical time in nanoseconds and the step
+ *          number (2 `int64`), followed by one 8-byte value per variable,
+ *          as a `float64` for reals and an `int64` for integers and
+ *          booleans.
+ */
+class flight_recorder : public cosim::observer
+{
+public:
+    /// Starts recording values from the last `window` of logical time.
+    explicit flight_recorder(cosim::duration window);
+
+    flight_recorder(const flight_recorder&) = delete;
+    flight_recorder& operator=(const flight_recorder&) = delete;
+
+    ~flight_recorder() noexcept;
+
+    /// Writes the recorded values to `file`.  Errors are logged.
+    void dump(const cosim::filesystem::path& file) const noexcept;
+
+private:
+    struct variable
+    {
+        std::string name;
+        cosim::value_reference reference;
+    };
+
+    struct simulator_record
+    {
+        std::string name;
+        cosim::observable* observable = nullptr;
+        std::vector<variable> reals;
+        std::vector<variable> integers;
+        std::vector<variable> booleans;
+
+        // A ring buffer of `count` frames of `frameSize` words, starting
+        // at frame `first`.
+        std::vector<std::uint64_t> frames;
+        std::size_t frameSize = 0;
+        std::size_t first = 0;
+        std::size_t count = 0;
+    };
+
+    void simulator_added(cosim::simulator_index, cosim::observable*, cosim::time_point) override;
+    void simulator_removed(cosim::simulator_index, cosim::time_point) override;
+    void variables_connected(cosim::variable_id, cosim::variable_id, cosim::time_point) override {}
+    void variable_disconnected(cosim::variable_id, cosim::time_point) override {}
+    void simulation_initialized(cosim::step_number firstStep, cosim::time_point startTime) override;
+    void step_complete(
+        cosim::step_number lastStep,
+        cosim::duration lastStepSize,
+        cosim::time_point currentTime) override;
+    void simulator_step_complete(
+        cosim::simulator_index index,
+        cosim::step_number lastStep,
+        cosim::duration lastStepSize,
+        cosim::time_point currentTime) override;
+    void state_restored(cosim::step_number currentStep, cosim::time_point currentTime) override;
+
+    void record(simulator_record& simulator, cosim::step_number step, cosim::time_point time);
+
+    cosim::duration window_;
+    std::map<cosim::simulator_index, simulator_record> simulators_;
+    void (*previousHandler_)(int) = SIG_DFL;
+};
+
+
+#endif
@@ -0,0 +1,166 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#include "fmu_metadata.hpp"
+
+#include "archive.hpp"
+
+#include <boost/lexical_cast.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/xml_parser.hpp>
+#include <cosim/utility/filesystem.hpp>
+
+#include <optional>
+#include <stdexcept>
+#include <string>
+
+
+namespace
+{
+
+using boost::property_tree::ptree;
+
+std::string attribute(const ptree& element, const char* name, const char* defaultValue = "")
+{
+    return element.get<std::string>(std::string("<xmlattr>.") + name, defaultValue);
+}
+
+cosim::variable_causality fmi2_causality(const std::string& causality)
+{
+    if (causality == "parameter") return cosim::variable_causality::parameter;
+    if (causality == "calculatedParameter") return cosim::variable_causality::calculated_parameter;
+    if (causality == "input") return cosim::variable_causality::input;
+    if (causality == "output") return cosim::variable_causality::output;
+    if (causality == "local" || causality == "independent") return cosim::variable_causality::local;
+    throw std::runtime_error("Invalid variable causality: " + causality);
+}
+
+cosim::variable_variability fmi2_variability(const std::string& variability)
+{
+    if (variability == "constant") return cosim::variable_variability::constant;
+    if (variability == "fixed") return cosim::variable_variability::fixed;
+    if (variability == "tunable") return cosim::variable_variability::tunable;
+    if (variability == "discrete") return cosim::variable_variability::discrete;
+    if (variability == "continuous") return cosim::variable_variability::continuous;
+    throw std::runtime_error("Invalid variable variability: " + variability);
+}
+
+// In FMI 1.0, parameters are identified by their variability rather than
+// their causality.  We translate them the same way libcosim does.
+cosim::variable_causality fmi1_causality(
+    const std::string& causality,
+    const std::string& variability)
+{
+    if (causality == "input") {
+        return variability == "parameter"
+            ? cosim::variable_causality::parameter
+            : cosim::variable_causality::input;
+    }
+    if (causality == "output") return cosim::variable_causality::output;
+    if (causality == "internal" || causality == "none") return cosim::variable_causality::local;
+    throw std::runtime_error("Invalid variable causality: " + causality);
+}
+
+cosim::variable_variability fmi1_variability(const std::string& variability)
+{
+    if (variability == "constant") return cosim::variable_variability::constant;
+    if (variability == "parameter") return cosim::variable_variability::fixed;
+    if (variability == "discrete") return cosim::variable_variability::discrete;
+    if (variability == "continuous") return cosim::variable_variability::continuous;
+    throw std::runtime_error("Invalid variable variability: " + variability);
+}
+
+// Sets the type and start value of `variable` based on the type-specific
+// child element of a <ScalarVariable>.
+void read_type_and_start(
+    const ptree& scalarVariable,
+    cosim::variable_description& variable)
+{
+    for (const auto& child : scalarVariable) {
+        const auto& typeName = child.first;
+        const auto start = child.second.get_optional<std::string>("<xmlattr>.start");
+        if (typeName == "Real") {
+            variable.type = cosim::variable_type::real;
+            if (start) variable.start = boost::lexical_cast<double>(*start);
+        } else if (typeName == "Integer" || typeName == "Enumeration") {
+            variable.type = typeName == "Integer"
+                ? cosim::variable_type::integer
+                : cosim::variable_type::enumeration;
+            if (start) variable.start = boost::lexical_cast<int>(*start);
+        } else if (typeName == "Boolean") {
+            variable.type = cosim::variable_type::boolean;
+            if (start) variable.start = (*start == "true" || *start == "1");
+        } else if (typeName == "String") {
+            variable.type = cosim::variable_type::string;
+            if (start) variable.start = *start;
+        } else {
+            continue;
+        }
+        return;
+    }
+    throw std::runtime_error("Variable has no type: " + variable.name);
+}
+
+cosim::model_description parse_model_description(const ptree& root)
+{
+    const auto& fmd = root.get_child("fmiModelDescription");
+    const auto fmiVersion = attribute(fmd, "fmiVersion");
+    const bool isFMI1 = fmiVersion == "1.0";
+    if (!isFMI1 && fmiVersion != "2.0") {
+        throw std::runtime_error("Unsupported FMI version: " + fmiVersion);
+    }
+
+    cosim::model_description md;
+    md.name = attribute(fmd, "modelName");
+    md.uuid = attribute(fmd, "guid");
+    md.description = attribute(fmd, "description");
+    md.author = attribute(fmd, "author");
+    md.version = attribute(fmd, "version");
+
+    const auto modelVariables = fmd.get_child_optional("ModelVariables");
+    if (!modelVariables) return md;
+    for (const auto& element : *modelVariables) {
+        if (element.first != "ScalarVariable") continue;
+        const auto& sv = element.second;
+        cosim::variable_description v;
+        v.name = attribute(sv, "name");
+        v.reference = sv.get<cosim::value_reference>("<xmlattr>.valueReference");
+        if (isFMI1) {
+            const auto variability = attribute(sv, "variability", "continuous");
+            v.causality = fmi1_causality(attribute(sv, "causality", "internal"), variability);
+            v.variability = fmi1_variability(variability);
+        } else {
+            v.causality = fmi2_causality(attribute(sv, "causality", "local"));
+            v.variability = fmi2_variability(attribute(sv, "variability", "continuous"));
+        }
+        read_type_and_start(sv, v);
+        md.variables.push_back(std::move(v));
+    }
+    return md;
+}
+
+} // namespace
+
+
+cosim::model_description read_fmu_model_description(
+    const cosim::filesystem::path& fmuPath)
+{
+    const auto tempDir = cosim::utility::temp_dir();
+    const auto xmlFile = extract_archive_entry(fmuPath, "modelDescription.xml", tempDir.path());
+    try {
+        ptree root;
+        boost::property_tree::read_xml(
+            xmlFile.string(),
+            root,
+            boost::property_tree::xml_parser::no_comments);
+        return parse_model_description(root);
+    } catch (const boost::property_tree::ptree_error& e) {
+        throw std::runtime_error(
+            "Error parsing model description of '" + fmuPath.string() + "': " + e.what());
+    } catch (const boost::bad_lexical_cast& e) {
+        throw std::runtime_error(
+            "Error parsing model description of '" + fmuPath.string() + "': " + e.what());
+    }
+}
@@ -0,0 +1,31 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#ifndef COSIM_FMU_METADATA_HPP
+#define COSIM_FMU_METADATA_HPP
+
+#include <cosim/fs_portability.hpp>
+#include <cosim/model_description.hpp>
+
+
+/**
+ *  Reads the model description of an FMU directly from the archive.
+ *
+ *  Only `modelDescription.xml` is extracted from the archive, and it is
+ *  parsed without involving the FMI import machinery, which makes this
+ *  much faster than a full model lookup for large FMUs.  FMI 1.0 and 2.0
+ *  model descriptions are supported, and they are translated to
+ *  `cosim::model_description` objects in the same way as libcosim does.
+ *
+ *  \throws std::runtime_error
+ *      If the archive does not contain a model description, if the model
+ *      description could not be parsed, or if it uses an unsupported FMI
+ *      version.
+ */
+cosim::model_description read_fmu_model_description(
+    const cosim::filesystem::path& fmuPath);
+
+
+#endif
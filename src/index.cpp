@@ -0,0 +1,122 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#include "index.hpp"
+
+#include "cache.hpp"
+#include "fingerprint.hpp"
+#include "fmu_metadata.hpp"
+#include "model_index.hpp"
+#include "parallel.hpp"
+#include "tools.hpp"
+
+#include <boost/interprocess/sync/file_lock.hpp>
+#include <boost/interprocess/sync/scoped_lock.hpp>
+#include <cosim/fs_portability.hpp>
+#include <cosim/log/logger.hpp>
+
+#include <atomic>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+void index_subcommand::setup_options(
+    boost::program_options::options_description& options,
+    boost::program_options::options_description& positionalOptions,
+    boost::program_options::positional_options_description& positions)
+    const noexcept
+{
+    // clang-format off
+    options.add_options()
+        ("jobs,j",
+            boost::program_options::value<int>()->default_value(0),
+            "The number of FMUs to process in parallel.  "
+            "The default (represented by the value 0) is to use the number "
+            "of system hardware cores.");
+    positionalOptions.add_options()
+        ("directory",
+            boost::program_options::value<std::vector<std::string>>()->required(),
+            "One or more directories to search for FMUs.");
+    // clang-format on
+    positions.add("directory", -1);
+}
+
+
+int index_subcommand::run(const boost::program_options::variables_map& args) const
+{
+    const auto jobs = args["jobs"].as<int>();
+    if (jobs < 0) {
+        throw boost::program_options::error("Invalid number of jobs (must be >=0)");
+    }
+    const auto directories = args["directory"].as<std::vector<std::string>>();
+    for (const auto& dir : directories) {
+        if (!cosim::filesystem::is_directory(dir)) {
+            throw std::runtime_error("Not a directory: " + dir);
+        }
+    }
+
+    const auto indexPath = model_index_path();
+    if (!indexPath) {
+        throw std::runtime_error(
+            "Unable to determine user cache directory; cannot store index.");
+    }
+
+    // Serialise concurrent updates of the index.
+    cosim::filesystem::create_directories(indexPath->parent_path());
+    auto lockPath = *indexPath;
+    lockPath += ".lock";
+    std::ofstream(lockPath.string(), std::ios::app);
+    auto lockFile = boost::interprocess::file_lock(lockPath.string().c_str());
+    boost::interprocess::scoped_lock<boost::interprocess::file_lock> lock(lockFile);
+
+    auto index = model_index(*indexPath);
+
+    std::vector<cosim::filesystem::path> fmus;
+    for (const auto& dir : directories) {
+        const auto found = find_fmus(dir);
+        fmus.insert(fmus.end(), found.begin(), found.end());
+    }
+
+    // Read the model descriptions of new and changed FMUs in parallel.
+    std::vector<std::optional<model_index_entry>> newEntries(fmus.size());
+    std::atomic<std::size_t> failureCount = 0;
+    parallel_for(fmus.size(), thread_count_or_default(jobs), [&](std::size_t i) {
+        try {
+            auto fingerprint = fingerprint_file(fmus[i]);
+            if (index.find(fingerprint)) return;
+            newEntries[i] = model_index_entry{
+                std::move(fingerprint),
+                read_fmu_model_description(fmus[i])};
+        } catch (const std::exception& e) {
+            BOOST_LOG_SEV(cosim::log::logger(), cosim::log::warning)
+                << "Unable to index " << fmus[i] << ": " << e.what();
+            ++failureCount;
+        }
+    });
+
+    std::size_t updateCount = 0;
+    for (auto& entry : newEntries) {
+        if (entry) {
+            index.insert(std::move(*entry));
+            ++updateCount;
+        }
+    }
+    std::size_t removeCount = 0;
+    for (const auto& dir : directories) removeCount += index.remove_missing(dir);
+    index.save();
+
+    std::cout
+        << "Found " << fmus.size() << " FMUs; "
+        << updateCount << " new or updated, "
+        << removeCount << " removed, "
+        << failureCount << " failed.  "
+        << "The index now contains " << index.size() << " FMUs." << std::endl;
+    return failureCount > 0 ? 1 : 0;
+}
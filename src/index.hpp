@@ -0,0 +1,56 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#ifndef COSIM_INDEX_HPP
+#define COSIM_INDEX_HPP
+
+#include "cli_application.hpp"
+
+
+/// The `index` subcommand.
+class index_subcommand : public cli_subcommand
+{
+public:
+    std::string name() const noexcept override
+    {
+        return "index";
+    }
+
+    std::string brief_description() const noexcept override
+    {
+        return "Builds an index of the FMUs in a model library";
+    }
+
+    std::string long_description() const noexcept override
+    {
+        return "This command searches one or more directories recursively for "
+               "FMUs, and stores information about them in a model index in "
+               "the program cache directory.  The index contains the model "
+               "name, UUID, and other metadata, along with a description of "
+               "each variable.\n"
+               "\n"
+               "The 'inspect' and 'run-single' commands consult the index "
+               "before they open an FMU, which makes them very fast for "
+               "indexed FMUs.  Each index entry records the size, "
+               "modification time, etc. of the FMU it was made from, so "
+               "entries for FMUs that have changed since they were indexed "
+               "are ignored.\n"
+               "\n"
+               "Running this command again for the same directories only "
+               "processes the FMUs which are new or have changed, and it "
+               "removes the entries for FMUs which no longer exist.";
+    }
+
+    void setup_options(
+        boost::program_options::options_description& options,
+        boost::program_options::options_description& positionalOptions,
+        boost::program_options::positional_options_description& positions)
+        const noexcept override;
+
+    int run(const boost::program_options::variables_map& args) const override;
+};
+
+
+#endif
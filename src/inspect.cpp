@@ -6,14 +6,40 @@
 #include "inspect.hpp"
 
 #include "cache.hpp"
+#include "fingerprint.hpp"
+#include "fmu_metadata.hpp"
+#include "model_index.hpp"
+#include "parallel.hpp"
+#include "system_analysis.hpp"
+#include "system_config.hpp"
 #include "tools.hpp"
 
 #include <cosim/fs_portability.hpp>
+#include <cosim/log/logger.hpp>
 #include <cosim/orchestration.hpp>
 #include <cosim/uri.hpp>
 
-#include <iomanip>
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <exception>
+#include <initializer_list>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <regex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <variant>
+#include <vector>
 
 
 void inspect_subcommand::setup_options(
@@ -24,13 +50,53 @@ void inspect_subcommand::setup_options(
 {
     // clang-format off
     options.add_options()
-        ("no-vars", "Do not print information about variables.");
+        ("no-vars", "Do not print information about variables.")
+        ("filter",
+            boost::program_options::value<std::string>()->value_name("regex"),
+            "Only print variables whose names match the given regular "
+            "expression (ECMAScript syntax).  The expression may match any "
+            "part of the name; use ^ and $ to match the whole name.")
+        ("causality",
+            boost::program_options::value<std::string>()->value_name("list"),
+            "Only print variables with the given causalities, specified as "
+            "a comma-separated list.  Valid causalities are: parameter, "
+            "calculated_parameter, input, output, local.")
+        ("type",
+            boost::program_options::value<std::string>()->value_name("list"),
+            "Only print variables of the given types, specified as a "
+            "comma-separated list.  Valid types are: real, integer, "
+            "boolean, string, enumeration.")
+        ("limit",
+            boost::program_options::value<int>()->value_name("count"),
+            "Print at most this many variables per model, after the other "
+            "filters have been applied.")
+        ("format",
+            boost::program_options::value<std::string>()->default_value("text"),
+            "The output format.  Valid values are 'text', 'jsonl' and 'yaml'.  "
+            "'jsonl' produces one JSON object per line, and 'yaml' produces "
+            "one YAML document, per model.  Unlike the text format, these "
+            "also include the number of variables of each type and causality.")
+        ("jobs,j",
+            boost::program_options::value<int>()->default_value(0),
+            "The number of models to inspect in parallel.  "
+            "The default (represented by the value 0) is to use the number "
+            "of system hardware cores.")
+        ("step-costs",
+            boost::program_options::value<std::string>()->value_name("file"),
+            "For system structures: A file with measured step costs, used "
+            "to estimate the parallelism of the system.  Each line should "
+            "contain a simulator name and the wall-clock time it takes to "
+            "perform one step, in seconds, separated by whitespace.  Lines "
+            "starting with '#' are ignored.  Without this, all simulators "
+            "are assumed to have the same cost.");
     positionalOptions.add_options()
         ("uri_or_path",
-            boost::program_options::value<std::string>()->required(),
-            "A model URI or FMU path.");
+            boost::program_options::value<std::vector<std::string>>()->required(),
+            "One or more model URIs, FMU paths, or system structure paths.  "
+            "If a path refers to a directory which is not a system structure, "
+            "it will be searched recursively for FMUs.");
     // clang-format on
-    positions.add("uri_or_path", 1);
+    positions.add("uri_or_path", -1);
 }
 
 
@@ -38,48 +104,863 @@ namespace
 {
 constexpr int keyWidth = 14;
 
-void print_model_description(const cosim::model_description& md)
+enum class output_format
 {
-    std::cout
-        << std::left
-        << std::setw(keyWidth) << "name:" << md.name << '\n'
-        << std::setw(keyWidth) << "uuid:" << md.uuid << '\n'
-        << std::setw(keyWidth) << "description:" << md.description << '\n'
-        << std::setw(keyWidth) << "author:" << md.author << '\n'
-        << std::setw(keyWidth) << "version:" << md.version << '\n';
+    text,
+    jsonl,
+    yaml
+};
+
+output_format parse_output_format(const std::string& format)
+{
+    if (format == "text") return output_format::text;
+    if (format == "jsonl") return output_format::jsonl;
+    if (format == "yaml") return output_format::yaml;
+    throw boost::program_options::error("Invalid '--format' value: " + format);
+}
+
+// Expands directory arguments, except system structure directories, to the
+// FMUs they contain.
+std::vector<std::string> find_sources(const std::vector<std::string>& args)
+{
+    std::vector<std::string> sources;
+    for (const auto& arg : args) {
+        const auto path = cosim::filesystem::path(arg);
+        if (cosim::filesystem::is_directory(path) && !is_system_structure_path(path)) {
+            for (const auto& fmu : find_fmus(path)) sources.push_back(fmu.string());
+        } else {
+            sources.push_back(arg);
+        }
+    }
+    return sources;
+}
+
+
+// Criteria for selecting which variables to print.
+struct variable_filter
+{
+    std::optional<std::regex> name;
+    std::set<cosim::variable_causality> causalities;
+    std::set<cosim::variable_type> types;
+    std::optional<std::size_t> limit;
+};
+
+// Parses a comma-separated list of enumerator names, as given to the
+// --causality and --type options.
+template<typename Enum>
+std::set<Enum> parse_enum_list(
+    const std::string& option,
+    const std::string& list,
+    std::initializer_list<Enum> validValues)
+{
+    std::set<Enum> values;
+    std::string_view remaining = list;
+    while (!remaining.empty()) {
+        const auto commaPos = std::min(remaining.find(','), remaining.size());
+        const auto name = remaining.substr(0, commaPos);
+        const auto it = std::find_if(
+            validValues.begin(),
+            validValues.end(),
+            [name](Enum e) { return name == cosim::to_text(e); });
+        if (it == validValues.end()) {
+            throw boost::program_options::error(
+                "Invalid '--" + option + "' value: " + std::string(name));
+        }
+        values.insert(*it);
+        remaining.remove_prefix(std::min(commaPos + 1, remaining.size()));
+    }
+    return values;
+}
+
+variable_filter get_variable_filter(const boost::program_options::variables_map& args)
+{
+    variable_filter filter;
+    if (args.count("filter")) {
+        try {
+            filter.name = std::regex(
+                args["filter"].as<std::string>(),
+                std::regex::ECMAScript | std::regex::optimize);
+        } catch (const std::regex_error& e) {
+            throw boost::program_options::error(
+                std::string("Invalid '--filter' value: ") + e.what());
+        }
+    }
+    if (args.count("causality")) {
+        filter.causalities = parse_enum_list(
+            "causality",
+            args["causality"].as<std::string>(),
+            {cosim::variable_causality::parameter,
+                cosim::variable_causality::calculated_parameter,
+                cosim::variable_causality::input,
+                cosim::variable_causality::output,
+                cosim::variable_causality::local});
+    }
+    if (args.count("type")) {
+        filter.types = parse_enum_list(
+            "type",
+            args["type"].as<std::string>(),
+            {cosim::variable_type::real,
+                cosim::variable_type::integer,
+                cosim::variable_type::boolean,
+                cosim::variable_type::string,
+                cosim::variable_type::enumeration});
+    }
+    if (args.count("limit")) {
+        const auto limit = args["limit"].as<int>();
+        if (limit < 0) {
+            throw boost::program_options::error("Invalid '--limit' value (must be >=0)");
+        }
+        filter.limit = static_cast<std::size_t>(limit);
+    }
+    return filter;
 }
 
-void print_variable_descriptions(const cosim::model_description& md)
+// Returns the variables that match `filter`.  The cheap checks are done
+// first, so the regular expression is only evaluated when necessary.
+std::vector<const cosim::variable_description*> select_variables(
+    const cosim::model_description& md,
+    const variable_filter& filter)
 {
-    std::cout << "variables:\n";
+    std::vector<const cosim::variable_description*> selection;
+    const auto limit = filter.limit.value_or(md.variables.size());
     for (const auto& v : md.variables) {
-        std::cout
-            << "  - " << std::setw(keyWidth) << "name:" << v.name << '\n'
-            << "    " << std::setw(keyWidth) << "reference:" << v.reference << '\n'
-            << "    " << std::setw(keyWidth) << "type:" << v.type << '\n'
-            << "    " << std::setw(keyWidth) << "causality:" << v.causality << '\n'
-            << "    " << std::setw(keyWidth) << "variability:" << v.variability << '\n';
-        if (v.start) {
-            std::cout << "    " << std::setw(keyWidth) << "start value:";
-            std::visit([](const auto& x) { std::cout << x << '\n'; }, *v.start);
+        if (selection.size() >= limit) break;
+        if (!filter.causalities.empty() && !filter.causalities.count(v.causality)) continue;
+        if (!filter.types.empty() && !filter.types.count(v.type)) continue;
+        if (filter.name && !std::regex_search(v.name, *filter.name)) continue;
+        selection.push_back(&v);
+    }
+    return selection;
+}
+
+
+// The output is built in a single string buffer per model, using the
+// following functions rather than iostreams, since the latter are
+// prohibitively slow for models with hundreds of thousands of variables.
+
+template<typename Integer>
+void append_integer(std::string& out, Integer value)
+{
+    char buffer[24];
+    const auto result = std::to_chars(buffer, buffer + sizeof buffer, value);
+    out.append(buffer, result.ptr);
+}
+
+// Appends a key for the text format, left-aligned in a field of width
+// `keyWidth`.
+void append_text_key(std::string& out, std::string_view indent, std::string_view key)
+{
+    out += indent;
+    out += key;
+    if (key.size() < keyWidth) out.append(keyWidth - key.size(), ' ');
+}
+
+void append_text_line(std::string& out, std::string_view indent, std::string_view key, std::string_view value)
+{
+    append_text_key(out, indent, key);
+    out += value;
+    out += '\n';
+}
+
+// Appends a scalar value the way it would be printed by an `std::ostream`
+// with default formatting flags.
+void append_text_scalar(std::string& out, const cosim::scalar_value& value)
+{
+    std::visit(
+        [&out](const auto& x) {
+            using T = std::decay_t<decltype(x)>;
+            if constexpr (std::is_same_v<T, std::string>) {
+                out += x;
+            } else if constexpr (std::is_same_v<T, bool>) {
+                out += x ? '1' : '0';
+            } else if constexpr (std::is_same_v<T, double>) {
+                char buffer[32];
+                const auto result = std::to_chars(
+                    buffer, buffer + sizeof buffer, x, std::chars_format::general, 6);
+                out.append(buffer, result.ptr);
+            } else {
+                append_integer(out, x);
+            }
+        },
+        value);
+}
+
+// Appends a scalar value as a JSON/YAML literal.
+void append_structured_scalar(std::string& out, const cosim::scalar_value& value)
+{
+    std::visit(
+        [&out](const auto& x) {
+            using T = std::decay_t<decltype(x)>;
+            if constexpr (std::is_same_v<T, std::string>) {
+                out += quoted_string(x);
+            } else if constexpr (std::is_same_v<T, bool>) {
+                out += x ? "true" : "false";
+            } else if constexpr (std::is_same_v<T, double>) {
+                if (!std::isfinite(x)) {
+                    out += "null";
+                } else {
+                    char buffer[32];
+                    const auto result = std::to_chars(buffer, buffer + sizeof buffer, x);
+                    out.append(buffer, result.ptr);
+                }
+            } else {
+                append_integer(out, x);
+            }
+        },
+        value);
+}
+
+template<typename Enum>
+using count_map = std::map<Enum, std::size_t>;
+
+void count_variables(
+    const cosim::model_description& md,
+    count_map<cosim::variable_type>& typeCounts,
+    count_map<cosim::variable_causality>& causalityCounts)
+{
+    for (const auto& v : md.variables) {
+        ++typeCounts[v.type];
+        ++causalityCounts[v.causality];
+    }
+}
+
+void print_model_description(std::string& out, const cosim::model_description& md)
+{
+    append_text_line(out, "", "name:", md.name);
+    append_text_line(out, "", "uuid:", md.uuid);
+    append_text_line(out, "", "description:", md.description);
+    append_text_line(out, "", "author:", md.author);
+    append_text_line(out, "", "version:", md.version);
+}
+
+void print_variable_descriptions(
+    std::string& out,
+    const std::vector<const cosim::variable_description*>& variables)
+{
+    out += "variables:\n";
+    for (const auto v : variables) {
+        append_text_line(out, "  - ", "name:", v->name);
+        append_text_key(out, "    ", "reference:");
+        append_integer(out, v->reference);
+        out += '\n';
+        append_text_line(out, "    ", "type:", cosim::to_text(v->type));
+        append_text_line(out, "    ", "causality:", cosim::to_text(v->causality));
+        append_text_line(out, "    ", "variability:", cosim::to_text(v->variability));
+        if (v->start) {
+            append_text_key(out, "    ", "start value:");
+            append_text_scalar(out, *v->start);
+            out += '\n';
+        }
+    }
+}
+
+template<typename Enum>
+void print_json_counts(std::string& out, const count_map<Enum>& counts)
+{
+    out += '{';
+    for (auto it = counts.begin(); it != counts.end(); ++it) {
+        if (it != counts.begin()) out += ',';
+        out += '"';
+        out += cosim::to_text(it->first);
+        out += "\":";
+        append_integer(out, it->second);
+    }
+    out += '}';
+}
+
+void print_json(
+    std::string& out,
+    const std::string& source,
+    const cosim::model_description& md,
+    const std::optional<std::vector<const cosim::variable_description*>>& variables)
+{
+    count_map<cosim::variable_type> typeCounts;
+    count_map<cosim::variable_causality> causalityCounts;
+    count_variables(md, typeCounts, causalityCounts);
+
+    out += "{\"source\":" + quoted_string(source);
+    out += ",\"name\":" + quoted_string(md.name);
+    out += ",\"uuid\":" + quoted_string(md.uuid);
+    out += ",\"description\":" + quoted_string(md.description);
+    out += ",\"author\":" + quoted_string(md.author);
+    out += ",\"version\":" + quoted_string(md.version);
+    out += ",\"variable_counts\":{\"total\":";
+    append_integer(out, md.variables.size());
+    out += ",\"type\":";
+    print_json_counts(out, typeCounts);
+    out += ",\"causality\":";
+    print_json_counts(out, causalityCounts);
+    out += '}';
+    if (variables) {
+        out += ",\"variables\":[";
+        for (std::size_t i = 0; i < variables->size(); ++i) {
+            const auto& v = *(*variables)[i];
+            if (i > 0) out += ',';
+            out += "{\"name\":" + quoted_string(v.name);
+            out += ",\"reference\":";
+            append_integer(out, v.reference);
+            out += ",\"type\":\"";
+            out += cosim::to_text(v.type);
+            out += "\",\"causality\":\"";
+            out += cosim::to_text(v.causality);
+            out += "\",\"variability\":\"";
+            out += cosim::to_text(v.variability);
+            out += '"';
+            if (v.start) {
+                out += ",\"start\":";
+                append_structured_scalar(out, *v.start);
+            }
+            out += '}';
+        }
+        out += ']';
+    }
+    out += "}\n";
+}
+
+template<typename Enum>
+void print_yaml_counts(std::string& out, const char* key, const count_map<Enum>& counts)
+{
+    out += "  ";
+    out += key;
+    out += counts.empty() ? ": {}\n" : ":\n";
+    for (const auto& c : counts) {
+        out += "    ";
+        out += cosim::to_text(c.first);
+        out += ": ";
+        append_integer(out, c.second);
+        out += '\n';
+    }
+}
+
+void print_yaml(
+    std::string& out,
+    const std::string& source,
+    const cosim::model_description& md,
+    const std::optional<std::vector<const cosim::variable_description*>>& variables)
+{
+    count_map<cosim::variable_type> typeCounts;
+    count_map<cosim::variable_causality> causalityCounts;
+    count_variables(md, typeCounts, causalityCounts);
+
+    out += "---\n";
+    out += "source: " + quoted_string(source) + '\n';
+    out += "name: " + quoted_string(md.name) + '\n';
+    out += "uuid: " + quoted_string(md.uuid) + '\n';
+    out += "description: " + quoted_string(md.description) + '\n';
+    out += "author: " + quoted_string(md.author) + '\n';
+    out += "version: " + quoted_string(md.version) + '\n';
+    out += "variable_counts:\n";
+    out += "  total: ";
+    append_integer(out, md.variables.size());
+    out += '\n';
+    print_yaml_counts(out, "type", typeCounts);
+    print_yaml_counts(out, "causality", causalityCounts);
+    if (variables) {
+        out += variables->empty() ? "variables: []\n" : "variables:\n";
+        for (const auto v : *variables) {
+            out += "  - name: " + quoted_string(v->name) + '\n';
+            out += "    reference: ";
+            append_integer(out, v->reference);
+            out += "\n    type: ";
+            out += cosim::to_text(v->type);
+            out += "\n    causality: ";
+            out += cosim::to_text(v->causality);
+            out += "\n    variability: ";
+            out += cosim::to_text(v->variability);
+            out += '\n';
+            if (v->start) {
+                out += "    start: ";
+                append_structured_scalar(out, *v->start);
+                out += '\n';
+            }
+        }
+    }
+}
+
+double to_seconds(cosim::duration d)
+{
+    return std::chrono::duration<double>(d).count();
+}
+
+// Returns the highest possible real time factor when a cycle has the given
+// cost, or an empty object if it can't be determined.
+std::optional<double> max_real_time_factor(const system_analysis& sa, double cycleCost)
+{
+    const auto& p = sa.parallelism;
+    if (!p.measured_costs || !sa.base_step_size || cycleCost <= 0.0) return std::nullopt;
+    return p.cycle_length * to_seconds(*sa.base_step_size) / cycleCost;
+}
+
+// Returns the speedup of a cycle of the given cost relative to
+// single-threaded stepping, or nothing if all steps are free.
+std::optional<double> speedup(const system_analysis& sa, double cycleCost)
+{
+    if (cycleCost <= 0.0) return std::nullopt;
+    return sa.parallelism.cycle_costs.front() / cycleCost;
+}
+
+void print_system_text(std::string& out, const system_analysis& sa)
+{
+    append_text_line(out, "", "algorithm:", sa.algorithm);
+    append_text_key(out, "", "base step:");
+    if (sa.base_step_size) {
+        append_text_scalar(out, to_seconds(*sa.base_step_size));
+    } else {
+        out += "unknown";
+    }
+    out += '\n';
+    out += "simulators:\n";
+    for (const auto& s : sa.simulators) {
+        append_text_line(out, "  - ", "name:", s.name);
+        append_text_line(out, "    ", "model:", s.model_name);
+        if (s.step_size_hint > cosim::duration::zero()) {
+            append_text_key(out, "    ", "step size:");
+            append_text_scalar(out, to_seconds(s.step_size_hint));
+            out += '\n';
+        }
+        append_text_key(out, "    ", "decimation:");
+        append_integer(out, s.decimation_factor);
+        out += '\n';
+        if (s.step_cost) {
+            append_text_key(out, "    ", "step cost:");
+            append_text_scalar(out, *s.step_cost);
+            out += '\n';
+        }
+    }
+    append_text_key(out, "", "functions:");
+    append_integer(out, sa.function_count);
+    out += '\n';
+    out += "connections:\n";
+    for (const auto& c : sa.couplings) {
+        append_text_line(out, "  - ", "source:", c.source);
+        append_text_line(out, "    ", "target:", c.target);
+        append_text_key(out, "    ", "variables:");
+        append_integer(out, c.variable_count);
+        out += '\n';
+    }
+
+    const auto& p = sa.parallelism;
+    out += "parallelism:\n";
+    append_text_key(out, "  ", "cycle:");
+    append_integer(out, p.cycle_length);
+    out += p.cycle_truncated ? " macro steps (truncated)\n" : " macro steps\n";
+    append_text_key(out, "  ", "concurrency:");
+    out += "min ";
+    append_integer(out, p.min_concurrency);
+    out += ", mean ";
+    append_text_scalar(out, p.mean_concurrency);
+    out += ", max ";
+    append_integer(out, p.max_concurrency);
+    out += '\n';
+    append_text_line(out, "  ", "step costs:", p.measured_costs ? "measured (s)" : "uniform (1 per step)");
+    out += "  threads:\n";
+    for (std::size_t t = 1; t <= p.cycle_costs.size(); ++t) {
+        const auto cost = p.cycle_costs[t - 1];
+        append_text_key(out, "    - ", "threads:");
+        append_integer(out, t);
+        out += '\n';
+        append_text_key(out, "      ", "cycle cost:");
+        append_text_scalar(out, cost);
+        out += '\n';
+        if (const auto s = speedup(sa, cost)) {
+            append_text_key(out, "      ", "speedup:");
+            append_text_scalar(out, *s);
+            out += '\n';
+        }
+        if (const auto rtf = max_real_time_factor(sa, cost)) {
+            append_text_key(out, "      ", "max RTF:");
+            append_text_scalar(out, *rtf);
+            out += '\n';
         }
     }
+    append_text_key(out, "  ", "suggested --worker-threads:");
+    out += ' ';
+    append_integer(out, p.suggested_worker_threads);
+    out += '\n';
 }
 
+void print_system_json(std::string& out, const std::string& source, const system_analysis& sa)
+{
+    out += "{\"source\":" + quoted_string(source);
+    out += ",\"algorithm\":" + quoted_string(sa.algorithm);
+    out += ",\"base_step_size\":";
+    if (sa.base_step_size) {
+        append_structured_scalar(out, to_seconds(*sa.base_step_size));
+    } else {
+        out += "null";
+    }
+    out += ",\"simulators\":[";
+    for (std::size_t i = 0; i < sa.simulators.size(); ++i) {
+        const auto& s = sa.simulators[i];
+        if (i > 0) out += ',';
+        out += "{\"name\":" + quoted_string(s.name);
+        out += ",\"model\":" + quoted_string(s.model_name);
+        if (s.step_size_hint > cosim::duration::zero()) {
+            out += ",\"step_size\":";
+            append_structured_scalar(out, to_seconds(s.step_size_hint));
+        }
+        out += ",\"decimation_factor\":";
+        append_integer(out, s.decimation_factor);
+        if (s.step_cost) {
+            out += ",\"step_cost\":";
+            append_structured_scalar(out, *s.step_cost);
+        }
+        out += '}';
+    }
+    out += "],\"function_count\":";
+    append_integer(out, sa.function_count);
+    out += ",\"connection_count\":";
+    append_integer(out, sa.connection_count);
+    out += ",\"connections\":[";
+    for (std::size_t i = 0; i < sa.couplings.size(); ++i) {
+        const auto& c = sa.couplings[i];
+        if (i > 0) out += ',';
+        out += "{\"source\":" + quoted_string(c.source);
+        out += ",\"target\":" + quoted_string(c.target);
+        out += ",\"variables\":";
+        append_integer(out, c.variable_count);
+        out += '}';
+    }
+
+    const auto& p = sa.parallelism;
+    out += "],\"parallelism\":{\"cycle_length\":";
+    append_integer(out, p.cycle_length);
+    out += ",\"cycle_truncated\":";
+    out += p.cycle_truncated ? "true" : "false";
+    out += ",\"min_concurrency\":";
+    append_integer(out, p.min_concurrency);
+    out += ",\"mean_concurrency\":";
+    append_structured_scalar(out, p.mean_concurrency);
+    out += ",\"max_concurrency\":";
+    append_integer(out, p.max_concurrency);
+    out += ",\"measured_costs\":";
+    out += p.measured_costs ? "true" : "false";
+    out += ",\"threads\":[";
+    for (std::size_t t = 1; t <= p.cycle_costs.size(); ++t) {
+        const auto cost = p.cycle_costs[t - 1];
+        if (t > 1) out += ',';
+        out += "{\"threads\":";
+        append_integer(out, t);
+        out += ",\"cycle_cost\":";
+        append_structured_scalar(out, cost);
+        if (const auto s = speedup(sa, cost)) {
+            out += ",\"speedup\":";
+            append_structured_scalar(out, *s);
+        }
+        if (const auto rtf = max_real_time_factor(sa, cost)) {
+            out += ",\"max_real_time_factor\":";
+            append_structured_scalar(out, *rtf);
+        }
+        out += '}';
+    }
+    out += "],\"suggested_worker_threads\":";
+    append_integer(out, p.suggested_worker_threads);
+    out += "}}\n";
+}
+
+void print_system_yaml(std::string& out, const std::string& source, const system_analysis& sa)
+{
+    out += "---\n";
+    out += "source: " + quoted_string(source) + '\n';
+    out += "algorithm: " + quoted_string(sa.algorithm) + '\n';
+    out += "base_step_size: ";
+    if (sa.base_step_size) {
+        append_structured_scalar(out, to_seconds(*sa.base_step_size));
+    } else {
+        out += "null";
+    }
+    out += '\n';
+    out += sa.simulators.empty() ? "simulators: []\n" : "simulators:\n";
+    for (const auto& s : sa.simulators) {
+        out += "  - name: " + quoted_string(s.name) + '\n';
+        out += "    model: " + quoted_string(s.model_name) + '\n';
+        if (s.step_size_hint > cosim::duration::zero()) {
+            out += "    step_size: ";
+            append_structured_scalar(out, to_seconds(s.step_size_hint));
+            out += '\n';
+        }
+        out += "    decimation_factor: ";
+        append_integer(out, s.decimation_factor);
+        out += '\n';
+        if (s.step_cost) {
+            out += "    step_cost: ";
+            append_structured_scalar(out, *s.step_cost);
+            out += '\n';
+        }
+    }
+    out += "function_count: ";
+    append_integer(out, sa.function_count);
+    out += "\nconnection_count: ";
+    append_integer(out, sa.connection_count);
+    out += '\n';
+    out += sa.couplings.empty() ? "connections: []\n" : "connections:\n";
+    for (const auto& c : sa.couplings) {
+        out += "  - source: " + quoted_string(c.source) + '\n';
+        out += "    target: " + quoted_string(c.target) + '\n';
+        out += "    variables: ";
+        append_integer(out, c.variable_count);
+        out += '\n';
+    }
+
+    const auto& p = sa.parallelism;
+    out += "parallelism:\n";
+    out += "  cycle_length: ";
+    append_integer(out, p.cycle_length);
+    out += "\n  cycle_truncated: ";
+    out += p.cycle_truncated ? "true" : "false";
+    out += "\n  min_concurrency: ";
+    append_integer(out, p.min_concurrency);
+    out += "\n  mean_concurrency: ";
+    append_structured_scalar(out, p.mean_concurrency);
+    out += "\n  max_concurrency: ";
+    append_integer(out, p.max_concurrency);
+    out += "\n  measured_costs: ";
+    out += p.measured_costs ? "true" : "false";
+    out += p.cycle_costs.empty() ? "\n  threads: []\n" : "\n  threads:\n";
+    for (std::size_t t = 1; t <= p.cycle_costs.size(); ++t) {
+        const auto cost = p.cycle_costs[t - 1];
+        out += "    - threads: ";
+        append_integer(out, t);
+        out += "\n      cycle_cost: ";
+        append_structured_scalar(out, cost);
+        out += '\n';
+        if (const auto s = speedup(sa, cost)) {
+            out += "      speedup: ";
+            append_structured_scalar(out, *s);
+            out += '\n';
+        }
+        if (const auto rtf = max_real_time_factor(sa, cost)) {
+            out += "      max_real_time_factor: ";
+            append_structured_scalar(out, *rtf);
+            out += '\n';
+        }
+    }
+    out += "  suggested_worker_threads: ";
+    append_integer(out, p.suggested_worker_threads);
+    out += '\n';
+}
+
+void print_error(
+    std::string& out,
+    output_format format,
+    const std::string& source,
+    const std::string& message)
+{
+    switch (format) {
+        case output_format::text:
+            append_text_line(out, "", "source:", source);
+            append_text_line(out, "", "error:", message);
+            break;
+        case output_format::jsonl:
+            out += "{\"source\":" + quoted_string(source);
+            out += ",\"error\":" + quoted_string(message) + "}\n";
+            break;
+        case output_format::yaml:
+            out += "---\n";
+            out += "source: " + quoted_string(source) + '\n';
+            out += "error: " + quoted_string(message) + '\n';
+            break;
+    }
+}
+
+
+// Obtains model descriptions, using the model index or the
+// direct-from-archive fast path for local FMU files where possible.
+// Safe to use from multiple threads.
+class model_description_source
+{
+public:
+    model_description_source()
+        : index_(load_user_model_index())
+    {
+        auto currentPath = cosim::filesystem::current_path();
+        currentPath += cosim::filesystem::path::preferred_separator;
+        baseUri_ = cosim::path_to_file_uri(currentPath);
+    }
+
+    // For local FMU files, the model description is taken from the model
+    // index if it has an up-to-date entry for the FMU, and otherwise read
+    // straight from the archive, which saves us from unpacking the entire
+    // FMU.  For other URIs, or if that fails, we fall back to a full model
+    // lookup.
+    std::shared_ptr<const cosim::model_description> get(const std::string& uriOrPath)
+    {
+        const auto uriReference = to_uri(uriOrPath);
+        const auto uri = cosim::resolve_reference(baseUri_, uriReference);
+        if (const auto fmuPath = local_fmu_path(uri)) {
+            if (index_) {
+                if (const auto entry = index_->find(fingerprint_file(*fmuPath))) {
+                    return std::make_shared<cosim::model_description>(entry->description);
+                }
+            }
+            try {
+                return std::make_shared<cosim::model_description>(
+                    read_fmu_model_description(*fmuPath));
+            } catch (const std::exception& e) {
+                BOOST_LOG_SEV(cosim::log::logger(), cosim::log::debug)
+                    << "Unable to read model description directly from "
+                    << *fmuPath << " (" << e.what() << "); "
+                    << "falling back to full model lookup";
+            }
+        }
+
+        // The model URI resolver is not necessarily thread safe, so we
+        // only allow one full lookup at a time.
+        std::lock_guard<std::mutex> lock(resolverMutex_);
+        if (!uriResolver_) uriResolver_ = caching_model_uri_resolver();
+        return uriResolver_->lookup_model(baseUri_, uriReference)->description();
+    }
+
+    // Loads a system structure.  This requires a full lookup of each model,
+    // so it is serialised like the fallback path of `get()`.
+    system_config load_system(const cosim::filesystem::path& path)
+    {
+        std::lock_guard<std::mutex> lock(resolverMutex_);
+        if (!uriResolver_) uriResolver_ = caching_model_uri_resolver();
+        return load_system_config(path, *uriResolver_);
+    }
+
+private:
+    const std::optional<model_index> index_;
+    cosim::uri baseUri_;
+    std::mutex resolverMutex_;
+    std::shared_ptr<cosim::model_uri_resolver> uriResolver_;
+};
+
+
+struct inspection_result
+{
+    std::string output;
+    std::exception_ptr error;
+};
+
 } // namespace
 
 
 int inspect_subcommand::run(const boost::program_options::variables_map& args) const
 {
-    auto currentPath = cosim::filesystem::current_path();
-    currentPath += cosim::filesystem::path::preferred_separator;
-    const auto baseUri = cosim::path_to_file_uri(currentPath);
-    const auto uriReference = to_uri(args["uri_or_path"].as<std::string>());
-    const auto uriResolver = caching_model_uri_resolver();
-    const auto model = uriResolver->lookup_model(baseUri, uriReference);
-    print_model_description(*model->description());
-    if (args.count("no-vars") == 0) {
-        print_variable_descriptions(*model->description());
+    const auto format = parse_output_format(args["format"].as<std::string>());
+    const auto printVariables = args.count("no-vars") == 0;
+    const auto filter = get_variable_filter(args);
+    const auto jobs = args["jobs"].as<int>();
+    if (jobs < 0) {
+        throw boost::program_options::error("Invalid number of jobs (must be >=0)");
+    }
+    const auto sources = find_sources(args["uri_or_path"].as<std::vector<std::string>>());
+    const auto multipleSources = sources.size() > 1;
+    step_cost_map stepCosts;
+    if (args.count("step-costs")) {
+        stepCosts = read_step_costs(args["step-costs"].as<std::string>());
+    }
+
+    model_description_source mdSource;
+    const auto inspect_system = [&](const std::string& source, std::string& out) {
+        const auto analysis = analyse_system(mdSource.load_system(source), stepCosts);
+        switch (format) {
+            case output_format::text:
+                if (multipleSources) append_text_line(out, "", "source:", source);
+                print_system_text(out, analysis);
+                if (multipleSources) out += '\n';
+                break;
+            case output_format::jsonl:
+                print_system_json(out, source, analysis);
+                break;
+            case output_format::yaml:
+                print_system_yaml(out, source, analysis);
+                break;
+        }
+    };
+    const auto inspect = [&](const std::string& source) {
+        inspection_result result;
+        auto& out = result.output;
+        try {
+            if (is_system_structure_path(source)) {
+                inspect_system(source, out);
+                return result;
+            }
+            const auto md = mdSource.get(source);
+            std::optional<std::vector<const cosim::variable_description*>> variables;
+            if (printVariables) variables = select_variables(*md, filter);
+            switch (format) {
+                case output_format::text:
+                    if (multipleSources) append_text_line(out, "", "source:", source);
+                    print_model_description(out, *md);
+                    if (variables) print_variable_descriptions(out, *variables);
+                    if (multipleSources) out += '\n';
+                    break;
+                case output_format::jsonl:
+                    print_json(out, source, *md, variables);
+                    break;
+                case output_format::yaml:
+                    print_yaml(out, source, *md, variables);
+                    break;
+            }
+        } catch (const std::exception& e) {
+            result.error = std::current_exception();
+            out.clear();
+            print_error(out, format, source, e.what());
+            if (format == output_format::text) out += '\n';
+        }
+        return result;
+    };
+
+    // With a single model, we behave like a plain command and let errors
+    // propagate to the caller.
+    if (!multipleSources) {
+        if (sources.empty()) throw std::runtime_error("No FMUs found");
+        const auto result = inspect(sources.front());
+        if (result.error) std::rethrow_exception(result.error);
+        std::cout.write(result.output.data(), result.output.size());
+        std::cout.flush();
+        return 0;
+    }
+
+    // Otherwise, the models are inspected in parallel on a background
+    // thread, while this thread prints the output in the same order as the
+    // sources.
+    std::vector<std::optional<inspection_result>> results(sources.size());
+    std::mutex resultsMutex;
+    std::condition_variable resultReady;
+    std::exception_ptr poolError;
+    std::thread pool([&]() {
+        try {
+            parallel_for(sources.size(), thread_count_or_default(jobs), [&](std::size_t i) {
+                auto result = inspect(sources[i]);
+                {
+                    std::lock_guard<std::mutex> lock(resultsMutex);
+                    results[i] = std::move(result);
+                }
+                resultReady.notify_all();
+            });
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(resultsMutex);
+            poolError = std::current_exception();
+        }
+        resultReady.notify_all();
+    });
+
+    std::size_t failureCount = 0;
+    for (std::size_t i = 0; i < sources.size(); ++i) {
+        inspection_result result;
+        {
+            std::unique_lock<std::mutex> lock(resultsMutex);
+            resultReady.wait(lock, [&] { return results[i].has_value() || poolError; });
+            if (!results[i]) break;
+            result = std::move(*results[i]);
+            results[i].reset();
+        }
+        std::cout.write(result.output.data(), result.output.size());
+        if (result.error) ++failureCount;
+    }
+    pool.join();
+    std::cout << std::flush;
+    if (poolError) std::rethrow_exception(poolError);
+
+    if (failureCount > 0) {
+        BOOST_LOG_SEV(cosim::log::logger(), cosim::log::error)
+            << failureCount << " of " << sources.size()
+            << " models could not be inspected";
+        return 1;
     }
     return 0;
 }
@@ -20,7 +20,7 @@ public:
 
     std::string brief_description() const noexcept override
     {
-        return "Shows information about a model";
+        return "Shows information about a model or a system";
     }
 
     std::string long_description() const noexcept override
@@ -32,7 +32,28 @@ public:
                "\n"
                "The model can be specified with a URI, or, if it's a local "
                "FMU, by its path.  Using a path is equivalent to using a "
-               "`file` URI.";
+               "`file` URI.\n"
+               "\n"
+               "Multiple models may be specified, and directories are "
+               "searched recursively for FMUs.  The models are then "
+               "inspected in parallel, and the results are printed in the "
+               "order the models were specified.  An error in one model "
+               "does not prevent the others from being inspected, but it "
+               "causes a nonzero exit code.  For processing by other programs, "
+               "the '--format' option can be used to select JSON Lines or "
+               "YAML output.\n"
+               "\n"
+               "If a path refers to an OSP or SSP system structure, such as "
+               "the ones accepted by the 'run' command, the command instead "
+               "lists the simulators in the system, their step sizes and "
+               "decimation factors, and the connections between them.  It "
+               "also estimates how many simulators can be stepped "
+               "concurrently by the fixed-step algorithm, and how the step "
+               "time scales with the number of worker threads.  By default, "
+               "all simulators are assumed to take equally long to perform "
+               "a step.  If measured step costs are given with "
+               "'--step-costs', the estimate also includes the highest "
+               "achievable real time factor for each thread count.";
     }
 
     void setup_options(
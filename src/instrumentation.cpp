@@ -0,0 +1,451 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#include "instrumentation.hpp"
+
+#include "metrics.hpp"
+
+#include <cosim/slave.hpp>
+
+#include <chrono>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+#ifdef __linux__
+#    include <time.h>
+#endif
+
+
+struct instrumentation::shared_state
+{
+    mutable std::mutex mutex;
+    std::vector<std::shared_ptr<const simulator_metrics>> simulators;
+    std::vector<instrumentation::step_start_hook> stepStartHooks;
+    std::vector<instrumentation::step_hook> stepHooks;
+    std::atomic<int> activeSteps = 0;
+    bool resourceAccounting = false;
+    std::mutex accountingMutex;
+};
+
+
+namespace
+{
+
+// Returns the CPU time used by the current thread in nanoseconds, or zero
+// if it can't be determined.
+std::int64_t thread_cpu_time() noexcept
+{
+#ifdef __linux__
+    timespec t;
+    if (::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t) == 0) {
+        return static_cast<std::int64_t>(t.tv_sec) * 1000000000 + t.tv_nsec;
+    }
+#endif
+    return 0;
+}
+
+
+// Adds the CPU time used by the current thread during its lifetime to a
+// simulator's metrics, if `enabled` is true.
+class cpu_time_measurement
+{
+public:
+    cpu_time_measurement(simulator_metrics& metrics, bool enabled) noexcept
+        : metrics_(enabled ? &metrics : nullptr)
+        , cpuTime_(enabled ? thread_cpu_time() : 0)
+    {}
+
+    cpu_time_measurement(const cpu_time_measurement&) = delete;
+    cpu_time_measurement& operator=(const cpu_time_measurement&) = delete;
+
+    ~cpu_time_measurement() noexcept
+    {
+        if (metrics_) metrics_->cpu_time += thread_cpu_time() - cpuTime_;
+    }
+
+private:
+    simulator_metrics* metrics_;
+    std::int64_t cpuTime_;
+};
+
+
+// Measures the growth in resident memory and thread count, and the CPU
+// time used by the current thread, during its lifetime, and adds them to
+// a simulator's metrics.  Measurements are serialised, so that they don't
+// include each other's growth.
+class resource_measurement
+{
+public:
+    resource_measurement(
+        instrumentation::shared_state& state,
+        simulator_metrics& metrics,
+        std::atomic<std::int64_t> simulator_metrics::*memoryGrowth)
+        : lock_(state.accountingMutex)
+        , metrics_(metrics)
+        , memoryGrowth_(memoryGrowth)
+        , memory_(resident_set_size())
+        , threads_(thread_count())
+        , cpuTime_(thread_cpu_time())
+    {}
+
+    resource_measurement(const resource_measurement&) = delete;
+    resource_measurement& operator=(const resource_measurement&) = delete;
+
+    ~resource_measurement() noexcept
+    {
+        metrics_.cpu_time += thread_cpu_time() - cpuTime_;
+        try {
+            const auto memory = resident_set_size();
+            if (memory && memory_) {
+                metrics_.*memoryGrowth_ +=
+                    static_cast<std::int64_t>(*memory) - static_cast<std::int64_t>(*memory_);
+            }
+            const auto threads = thread_count();
+            if (threads && threads_) metrics_.threads_created += *threads - *threads_;
+        } catch (...) {
+            // The measurement is lost, but the simulation can go on.
+        }
+    }
+
+private:
+    std::lock_guard<std::mutex> lock_;
+    simulator_metrics& metrics_;
+    std::atomic<std::int64_t> simulator_metrics::*memoryGrowth_;
+    std::optional<std::uint64_t> memory_;
+    std::optional<int> threads_;
+    std::int64_t cpuTime_;
+};
+
+
+// Forwards everything to another slave, and measures the time spent in
+// `do_step()`, as well as resource usage if enabled.
+class instrumented_slave : public cosim::slave
+{
+public:
+    instrumented_slave(
+        std::shared_ptr<cosim::slave> slave,
+        std::shared_ptr<simulator_metrics> metrics,
+        std::shared_ptr<instrumentation::shared_state> state,
+        std::vector<instrumentation::step_start_hook> stepStartHooks,
+        std::vector<instrumentation::step_hook> stepHooks,
+        bool resourceAccounting)
+        : slave_(std::move(slave))
+        , metrics_(std::move(metrics))
+        , state_(std::move(state))
+        , stepStartHooks_(std::move(stepStartHooks))
+        , stepHooks_(std::move(stepHooks))
+        , resourceAccounting_(resourceAccounting)
+    {}
+
+    cosim::model_description model_description() const override
+    {
+        return slave_->model_description();
+    }
+
+    void setup(
+        cosim::time_point startTime,
+        std::optional<cosim::time_point> stopTime,
+        std::optional<double> relativeTolerance) override
+    {
+        std::optional<resource_measurement> measurement;
+        if (resourceAccounting_) {
+            measurement.emplace(*state_, *metrics_, &simulator_metrics::initialization_memory);
+        }
+        slave_->setup(startTime, stopTime, relativeTolerance);
+    }
+
+    void start_simulation() override
+    {
+        std::optional<resource_measurement> measurement;
+        if (resourceAccounting_) {
+            measurement.emplace(*state_, *metrics_, &simulator_metrics::initialization_memory);
+        }
+        slave_->start_simulation();
+    }
+
+    void end_simulation() override
+    {
+        const auto cpuTime = resourceAccounting_ ? thread_cpu_time() : 0;
+        slave_->end_simulation();
+        if (resourceAccounting_) metrics_->cpu_time += thread_cpu_time() - cpuTime;
+    }
+
+    cosim::step_result do_step(cosim::time_point currentT, cosim::duration deltaT) override
+    {
+        for (const auto& hook : stepStartHooks_) hook(*metrics_);
+        const auto cpuTime = resourceAccounting_ ? thread_cpu_time() : 0;
+        ++state_->activeSteps;
+        const auto start = std::chrono::steady_clock::now();
+        cosim::step_result result;
+        try {
+            result = slave_->do_step(currentT, deltaT);
+        } catch (...) {
+            --state_->activeSteps;
+            throw;
+        }
+        const auto end = std::chrono::steady_clock::now();
+        --state_->activeSteps;
+        if (resourceAccounting_) metrics_->cpu_time += thread_cpu_time() - cpuTime;
+        const auto stepTime =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+
+        ++metrics_->steps;
+        metrics_->total_step_time += stepTime;
+        metrics_->last_step_time = stepTime;
+        // Only the stepping thread writes the maximum, so there is no race.
+        if (stepTime > metrics_->max_step_time) metrics_->max_step_time = stepTime;
+        for (auto hook = stepHooks_.rbegin(); hook != stepHooks_.rend(); ++hook) {
+            (*hook)(*metrics_, start, end);
+        }
+        return result;
+    }
+
+    void get_real_variables(
+        gsl::span<const cosim::value_reference> variables,
+        gsl::span<double> values) const override
+    {
+        const cpu_time_measurement measurement(*metrics_, resourceAccounting_);
+        slave_->get_real_variables(variables, values);
+    }
+
+    void get_integer_variables(
+        gsl::span<const cosim::value_reference> variables,
+        gsl::span<int> values) const override
+    {
+        const cpu_time_measurement measurement(*metrics_, resourceAccounting_);
+        slave_->get_integer_variables(variables, values);
+    }
+
+    void get_boolean_variables(
+        gsl::span<const cosim::value_reference> variables,
+        gsl::span<bool> values) const override
+    {
+        const cpu_time_measurement measurement(*metrics_, resourceAccounting_);
+        slave_->get_boolean_variables(variables, values);
+    }
+
+    void get_string_variables(
+        gsl::span<const cosim::value_reference> variables,
+        gsl::span<std::string> values) const override
+    {
+        const cpu_time_measurement measurement(*metrics_, resourceAccounting_);
+        slave_->get_string_variables(variables, values);
+    }
+
+    void set_real_variables(
+        gsl::span<const cosim::value_reference> variables,
+        gsl::span<const double> values) override
+    {
+        const cpu_time_measurement measurement(*metrics_, resourceAccounting_);
+        slave_->set_real_variables(variables, values);
+    }
+
+    void set_integer_variables(
+        gsl::span<const cosim::value_reference> variables,
+        gsl::span<const int> values) override
+    {
+        const cpu_time_measurement measurement(*metrics_, resourceAccounting_);
+        slave_->set_integer_variables(variables, values);
+    }
+
+    void set_boolean_variables(
+        gsl::span<const cosim::value_reference> variables,
+        gsl::span<const bool> values) override
+    {
+        const cpu_time_measurement measurement(*metrics_, resourceAccounting_);
+        slave_->set_boolean_variables(variables, values);
+    }
+
+    void set_string_variables(
+        gsl::span<const cosim::value_reference> variables,
+        gsl::span<const std::string> values) override
+    {
+        const cpu_time_measurement measurement(*metrics_, resourceAccounting_);
+        slave_->set_string_variables(variables, values);
+    }
+
+    state_index save_state() override
+    {
+        const cpu_time_measurement measurement(*metrics_, resourceAccounting_);
+        return slave_->save_state();
+    }
+
+    void save_state(state_index stateIndex) override
+    {
+        const cpu_time_measurement measurement(*metrics_, resourceAccounting_);
+        slave_->save_state(stateIndex);
+    }
+
+    void restore_state(state_index stateIndex) override
+    {
+        const cpu_time_measurement measurement(*metrics_, resourceAccounting_);
+        slave_->restore_state(stateIndex);
+    }
+
+    void release_state(state_index stateIndex) override
+    {
+        const cpu_time_measurement measurement(*metrics_, resourceAccounting_);
+        slave_->release_state(stateIndex);
+    }
+
+    cosim::serialization::node export_state(state_index stateIndex) const override
+    {
+        const cpu_time_measurement measurement(*metrics_, resourceAccounting_);
+        return slave_->export_state(stateIndex);
+    }
+
+    state_index import_state(const cosim::serialization::node& exportedState) override
+    {
+        const cpu_time_measurement measurement(*metrics_, resourceAccounting_);
+        return slave_->import_state(exportedState);
+    }
+
+private:
+    std::shared_ptr<cosim::slave> slave_;
+    std::shared_ptr<simulator_metrics> metrics_;
+    std::shared_ptr<instrumentation::shared_state> state_;
+    std::vector<instrumentation::step_start_hook> stepStartHooks_;
+    std::vector<instrumentation::step_hook> stepHooks_;
+    const bool resourceAccounting_;
+};
+
+
+class instrumented_model : public cosim::model
+{
+public:
+    instrumented_model(
+        std::shared_ptr<cosim::model> model,
+        std::shared_ptr<instrumentation::shared_state> state)
+        : model_(std::move(model))
+        , state_(std::move(state))
+    {}
+
+    std::shared_ptr<const cosim::model_description> description() const noexcept override
+    {
+        return model_->description();
+    }
+
+    std::shared_ptr<cosim::slave> instantiate(std::string_view name) override
+    {
+        auto metrics = std::make_shared<simulator_metrics>(std::string(name));
+        std::vector<instrumentation::step_start_hook> stepStartHooks;
+        std::vector<instrumentation::step_hook> stepHooks;
+        bool resourceAccounting = false;
+        {
+            std::lock_guard<std::mutex> lock(state_->mutex);
+            state_->simulators.push_back(metrics);
+            stepStartHooks = state_->stepStartHooks;
+            stepHooks = state_->stepHooks;
+            resourceAccounting = state_->resourceAccounting;
+        }
+        std::optional<resource_measurement> measurement;
+        if (resourceAccounting) {
+            measurement.emplace(*state_, *metrics, &simulator_metrics::instantiation_memory);
+        }
+        auto slave = model_->instantiate(name);
+        measurement.reset();
+        return std::make_shared<instrumented_slave>(
+            std::move(slave),
+            std::move(metrics),
+            state_,
+            std::move(stepStartHooks),
+            std::move(stepHooks),
+            resourceAccounting);
+    }
+
+private:
+    std::shared_ptr<cosim::model> model_;
+    std::shared_ptr<instrumentation::shared_state> state_;
+};
+
+
+// Wraps the models returned by another resolver.  The same wrapper is
+// returned for repeated lookups of a model, so that models can still be
+// identified by their addresses.
+class instrumenting_sub_resolver : public cosim::model_uri_sub_resolver
+{
+public:
+    instrumenting_sub_resolver(
+        std::shared_ptr<cosim::model_uri_resolver> resolver,
+        std::shared_ptr<instrumentation::shared_state> state)
+        : resolver_(std::move(resolver))
+        , state_(std::move(state))
+    {}
+
+    std::shared_ptr<cosim::model> lookup_model(const cosim::uri& modelUri) override
+    {
+        auto model = resolver_->lookup_model(modelUri);
+        if (!model) return nullptr;
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& wrapper = wrappers_[model.get()];
+        auto wrapped = wrapper.lock();
+        if (!wrapped) {
+            wrapped = std::make_shared<instrumented_model>(std::move(model), state_);
+            wrapper = wrapped;
+        }
+        return wrapped;
+    }
+
+private:
+    std::shared_ptr<cosim::model_uri_resolver> resolver_;
+    std::shared_ptr<instrumentation::shared_state> state_;
+    std::mutex mutex_;
+    std::unordered_map<const cosim::model*, std::weak_ptr<cosim::model>> wrappers_;
+};
+
+} // namespace
+
+
+instrumentation::instrumentation()
+    : state_(std::make_shared<shared_state>())
+{}
+
+
+std::shared_ptr<cosim::model_uri_resolver> instrumentation::wrap_resolver(
+    std::shared_ptr<cosim::model_uri_resolver> resolver)
+{
+    auto wrapper = std::make_shared<cosim::model_uri_resolver>();
+    wrapper->add_sub_resolver(
+        std::make_shared<instrumenting_sub_resolver>(std::move(resolver), state_));
+    return wrapper;
+}
+
+
+void instrumentation::add_step_hook(step_hook hook)
+{
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    state_->stepHooks.push_back(std::move(hook));
+}
+
+
+void instrumentation::enable_resource_accounting()
+{
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    state_->resourceAccounting = true;
+}
+
+
+void instrumentation::add_step_start_hook(step_start_hook hook)
+{
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    state_->stepStartHooks.push_back(std::move(hook));
+}
+
+
+std::vector<std::shared_ptr<const simulator_metrics>> instrumentation::simulators() const
+{
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    return state_->simulators;
+}
+
+
+int instrumentation::active_steps() const noexcept
+{
+    return state_->activeSteps;
+}
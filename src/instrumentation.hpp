@@ -0,0 +1,138 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#ifndef COSIM_INSTRUMENTATION_HPP
+#define COSIM_INSTRUMENTATION_HPP
+
+#include <cosim/orchestration.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+/**
+ *  Step statistics for one simulator.  The counters are updated by the
+ *  thread that steps the simulator, and may be read by any thread.
+ */
+struct simulator_metrics
+{
+    explicit simulator_metrics(std::string simulatorName)
+        : name(std::move(simulatorName))
+    {}
+
+    /// The simulator name.
+    const std::string name;
+
+    /// The number of completed steps.
+    std::atomic<std::uint64_t> steps = 0;
+
+    /// The total wall-clock time spent in `do_step()`, in nanoseconds.
+    std::atomic<std::int64_t> total_step_time = 0;
+
+    /// The longest time spent in a single call to `do_step()`, in nanoseconds.
+    std::atomic<std::int64_t> max_step_time = 0;
+
+    /// The time spent in the latest call to `do_step()`, in nanoseconds.
+    std::atomic<std::int64_t> last_step_time = 0;
+
+    /*
+     *  The following are only measured with resource accounting; see
+     *  `instrumentation::enable_resource_accounting()`.
+     */
+
+    /// The growth in resident memory during instantiation, in bytes.
+    std::atomic<std::int64_t> instantiation_memory = 0;
+
+    /// The growth in resident memory during setup and start, in bytes.
+    std::atomic<std::int64_t> initialization_memory = 0;
+
+    /// The number of threads created during instantiation, setup and start.
+    std::atomic<int> threads_created = 0;
+
+    /// The CPU time used by the calling threads in all calls to the simulator, in nanoseconds.
+    std::atomic<std::int64_t> cpu_time = 0;
+};
+
+
+/**
+ *  Collects measurements from simulators.
+ *
+ *  Models obtained through the resolver returned by `wrap_resolver()`
+ *  instantiate simulators that report to this object.  The models and
+ *  simulators may outlive it.  This class is thread safe.
+ */
+class instrumentation
+{
+public:
+    instrumentation();
+
+    /**
+     *  Returns a model URI resolver which obtains models from `resolver`
+     *  and instruments them.
+     */
+    std::shared_ptr<cosim::model_uri_resolver> wrap_resolver(
+        std::shared_ptr<cosim::model_uri_resolver> resolver);
+
+    /**
+     *  A function which is called before each simulator step, on the
+     *  thread that performs it.
+     */
+    using step_start_hook = std::function<void(const simulator_metrics& simulator)>;
+
+    /**
+     *  A function which is called after each simulator step, on the thread
+     *  that performed it, with the wall-clock start and end times of the
+     *  step.
+     */
+    using step_hook = std::function<void(
+        const simulator_metrics& simulator,
+        std::chrono::steady_clock::time_point start,
+        std::chrono::steady_clock::time_point end)>;
+
+    /**
+     *  Adds a function to be called after each step of the simulators
+     *  which are instantiated from now on.
+     */
+    void add_step_hook(step_hook hook);
+
+    /**
+     *  Adds a function to be called before each step of the simulators
+     *  which are instantiated from now on.  The functions added with
+     *  `add_step_hook()` are called in the opposite order afterwards, so
+     *  the last function added sees the step most precisely.
+     */
+    void add_step_start_hook(step_start_hook hook);
+
+    /**
+     *  Enables resource accounting for the simulators which are
+     *  instantiated from now on.
+     *
+     *  This measures the growth in resident memory and thread count
+     *  during their instantiation, setup and start, and the CPU time of
+     *  all calls to them.  To attribute the growth correctly, these calls
+     *  are serialised, even if they are made from different threads.
+     */
+    void enable_resource_accounting();
+
+    /// Returns the statistics of all simulators instantiated so far.
+    std::vector<std::shared_ptr<const simulator_metrics>> simulators() const;
+
+    /// Returns the number of simulators which are currently performing a step.
+    int active_steps() const noexcept;
+
+    struct shared_state;
+
+private:
+    std::shared_ptr<shared_state> state_;
+};
+
+
+#endif
@@ -0,0 +1,204 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#include "jobserver.hpp"
+
+#include <cosim/log/logger.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#ifndef _WIN32
+#    include <fcntl.h>
+#    include <poll.h>
+#    include <unistd.h>
+#endif
+
+
+#ifdef _WIN32
+
+jobserver_tokens::jobserver_tokens(int readFd, int writeFd, bool ownsFds) noexcept
+    : readFd_(readFd)
+    , writeFd_(writeFd)
+    , ownsFds_(ownsFds)
+{}
+
+jobserver_tokens::~jobserver_tokens() = default;
+
+void jobserver_tokens::try_acquire(unsigned int) {}
+
+std::unique_ptr<jobserver_tokens> acquire_jobserver_tokens(unsigned int)
+{
+    return nullptr;
+}
+
+#else
+
+namespace
+{
+
+struct jobserver_auth
+{
+    std::optional<std::string> fifo;
+    int readFd = -1;
+    int writeFd = -1;
+};
+
+// Extracts the jobserver details from the value of MAKEFLAGS.  If the
+// option occurs several times, the last one applies.
+std::optional<jobserver_auth> parse_makeflags(std::string_view makeflags)
+{
+    std::optional<jobserver_auth> auth;
+    while (!makeflags.empty()) {
+        const auto wordEnd = std::min(makeflags.find(' '), makeflags.size());
+        auto word = makeflags.substr(0, wordEnd);
+        makeflags.remove_prefix(std::min(wordEnd + 1, makeflags.size()));
+
+        std::string_view value;
+        for (const std::string_view prefix : {"--jobserver-auth=", "--jobserver-fds="}) {
+            if (word.substr(0, prefix.size()) == prefix) value = word.substr(prefix.size());
+        }
+        if (value.empty()) continue;
+
+        jobserver_auth a;
+        if (value.substr(0, 5) == "fifo:") {
+            a.fifo = std::string(value.substr(5));
+        } else {
+            const auto comma = value.find(',');
+            if (comma == std::string_view::npos) continue;
+            char* end = nullptr;
+            const auto r = std::string(value.substr(0, comma));
+            const auto w = std::string(value.substr(comma + 1));
+            a.readFd = static_cast<int>(std::strtol(r.c_str(), &end, 10));
+            if (*end != '\0') continue;
+            a.writeFd = static_cast<int>(std::strtol(w.c_str(), &end, 10));
+            if (*end != '\0') continue;
+        }
+        auth = std::move(a);
+    }
+    return auth;
+}
+
+bool is_valid_fd(int fd)
+{
+    return fd >= 0 && ::fcntl(fd, F_GETFD) != -1;
+}
+
+// Opens the file that an inherited descriptor refers to anew, like make
+// 4.4 does, so that we get a file description of our own whose mode we
+// can change without affecting make and the other processes that share
+// the inherited one.  Returns -1 on failure, e.g. on systems without /proc.
+int reopen_fd(int fd, int flags)
+{
+    const auto path = "/proc/self/fd/" + std::to_string(fd);
+    return ::open(path.c_str(), flags | O_CLOEXEC);
+}
+
+} // namespace
+
+
+jobserver_tokens::jobserver_tokens(int readFd, int writeFd, bool ownsFds) noexcept
+    : readFd_(readFd)
+    , writeFd_(writeFd)
+    , ownsFds_(ownsFds)
+{}
+
+
+jobserver_tokens::~jobserver_tokens()
+{
+    // Tokens must be returned with the same byte values as we got them.
+    std::string_view remaining = tokens_;
+    while (!remaining.empty()) {
+        const auto n = ::write(writeFd_, remaining.data(), remaining.size());
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            BOOST_LOG_SEV(cosim::log::logger(), cosim::log::warning)
+                << "Failed to return " << remaining.size()
+                << " token(s) to the make jobserver";
+            break;
+        }
+        remaining.remove_prefix(static_cast<std::size_t>(n));
+    }
+    if (ownsFds_) {
+        ::close(readFd_);
+        if (writeFd_ != readFd_) ::close(writeFd_);
+    }
+}
+
+
+void jobserver_tokens::try_acquire(unsigned int count)
+{
+    // The read end is nonblocking if we have opened it ourselves.
+    // Otherwise, we share it with make and other processes and must not
+    // change its mode, so we check for available tokens first.  Another
+    // process could then take the token between the check and the read,
+    // in which case we wait for the next one.
+    while (count > 0) {
+        if (!ownsFds_) {
+            pollfd pfd = {readFd_, POLLIN, 0};
+            if (::poll(&pfd, 1, 0) <= 0) break;
+        }
+        char token;
+        const auto n = ::read(readFd_, &token, 1);
+        if (n == 1) {
+            tokens_ += token;
+            --count;
+        } else if (n == 0 || errno != EINTR) {
+            break;
+        }
+    }
+}
+
+
+std::unique_ptr<jobserver_tokens> acquire_jobserver_tokens(unsigned int maxCount)
+{
+    const auto makeflags = std::getenv("MAKEFLAGS");
+    if (!makeflags) return nullptr;
+    const auto auth = parse_makeflags(makeflags);
+    if (!auth) return nullptr;
+
+    std::unique_ptr<jobserver_tokens> tokens;
+    if (auth->fifo) {
+        const auto readFd = ::open(auth->fifo->c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        const auto writeFd = ::open(auth->fifo->c_str(), O_WRONLY | O_CLOEXEC);
+        if (readFd < 0 || writeFd < 0) {
+            if (readFd >= 0) ::close(readFd);
+            if (writeFd >= 0) ::close(writeFd);
+            BOOST_LOG_SEV(cosim::log::logger(), cosim::log::warning)
+                << "Unable to open make jobserver FIFO " << *auth->fifo
+                << "; ignoring jobserver";
+            return nullptr;
+        }
+        tokens = std::make_unique<jobserver_tokens>(readFd, writeFd, true);
+    } else {
+        if (!is_valid_fd(auth->readFd) || !is_valid_fd(auth->writeFd)) {
+            BOOST_LOG_SEV(cosim::log::logger(), cosim::log::debug)
+                << "make jobserver file descriptors are not available "
+                << "(is the recipe marked with '+'?); ignoring jobserver";
+            return nullptr;
+        }
+        const auto readFd = reopen_fd(auth->readFd, O_RDONLY | O_NONBLOCK);
+        const auto writeFd = reopen_fd(auth->writeFd, O_WRONLY);
+        if (readFd >= 0 && writeFd >= 0) {
+            tokens = std::make_unique<jobserver_tokens>(readFd, writeFd, true);
+        } else {
+            if (readFd >= 0) ::close(readFd);
+            if (writeFd >= 0) ::close(writeFd);
+            tokens = std::make_unique<jobserver_tokens>(auth->readFd, auth->writeFd, false);
+        }
+    }
+
+    tokens->try_acquire(maxCount);
+    BOOST_LOG_SEV(cosim::log::logger(), cosim::log::info)
+        << "Acquired " << tokens->count() << " of " << maxCount
+        << " requested job slot(s) from the make jobserver";
+    return tokens;
+}
+
+#endif
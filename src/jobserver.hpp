@@ -0,0 +1,69 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#ifndef COSIM_JOBSERVER_HPP
+#define COSIM_JOBSERVER_HPP
+
+#include <memory>
+#include <string>
+
+
+/**
+ *  Job slots ("tokens") acquired from a GNU make jobserver.
+ *
+ *  Every process started by make implicitly owns one job slot, which it
+ *  uses for its main thread.  Additional threads should only be used if
+ *  the corresponding number of tokens have been acquired from the
+ *  jobserver.  The tokens are returned when this object is destroyed.
+ */
+class jobserver_tokens
+{
+public:
+    jobserver_tokens(int readFd, int writeFd, bool ownsFds) noexcept;
+
+    jobserver_tokens(const jobserver_tokens&) = delete;
+    jobserver_tokens& operator=(const jobserver_tokens&) = delete;
+
+    ~jobserver_tokens();
+
+    /**
+     *  Acquires up to `count` more tokens, without waiting for any.
+     *
+     *  If the jobserver file descriptors are inherited ones which could
+     *  not be opened anew, their mode can't be changed, and another
+     *  process may take a token that was seen as available.  This call
+     *  then waits until the next token becomes available.
+     */
+    void try_acquire(unsigned int count);
+
+    /// The number of tokens held.
+    unsigned int count() const noexcept { return static_cast<unsigned int>(tokens_.size()); }
+
+private:
+    int readFd_;
+    int writeFd_;
+    bool ownsFds_;
+    std::string tokens_;
+};
+
+
+/**
+ *  Connects to the jobserver of a parent GNU make process, if any, and
+ *  acquires up to `maxCount` tokens from it.
+ *
+ *  The jobserver is found through the `MAKEFLAGS` environment variable.
+ *  Both the pipe-based (`--jobserver-auth=R,W`) and the named-pipe-based
+ *  (`--jobserver-auth=fifo:PATH`) variants of the protocol are supported.
+ *  Inherited pipe descriptors are opened anew through `/proc/self/fd`
+ *  where possible, so tokens can be read without blocking.
+ *  Returns null if there is no usable jobserver, which includes the case
+ *  where make hasn't passed its file descriptors on to us because the
+ *  recipe is not marked as recursive with '+'.  Always returns null on
+ *  Windows.
+ */
+std::unique_ptr<jobserver_tokens> acquire_jobserver_tokens(unsigned int maxCount);
+
+
+#endif
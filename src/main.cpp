@@ -5,11 +5,14 @@
  */
 #include "clean_cache.hpp"
 #include "cli_application.hpp"
+#include "index.hpp"
 #include "inspect.hpp"
 #include "logging_options.hpp"
 #include "project_version_from_cmake.hpp"
 #include "run.hpp"
+#include "run_batch.hpp"
 #include "run_single.hpp"
+#include "serve.hpp"
 #include "version_option.hpp"
 
 #include <boost/log/expressions.hpp>
@@ -38,8 +41,11 @@ int main(int argc, char const* const* argv)
     app.add_global_options(std::make_unique<logging_options>());
     app.add_global_options(std::make_unique<version_option>("cosim", project_version));
     app.add_subcommand(std::make_unique<clean_cache_subcommand>());
+    app.add_subcommand(std::make_unique<index_subcommand>());
     app.add_subcommand(std::make_unique<inspect_subcommand>());
     app.add_subcommand(std::make_unique<run_subcommand>());
+    app.add_subcommand(std::make_unique<run_batch_subcommand>());
     app.add_subcommand(std::make_unique<run_single_subcommand>());
+    app.add_subcommand(std::make_unique<serve_subcommand>());
     return app.run(argc, argv);
 }
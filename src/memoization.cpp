@@ -0,0 +1,301 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#include "memoization.hpp"
+
+#include "cache.hpp"
+#include "fingerprint.hpp"
+#include "project_version_from_cmake.hpp"
+#include "tools.hpp"
+
+#include <cosim/lib_info.hpp>
+#include <cosim/log/logger.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+
+namespace
+{
+
+// Returns a hash of the contents of a file, or a fixed string if the file
+// does not exist.
+std::string content_hash(const cosim::filesystem::path& path)
+{
+    std::ifstream stream(path.string(), std::ios::binary);
+    if (!stream) return "missing";
+    return hash_string(std::string(
+        std::istreambuf_iterator<char>(stream),
+        std::istreambuf_iterator<char>()));
+}
+
+std::string fingerprint_string(const file_fingerprint& fp)
+{
+    return fp.path + ' ' + std::to_string(fp.size) + ' ' +
+        std::to_string(fp.mtime) + ' ' + std::to_string(fp.inode);
+}
+
+bool is_ssp_archive(const cosim::filesystem::path& path)
+{
+    return path.extension() == ".ssp" && !cosim::filesystem::is_directory(path);
+}
+
+// Describes the system structure definition file.  An SSP archive may
+// be very large, since it contains the FMUs, so it is identified by its
+// fingerprint rather than by its contents.
+std::string system_structure_source(const cosim::filesystem::path& path)
+{
+    if (is_ssp_archive(path)) return "ssp " + fingerprint_string(fingerprint_file(path));
+    if (!cosim::filesystem::is_directory(path)) return "file " + content_hash(path);
+    if (cosim::filesystem::exists(path / "OspSystemStructure.xml")) {
+        return "osp " + content_hash(path / "OspSystemStructure.xml");
+    }
+    return "ssd " + content_hash(path / "SystemStructure.ssd");
+}
+
+std::string output_config_source(const system_run_options& options)
+{
+    if (options.output_config == "auto") {
+        const auto& systemPath = options.system_structure_path;
+        const auto systemDir = cosim::filesystem::is_directory(systemPath)
+            ? systemPath
+            : systemPath.parent_path();
+        return "auto " + content_hash(systemDir / "LogConfig.xml");
+    }
+    if (options.output_config == "all" || options.output_config == "none") {
+        return options.output_config;
+    }
+    return "file " + content_hash(options.output_config);
+}
+
+std::string scalar_string(const cosim::scalar_value& value)
+{
+    return std::visit(
+        [](const auto& v) {
+            using T = std::decay_t<decltype(v)>;
+            std::ostringstream s;
+            if constexpr (std::is_same_v<T, double>) {
+                s << "real " << std::setprecision(17) << v;
+            } else if constexpr (std::is_same_v<T, int>) {
+                s << "integer " << v;
+            } else if constexpr (std::is_same_v<T, bool>) {
+                s << "boolean " << v;
+            } else {
+                s << "string " << quoted_string(v);
+            }
+            return s.str();
+        },
+        value);
+}
+
+// Returns the paths of all regular files under `dir`, relative to `dir`,
+// sorted lexicographically.
+std::vector<cosim::filesystem::path> list_files(const cosim::filesystem::path& dir)
+{
+    std::vector<cosim::filesystem::path> files;
+    if (!cosim::filesystem::is_directory(dir)) return files;
+    for (const auto& entry : cosim::filesystem::recursive_directory_iterator(dir)) {
+        if (entry.is_regular_file()) {
+            files.push_back(cosim::filesystem::relative(entry.path(), dir));
+        }
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+void copy_files(const cosim::filesystem::path& from, const cosim::filesystem::path& to)
+{
+    for (const auto& file : list_files(from)) {
+        cosim::filesystem::create_directories((to / file).parent_path());
+        cosim::filesystem::copy_file(
+            from / file,
+            to / file,
+            cosim::filesystem::copy_options::overwrite_existing);
+    }
+}
+
+bool same_contents(const cosim::filesystem::path& a, const cosim::filesystem::path& b)
+{
+    std::ifstream streamA(a.string(), std::ios::binary);
+    std::ifstream streamB(b.string(), std::ios::binary);
+    if (!streamA || !streamB) return false;
+    return std::equal(
+        std::istreambuf_iterator<char>(streamA),
+        std::istreambuf_iterator<char>(),
+        std::istreambuf_iterator<char>(streamB),
+        std::istreambuf_iterator<char>());
+}
+
+} // namespace
+
+
+std::string simulation_input_key(
+    const system_config& config,
+    const system_run_options& options)
+{
+    const auto libcosimVersion = cosim::library_version();
+    std::ostringstream material;
+    material
+        << "cosim " << project_version << '\n'
+        << "libcosim " << libcosimVersion.major << '.' << libcosimVersion.minor
+        << '.' << libcosimVersion.patch << '\n'
+        << "system " << system_structure_source(options.system_structure_path) << '\n';
+
+    // The models in an SSP archive are covered by the archive fingerprint,
+    // and the paths they are unpacked to depend on the cache location.
+    const bool includeModelFiles = !is_ssp_archive(options.system_structure_path);
+    for (const auto& entity : config.structure.entities()) {
+        material << "entity " << quoted_string(entity.name) << ' '
+                 << entity.step_size_hint.count();
+        if (const auto model = std::get_if<std::shared_ptr<cosim::model>>(&entity.type)) {
+            const auto description = (*model)->description();
+            material << " model " << quoted_string(description->uuid);
+            const auto uri = config.model_uris.find(model->get());
+            if (includeModelFiles && uri != config.model_uris.end()) {
+                material << ' ' << quoted_string(uri->second.view());
+                if (const auto fmuPath = local_fmu_path(uri->second)) {
+                    material << ' ' << fingerprint_string(fingerprint_file(*fmuPath));
+                }
+            }
+        } else {
+            material << " function";
+        }
+        material << '\n';
+    }
+
+    std::vector<std::string> connections;
+    for (const auto& c : config.structure.connections()) {
+        connections.push_back(
+            "connection " + to_text(c.source) + ' ' + to_text(c.target));
+    }
+    std::sort(connections.begin(), connections.end());
+    for (const auto& c : connections) material << c << '\n';
+
+    material << "parameter_set " << quoted_string(options.parameter_set) << '\n';
+    const auto parameterSet = config.parameter_sets.find(options.parameter_set);
+    if (parameterSet != config.parameter_sets.end()) {
+        std::vector<std::string> values;
+        for (const auto& [name, value] : parameterSet->second) {
+            values.push_back("value " + to_text(name) + ' ' + scalar_string(value));
+        }
+        std::sort(values.begin(), values.end());
+        for (const auto& v : values) material << v << '\n';
+    }
+
+    if (const auto params = std::get_if<cosim::fixed_step_algorithm_params>(&config.algorithm)) {
+        material << "base_step_size " << params->base_step_size.count() << '\n';
+    }
+    material
+        << "begin " << options.begin_time.time_since_epoch().count() << '\n'
+        << "end " << options.end_time.time_since_epoch().count() << '\n'
+        << "output_config " << output_config_source(options) << '\n';
+    if (options.scenario) {
+        material
+            << "scenario " << content_hash(*options.scenario) << ' '
+            << options.scenario_start.time_since_epoch().count() << '\n';
+    }
+    return hash_string(material.str());
+}
+
+
+memoized_result::memoized_result(
+    const system_config& config,
+    const system_run_options& options)
+    : key_(simulation_input_key(config, options))
+{
+    const auto resultsDir = memoized_results_path();
+    if (!resultsDir) {
+        throw std::runtime_error(
+            "Unable to determine user cache directory; cannot memoize results.");
+    }
+    entryDir_ = *resultsDir / key_;
+}
+
+
+memoized_result::~memoized_result() noexcept
+{
+    if (recordingDir_) {
+        std::error_code ec;
+        cosim::filesystem::remove_all(*recordingDir_, ec);
+    }
+}
+
+
+bool memoized_result::exists() const
+{
+    return cosim::filesystem::is_directory(entryDir_);
+}
+
+
+void memoized_result::restore(const cosim::filesystem::path& outputDir) const
+{
+    copy_files(entryDir_, outputDir);
+}
+
+
+cosim::filesystem::path memoized_result::begin_recording()
+{
+    if (recordingDir_) throw std::logic_error("Recording already started");
+    std::random_device randomDevice;
+    std::ostringstream name;
+    name << key_ << '.' << std::hex << randomDevice() << ".recording";
+    recordingDir_ = entryDir_.parent_path() / name.str();
+    // Locked before the directory is created, so `clean_cache()` never
+    // sees it unlocked.
+    recordingLock_.emplace(*recordingDir_);
+    cosim::filesystem::create_directories(*recordingDir_);
+    return *recordingDir_;
+}
+
+
+bool memoized_result::recording_matches_stored() const
+{
+    if (!recordingDir_) throw std::logic_error("No recording");
+
+    // Output file names contain a timestamp, so files are paired up by
+    // their position in the sorted list rather than by name.
+    const auto recordedFiles = list_files(*recordingDir_);
+    const auto storedFiles = list_files(entryDir_);
+    if (recordedFiles.size() != storedFiles.size()) return false;
+    for (std::size_t i = 0; i < recordedFiles.size(); ++i) {
+        if (!same_contents(*recordingDir_ / recordedFiles[i], entryDir_ / storedFiles[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+void memoized_result::finish_recording(const cosim::filesystem::path& outputDir)
+{
+    if (!recordingDir_) throw std::logic_error("No recording");
+    cosim::filesystem::create_directories(outputDir);
+    copy_files(*recordingDir_, outputDir);
+    if (exists()) return;
+
+    // Renaming fails if another process has stored the same result in
+    // the meantime, which is harmless.
+    std::error_code ec;
+    cosim::filesystem::rename(*recordingDir_, entryDir_, ec);
+    if (ec) {
+        BOOST_LOG_SEV(cosim::log::logger(), cosim::log::debug)
+            << "Unable to store memoized result " << entryDir_ << ": " << ec.message();
+        return;
+    }
+    recordingDir_.reset();
+    recordingLock_.reset();
+    BOOST_LOG_SEV(cosim::log::logger(), cosim::log::info)
+        << "Stored memoized result: " << entryDir_;
+}
@@ -0,0 +1,97 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#ifndef COSIM_MEMOIZATION_HPP
+#define COSIM_MEMOIZATION_HPP
+
+#include "cache.hpp"
+#include "system_config.hpp"
+#include "system_run.hpp"
+
+#include <cosim/fs_portability.hpp>
+
+#include <optional>
+#include <string>
+
+
+/**
+ *  Computes a key which identifies the inputs to a simulation.
+ *
+ *  The key is a hash of everything that may influence the simulation
+ *  results:  the system structure definition file, the models and the
+ *  fingerprints of their FMU files, the initial values, the algorithm
+ *  settings, the begin and end times, the scenario, the output
+ *  configuration, and the program and libcosim versions.  Settings that
+ *  only affect how fast the simulation runs, such as the number of worker
+ *  threads and the real-time factor, are not included.
+ */
+std::string simulation_input_key(
+    const system_config& config,
+    const system_run_options& options);
+
+
+/**
+ *  The stored results of a simulation, in the application cache directory.
+ *
+ *  A new result is recorded by simulating into the directory returned by
+ *  `begin_recording()` and then calling `finish_recording()`.  The
+ *  recording is only stored once it is complete, so a failed or
+ *  interrupted simulation never leaves a partial result behind.  The
+ *  recording directory is locked while it is in use, so `clean_cache()`
+ *  can tell abandoned recordings, e.g. from crashed processes, from ones
+ *  that are in progress.
+ */
+class memoized_result
+{
+public:
+    /**
+     *  Looks up the result for the given simulation inputs.
+     *
+     *  Throws `std::runtime_error` if the cache directory could not be
+     *  determined.
+     */
+    memoized_result(const system_config& config, const system_run_options& options);
+
+    ~memoized_result() noexcept;
+
+    memoized_result(const memoized_result&) = delete;
+    memoized_result& operator=(const memoized_result&) = delete;
+
+    /// The simulation input key.
+    const std::string& key() const noexcept { return key_; }
+
+    /// Returns whether a result has been stored for these inputs.
+    bool exists() const;
+
+    /// Copies the stored output files into `outputDir`.
+    void restore(const cosim::filesystem::path& outputDir) const;
+
+    /**
+     *  Creates and returns an empty directory in which the output of a
+     *  new simulation should be written.
+     */
+    cosim::filesystem::path begin_recording();
+
+    /**
+     *  Returns whether the recorded output is identical to the stored
+     *  result.  Used to check whether simulations are deterministic.
+     */
+    bool recording_matches_stored() const;
+
+    /**
+     *  Copies the recorded output into `outputDir` and stores it, unless
+     *  a result has already been stored.
+     */
+    void finish_recording(const cosim::filesystem::path& outputDir);
+
+private:
+    std::string key_;
+    cosim::filesystem::path entryDir_;
+    std::optional<cosim::filesystem::path> recordingDir_;
+    std::optional<cache_entry_lock> recordingLock_;
+};
+
+
+#endif
@@ -0,0 +1,333 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#include "metrics.hpp"
+
+#include "tools.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+
+#ifdef __linux__
+#    include <unistd.h>
+#endif
+
+
+namespace
+{
+
+std::string format_number(double value)
+{
+    char buffer[32];
+    const auto result = std::to_chars(buffer, buffer + sizeof buffer, value);
+    return std::string(buffer, result.ptr);
+}
+
+std::string escape_label_value(const std::string& value)
+{
+    std::string escaped;
+    for (const char c : value) {
+        if (c == '\\') {
+            escaped += "\\\\";
+        } else if (c == '"') {
+            escaped += "\\\"";
+        } else if (c == '\n') {
+            escaped += "\\n";
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+// Builds a file in the Prometheus text exposition format.
+class prometheus_writer
+{
+public:
+    explicit prometheus_writer(const std::vector<std::pair<std::string, std::string>>& labels)
+    {
+        for (const auto& [name, value] : labels) {
+            commonLabels_ += (commonLabels_.empty() ? "" : ",") + name + "=\"" +
+                escape_label_value(value) + '"';
+        }
+    }
+
+    void metric(const char* name, const char* type, const char* help)
+    {
+        text_ += std::string("# HELP ") + name + ' ' + help + '\n';
+        text_ += std::string("# TYPE ") + name + ' ' + type + '\n';
+    }
+
+    void sample(const char* name, double value, const std::string& simulator = {})
+    {
+        auto labels = commonLabels_;
+        if (!simulator.empty()) {
+            labels += (labels.empty() ? "" : ",") + std::string("simulator=\"") +
+                escape_label_value(simulator) + '"';
+        }
+        text_ += name;
+        if (!labels.empty()) text_ += '{' + labels + '}';
+        text_ += ' ' + format_number(value) + '\n';
+    }
+
+    const std::string& text() const noexcept { return text_; }
+
+private:
+    std::string commonLabels_;
+    std::string text_;
+};
+
+double to_seconds(std::int64_t nanoseconds)
+{
+    return nanoseconds * 1e-9;
+}
+
+double to_mebibytes(std::int64_t bytes)
+{
+    return static_cast<double>(bytes) / (1024 * 1024);
+}
+
+std::int64_t memory_growth(const simulator_metrics& s)
+{
+    return s.instantiation_memory + s.initialization_memory;
+}
+
+std::optional<std::uint64_t> total_size(const cosim::filesystem::path& path)
+{
+    std::error_code ec;
+    if (!cosim::filesystem::is_directory(path, ec)) {
+        const auto size = cosim::filesystem::file_size(path, ec);
+        if (ec) return std::nullopt;
+        return size;
+    }
+    std::uint64_t size = 0;
+    for (auto it = cosim::filesystem::recursive_directory_iterator(path, ec);
+         !ec && it != cosim::filesystem::recursive_directory_iterator();
+         it.increment(ec)) {
+        std::error_code fileError;
+        if (it->is_regular_file(fileError)) {
+            const auto fileSize = it->file_size(fileError);
+            if (!fileError) size += fileSize;
+        }
+    }
+    return size;
+}
+
+} // namespace
+
+
+std::optional<std::uint64_t> resident_set_size()
+{
+#ifdef __linux__
+    std::ifstream statm("/proc/self/statm");
+    std::uint64_t totalPages = 0;
+    std::uint64_t residentPages = 0;
+    if (statm >> totalPages >> residentPages) {
+        return residentPages * static_cast<std::uint64_t>(::sysconf(_SC_PAGESIZE));
+    }
+#endif
+    return std::nullopt;
+}
+
+
+std::optional<int> thread_count()
+{
+#ifdef __linux__
+    std::ifstream status("/proc/self/status");
+    for (std::string line; std::getline(status, line);) {
+        if (line.rfind("Threads:", 0) == 0) {
+            try {
+                return std::stoi(line.substr(8));
+            } catch (const std::logic_error&) {
+                return std::nullopt;
+            }
+        }
+    }
+#endif
+    return std::nullopt;
+}
+
+
+void print_resource_usage(
+    std::ostream& out,
+    const std::vector<std::shared_ptr<const simulator_metrics>>& simulators)
+{
+    auto sorted = simulators;
+    std::stable_sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) {
+        return memory_growth(*a) > memory_growth(*b);
+    });
+    std::size_t nameWidth = 9;
+    for (const auto& s : sorted) nameWidth = std::max(nameWidth, s->name.size());
+
+    out << std::left << std::setw(nameWidth) << "simulator" << "  "
+        << std::right << std::setw(12) << "inst. [MiB]" << "  "
+        << std::setw(12) << "init. [MiB]" << "  "
+        << std::setw(12) << "total [MiB]" << "  "
+        << std::setw(7) << "threads" << "  "
+        << std::setw(10) << "CPU [s]" << '\n';
+    out << std::fixed;
+    for (const auto& s : sorted) {
+        out << std::left << std::setw(nameWidth) << s->name << "  " << std::right
+            << std::setprecision(1)
+            << std::setw(12) << to_mebibytes(s->instantiation_memory) << "  "
+            << std::setw(12) << to_mebibytes(s->initialization_memory) << "  "
+            << std::setw(12) << to_mebibytes(memory_growth(*s)) << "  "
+            << std::setw(7) << s->threads_created << "  "
+            << std::setprecision(3)
+            << std::setw(10) << to_seconds(s->cpu_time) << '\n';
+    }
+    out << std::defaultfloat << std::setprecision(6);
+}
+
+
+void write_resource_usage_file(
+    const cosim::filesystem::path& file,
+    const std::vector<std::shared_ptr<const simulator_metrics>>& simulators)
+{
+    std::string out = "[";
+    for (std::size_t i = 0; i < simulators.size(); ++i) {
+        const auto& s = *simulators[i];
+        out += i == 0 ? "\n" : ",\n";
+        out += "  {\"name\": " + quoted_string(s.name) +
+            ", \"instantiation_memory\": " + std::to_string(s.instantiation_memory) +
+            ", \"initialization_memory\": " + std::to_string(s.initialization_memory) +
+            ", \"threads_created\": " + std::to_string(s.threads_created) +
+            ", \"cpu_time\": " + format_number(to_seconds(s.cpu_time)) +
+            ", \"steps\": " + std::to_string(s.steps) + "}";
+    }
+    out += simulators.empty() ? "]\n" : "\n]\n";
+    write_file_atomically(file, out);
+}
+
+
+metrics_file::metrics_file(
+    cosim::filesystem::path file,
+    std::shared_ptr<const instrumentation> instrumentation,
+    std::optional<cosim::filesystem::path> outputPath,
+    std::vector<std::pair<std::string, std::string>> labels,
+    std::chrono::duration<double> interval)
+    : file_(std::move(file))
+    , instrumentation_(std::move(instrumentation))
+    , outputPath_(std::move(outputPath))
+    , labels_(std::move(labels))
+    , interval_(interval)
+{}
+
+
+void metrics_file::update(cosim::time_point currentTime)
+{
+    const auto now = clock::now();
+    if (!wallStartTime_) {
+        wallStartTime_ = now;
+        startTime_ = currentTime;
+    } else if (currentTime > currentTime_) {
+        ++stepCount_;
+    }
+    currentTime_ = currentTime;
+    if (stepCount_ == 0 || now - lastWriteTime_ >= interval_) write();
+}
+
+
+void metrics_file::write()
+{
+    const auto now = clock::now();
+    double rtf = 0.0;
+    if (wallStartTime_) {
+        const auto wallElapsed = std::chrono::duration<double>(now - *wallStartTime_).count();
+        if (wallElapsed > 0.0) {
+            rtf = cosim::to_double_duration(currentTime_ - startTime_, startTime_) / wallElapsed;
+        }
+    }
+    const auto outputBytes = outputPath_ ? total_size(*outputPath_) : std::nullopt;
+    const auto text = file_.extension() == ".json"
+        ? json_text(rtf, outputBytes)
+        : prometheus_text(rtf, outputBytes);
+    write_file_atomically(file_, text);
+    lastWriteTime_ = now;
+}
+
+
+std::string metrics_file::prometheus_text(
+    double rtf,
+    std::optional<std::uint64_t> outputBytes) const
+{
+    prometheus_writer w(labels_);
+    w.metric("cosim_steps_total", "counter", "Number of completed macro steps.");
+    w.sample("cosim_steps_total", static_cast<double>(stepCount_));
+    w.metric("cosim_logical_time_seconds", "gauge", "Current logical time.");
+    w.sample("cosim_logical_time_seconds", cosim::to_double_time_point(currentTime_));
+    w.metric("cosim_real_time_factor", "gauge", "Achieved real time factor since the start of the simulation.");
+    w.sample("cosim_real_time_factor", rtf);
+    if (outputBytes) {
+        w.metric("cosim_output_bytes", "gauge", "Size of the simulation output written so far.");
+        w.sample("cosim_output_bytes", static_cast<double>(*outputBytes));
+    }
+    w.metric("cosim_active_simulator_steps", "gauge", "Number of simulators currently performing a step.");
+    w.sample("cosim_active_simulator_steps", instrumentation_->active_steps());
+    if (const auto rss = resident_set_size()) {
+        w.metric("cosim_resident_memory_bytes", "gauge", "Resident set size of the process.");
+        w.sample("cosim_resident_memory_bytes", static_cast<double>(*rss));
+    }
+
+    const auto simulators = instrumentation_->simulators();
+    if (!simulators.empty()) {
+        w.metric("cosim_simulator_steps_total", "counter", "Number of steps completed by a simulator.");
+        for (const auto& s : simulators) {
+            w.sample("cosim_simulator_steps_total", static_cast<double>(s->steps), s->name);
+        }
+        w.metric("cosim_simulator_step_seconds_total", "counter", "Total wall-clock time spent stepping a simulator.");
+        for (const auto& s : simulators) {
+            w.sample("cosim_simulator_step_seconds_total", to_seconds(s->total_step_time), s->name);
+        }
+        w.metric("cosim_simulator_step_seconds_max", "gauge", "Longest wall-clock time of a single simulator step.");
+        for (const auto& s : simulators) {
+            w.sample("cosim_simulator_step_seconds_max", to_seconds(s->max_step_time), s->name);
+        }
+        w.metric("cosim_simulator_last_step_seconds", "gauge", "Wall-clock time of the latest simulator step.");
+        for (const auto& s : simulators) {
+            w.sample("cosim_simulator_last_step_seconds", to_seconds(s->last_step_time), s->name);
+        }
+    }
+    return w.text();
+}
+
+
+std::string metrics_file::json_text(
+    double rtf,
+    std::optional<std::uint64_t> outputBytes) const
+{
+    std::string out = "{\n  \"labels\": {";
+    for (std::size_t i = 0; i < labels_.size(); ++i) {
+        out += (i == 0 ? "" : ", ") + quoted_string(labels_[i].first) + ": " +
+            quoted_string(labels_[i].second);
+    }
+    out += "},\n";
+    out += "  \"steps\": " + std::to_string(stepCount_) + ",\n";
+    out += "  \"logical_time\": " + format_number(cosim::to_double_time_point(currentTime_)) + ",\n";
+    out += "  \"real_time_factor\": " + format_number(rtf) + ",\n";
+    if (outputBytes) out += "  \"output_bytes\": " + std::to_string(*outputBytes) + ",\n";
+    out += "  \"active_simulator_steps\": " + std::to_string(instrumentation_->active_steps()) + ",\n";
+    if (const auto rss = resident_set_size()) {
+        out += "  \"resident_memory_bytes\": " + std::to_string(*rss) + ",\n";
+    }
+    out += "  \"simulators\": [";
+    const auto simulators = instrumentation_->simulators();
+    for (std::size_t i = 0; i < simulators.size(); ++i) {
+        const auto& s = *simulators[i];
+        out += i == 0 ? "\n" : ",\n";
+        out += "    {\"name\": " + quoted_string(s.name) +
+            ", \"steps\": " + std::to_string(s.steps) +
+            ", \"step_time_total\": " + format_number(to_seconds(s.total_step_time)) +
+            ", \"step_time_max\": " + format_number(to_seconds(s.max_step_time)) +
+            ", \"last_step_time\": " + format_number(to_seconds(s.last_step_time)) + "}";
+    }
+    out += simulators.empty() ? "]\n}\n" : "\n  ]\n}\n";
+    return out;
+}
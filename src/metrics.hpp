@@ -0,0 +1,127 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#ifndef COSIM_METRICS_HPP
+#define COSIM_METRICS_HPP
+
+#include "instrumentation.hpp"
+
+#include <cosim/fs_portability.hpp>
+#include <cosim/time.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+/**
+ *  Returns the resident set size of the current process in bytes, or an
+ *  empty object if it could not be determined.
+ */
+std::optional<std::uint64_t> resident_set_size();
+
+
+/**
+ *  Returns the number of threads in the current process, or an empty
+ *  object if it could not be determined.
+ */
+std::optional<int> thread_count();
+
+
+/**
+ *  Prints a table of the resources used by each simulator, as measured
+ *  with resource accounting, with the largest memory users first.
+ */
+void print_resource_usage(
+    std::ostream& out,
+    const std::vector<std::shared_ptr<const simulator_metrics>>& simulators);
+
+
+/**
+ *  Writes the resources used by each simulator, as measured with resource
+ *  accounting, to a JSON file.
+ */
+void write_resource_usage_file(
+    const cosim::filesystem::path& file,
+    const std::vector<std::shared_ptr<const simulator_metrics>>& simulators);
+
+
+/**
+ *  A file with simulation metrics, for scraping by monitoring systems.
+ *
+ *  The file is rewritten atomically at regular intervals, so readers
+ *  always see a complete file.  If its name ends with `.json`, it is
+ *  written as a JSON object; otherwise it uses the Prometheus text
+ *  exposition format, as read by e.g. the node exporter's textfile
+ *  collector.
+ *
+ *  The metrics are the number of completed steps, the current logical
+ *  time, the achieved real time factor, the size of the simulation output,
+ *  the number of simulators currently performing a step, the resident
+ *  set size of the process, and step counts and step times for each
+ *  simulator.
+ */
+class metrics_file
+{
+public:
+    /**
+     *  Constructor.
+     *
+     *  \param file
+     *      The metrics file.
+     *  \param instrumentation
+     *      The source of per-simulator metrics.
+     *  \param outputPath
+     *      A file or directory whose total size is reported as the
+     *      amount of output written, if any.
+     *  \param labels
+     *      Name-value pairs that are attached to all metrics, to tell
+     *      simulations apart when several write metrics.
+     *  \param interval
+     *      The minimum wall-clock time between rewrites of the file.
+     */
+    metrics_file(
+        cosim::filesystem::path file,
+        std::shared_ptr<const instrumentation> instrumentation,
+        std::optional<cosim::filesystem::path> outputPath,
+        std::vector<std::pair<std::string, std::string>> labels,
+        std::chrono::duration<double> interval);
+
+    /**
+     *  Records that the simulation has reached `currentTime`, and rewrites
+     *  the file if enough time has passed since the last time.  Should be
+     *  called at the start of the simulation and after each macro step.
+     */
+    void update(cosim::time_point currentTime);
+
+    /// Rewrites the file.
+    void write();
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    std::string prometheus_text(double rtf, std::optional<std::uint64_t> outputBytes) const;
+    std::string json_text(double rtf, std::optional<std::uint64_t> outputBytes) const;
+
+    const cosim::filesystem::path file_;
+    const std::shared_ptr<const instrumentation> instrumentation_;
+    const std::optional<cosim::filesystem::path> outputPath_;
+    const std::vector<std::pair<std::string, std::string>> labels_;
+    const std::chrono::duration<double> interval_;
+
+    std::optional<clock::time_point> wallStartTime_;
+    clock::time_point lastWriteTime_;
+    cosim::time_point startTime_;
+    cosim::time_point currentTime_;
+    std::uint64_t stepCount_ = 0;
+};
+
+
+#endif
@@ -0,0 +1,231 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#include "model_index.hpp"
+
+#include "cache.hpp"
+
+#include <cosim/log/logger.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+
+
+namespace
+{
+
+// Incremented whenever the file format changes incompatibly.
+constexpr std::uint64_t formatVersion = 1;
+
+// Variables are stored as arrays rather than maps to keep the file compact.
+// The elements are: name, reference, type, causality, variability and
+// (optionally) start value.
+cbor_item_ptr encode_variable(const cosim::variable_description& v)
+{
+    auto item = make_cbor_array(v.start ? 6 : 5);
+    append_to_cbor_array(item.get(), make_cbor_string(v.name));
+    append_to_cbor_array(item.get(), make_cbor_uint(v.reference));
+    append_to_cbor_array(item.get(), make_cbor_uint(static_cast<std::uint64_t>(v.type)));
+    append_to_cbor_array(item.get(), make_cbor_uint(static_cast<std::uint64_t>(v.causality)));
+    append_to_cbor_array(item.get(), make_cbor_uint(static_cast<std::uint64_t>(v.variability)));
+    if (v.start) append_to_cbor_array(item.get(), make_cbor_scalar(*v.start));
+    return item;
+}
+
+cosim::variable_description decode_variable(const cbor_item_t* item)
+{
+    cosim::variable_description v;
+    v.name = get_cbor_string(get_cbor_array_element(item, 0));
+    v.reference = static_cast<cosim::value_reference>(
+        get_cbor_uint(get_cbor_array_element(item, 1)));
+    v.type = static_cast<cosim::variable_type>(
+        get_cbor_uint(get_cbor_array_element(item, 2)));
+    v.causality = static_cast<cosim::variable_causality>(
+        get_cbor_uint(get_cbor_array_element(item, 3)));
+    v.variability = static_cast<cosim::variable_variability>(
+        get_cbor_uint(get_cbor_array_element(item, 4)));
+    if (get_cbor_array_size(item) > 5) {
+        v.start = get_cbor_scalar(get_cbor_array_element(item, 5), v.type);
+    }
+    return v;
+}
+
+cbor_item_ptr encode_entry(const model_index_entry& entry)
+{
+    const auto& fp = entry.fingerprint;
+    const auto& md = entry.description;
+    auto item = make_cbor_map(10);
+    add_to_cbor_map(item.get(), "path", make_cbor_string(fp.path));
+    add_to_cbor_map(item.get(), "size", make_cbor_uint(fp.size));
+    add_to_cbor_map(item.get(), "mtime", make_cbor_int(fp.mtime));
+    add_to_cbor_map(item.get(), "inode", make_cbor_uint(fp.inode));
+    add_to_cbor_map(item.get(), "name", make_cbor_string(md.name));
+    add_to_cbor_map(item.get(), "uuid", make_cbor_string(md.uuid));
+    add_to_cbor_map(item.get(), "description", make_cbor_string(md.description));
+    add_to_cbor_map(item.get(), "author", make_cbor_string(md.author));
+    add_to_cbor_map(item.get(), "version", make_cbor_string(md.version));
+    auto variables = make_cbor_array(md.variables.size());
+    for (const auto& v : md.variables) {
+        append_to_cbor_array(variables.get(), encode_variable(v));
+    }
+    add_to_cbor_map(item.get(), "variables", std::move(variables));
+    return item;
+}
+
+file_fingerprint decode_fingerprint(const cbor_item_t* item)
+{
+    file_fingerprint fp;
+    fp.path = get_cbor_string(get_from_cbor_map(item, "path"));
+    fp.size = get_cbor_uint(get_from_cbor_map(item, "size"));
+    fp.mtime = get_cbor_int(get_from_cbor_map(item, "mtime"));
+    fp.inode = get_cbor_uint(get_from_cbor_map(item, "inode"));
+    return fp;
+}
+
+// Decodes the rest of an entry whose fingerprint has already been decoded.
+model_index_entry decode_entry(const cbor_item_t* item, file_fingerprint fingerprint)
+{
+    model_index_entry entry;
+    entry.fingerprint = std::move(fingerprint);
+    auto& md = entry.description;
+    md.name = get_cbor_string(get_from_cbor_map(item, "name"));
+    md.uuid = get_cbor_string(get_from_cbor_map(item, "uuid"));
+    md.description = get_cbor_string(get_from_cbor_map(item, "description"));
+    md.author = get_cbor_string(get_from_cbor_map(item, "author"));
+    md.version = get_cbor_string(get_from_cbor_map(item, "version"));
+    const auto variables = get_from_cbor_map(item, "variables");
+    const auto variableCount = get_cbor_array_size(variables);
+    md.variables.reserve(variableCount);
+    for (std::size_t i = 0; i < variableCount; ++i) {
+        md.variables.push_back(decode_variable(get_cbor_array_element(variables, i)));
+    }
+    return entry;
+}
+
+// Returns whether `path` is located somewhere inside `directory`.
+// Both paths must be absolute and canonical.
+bool is_inside(const cosim::filesystem::path& path, const cosim::filesystem::path& directory)
+{
+    const auto mismatch = std::mismatch(
+        directory.begin(), directory.end(), path.begin(), path.end());
+    return mismatch.first == directory.end();
+}
+
+} // namespace
+
+
+model_index::model_index(cosim::filesystem::path file)
+    : file_(std::move(file))
+{
+    auto root = read_cbor_file(file_);
+    if (!root) return;
+    try {
+        if (get_cbor_uint(get_from_cbor_map(root.get(), "format_version")) != formatVersion) {
+            BOOST_LOG_SEV(cosim::log::logger(), cosim::log::info)
+                << "Ignoring model index with unsupported format: " << file_;
+            return;
+        }
+        // Only the paths are decoded here; the rest of an entry is decoded
+        // by `find()`.
+        const auto models = get_from_cbor_map(root.get(), "models");
+        const auto modelCount = get_cbor_array_size(models);
+        encodedEntries_.reserve(modelCount);
+        for (std::size_t i = 0; i < modelCount; ++i) {
+            const auto model = get_cbor_array_element(models, i);
+            encodedEntries_.insert_or_assign(
+                get_cbor_string(get_from_cbor_map(model, "path")),
+                model);
+        }
+        root_ = std::move(root);
+    } catch (const std::runtime_error& e) {
+        BOOST_LOG_SEV(cosim::log::logger(), cosim::log::warning)
+            << "Ignoring invalid model index " << file_ << ": " << e.what();
+        encodedEntries_.clear();
+    }
+}
+
+
+std::optional<model_index_entry> model_index::find(const file_fingerprint& fingerprint) const
+{
+    if (const auto it = entries_.find(fingerprint.path); it != entries_.end()) {
+        if (it->second.fingerprint != fingerprint) return std::nullopt;
+        return it->second;
+    }
+    const auto it = encodedEntries_.find(fingerprint.path);
+    if (it == encodedEntries_.end()) return std::nullopt;
+    try {
+        auto storedFingerprint = decode_fingerprint(it->second);
+        if (storedFingerprint != fingerprint) return std::nullopt;
+        return decode_entry(it->second, std::move(storedFingerprint));
+    } catch (const std::runtime_error& e) {
+        BOOST_LOG_SEV(cosim::log::logger(), cosim::log::warning)
+            << "Ignoring invalid entry for " << fingerprint.path
+            << " in model index " << file_ << ": " << e.what();
+        return std::nullopt;
+    }
+}
+
+
+void model_index::insert(model_index_entry entry)
+{
+    auto path = entry.fingerprint.path;
+    encodedEntries_.erase(path);
+    entries_.insert_or_assign(std::move(path), std::move(entry));
+}
+
+
+std::size_t model_index::remove_missing(const cosim::filesystem::path& directory)
+{
+    const auto canonicalDir = cosim::filesystem::canonical(directory);
+    std::size_t removed = 0;
+    const auto removeFrom = [&](auto& entries) {
+        for (auto it = entries.begin(); it != entries.end();) {
+            const auto path = cosim::filesystem::path(it->first);
+            if (is_inside(path, canonicalDir) && !cosim::filesystem::exists(path)) {
+                it = entries.erase(it);
+                ++removed;
+            } else {
+                ++it;
+            }
+        }
+    };
+    removeFrom(encodedEntries_);
+    removeFrom(entries_);
+    return removed;
+}
+
+
+std::size_t model_index::size() const noexcept
+{
+    return encodedEntries_.size() + entries_.size();
+}
+
+
+void model_index::save() const
+{
+    // Entries that were loaded from the file are written back unchanged.
+    auto models = make_cbor_array(size());
+    for (const auto& entry : encodedEntries_) {
+        append_to_cbor_array(models.get(), share_cbor_item(entry.second));
+    }
+    for (const auto& entry : entries_) {
+        append_to_cbor_array(models.get(), encode_entry(entry.second));
+    }
+    auto root = make_cbor_map(2);
+    add_to_cbor_map(root.get(), "format_version", make_cbor_uint(formatVersion));
+    add_to_cbor_map(root.get(), "models", std::move(models));
+    cosim::filesystem::create_directories(file_.parent_path());
+    write_cbor_file(file_, root.get());
+}
+
+
+std::optional<model_index> load_user_model_index()
+{
+    const auto indexPath = model_index_path();
+    if (!indexPath || !cosim::filesystem::exists(*indexPath)) return std::nullopt;
+    return model_index(*indexPath);
+}
@@ -0,0 +1,97 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#ifndef COSIM_MODEL_INDEX_HPP
+#define COSIM_MODEL_INDEX_HPP
+
+#include "cbor_utils.hpp"
+#include "fingerprint.hpp"
+
+#include <cosim/fs_portability.hpp>
+#include <cosim/model_description.hpp>
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+
+/// An entry in a `model_index`.
+struct model_index_entry
+{
+    /// The fingerprint of the FMU archive at the time it was indexed.
+    file_fingerprint fingerprint;
+
+    /// The model description.
+    cosim::model_description description;
+};
+
+
+/**
+ *  A persistent index of FMU metadata.
+ *
+ *  The index maps FMU paths to model descriptions, and it is stored in a
+ *  compact binary (CBOR) file.  Each entry records the fingerprint of the
+ *  archive it was created from, so stale entries are easily detected.
+ *
+ *  Entries loaded from the file are kept in encoded form, and an entry is
+ *  only decoded when it is looked up, so the cost of a lookup does not
+ *  depend on the size of the index.
+ */
+class model_index
+{
+public:
+    /**
+     *  Loads the index from `file`.
+     *
+     *  If the file does not exist or is invalid, the index is initially
+     *  empty.
+     */
+    explicit model_index(cosim::filesystem::path file);
+
+    /**
+     *  Returns the entry for the FMU with the given fingerprint, or nothing
+     *  if the index contains no up-to-date entry for it.
+     */
+    std::optional<model_index_entry> find(const file_fingerprint& fingerprint) const;
+
+    /// Adds an entry, replacing any existing entry for the same path.
+    void insert(model_index_entry entry);
+
+    /**
+     *  Removes the entries for all FMUs in `directory` (recursively) which
+     *  no longer exist, and returns the number of removed entries.
+     */
+    std::size_t remove_missing(const cosim::filesystem::path& directory);
+
+    /// Returns the number of entries.
+    std::size_t size() const noexcept;
+
+    /// Writes the index to the file it was loaded from.
+    void save() const;
+
+private:
+    cosim::filesystem::path file_;
+
+    // The contents of the file, and the entries in it that have not been
+    // replaced or removed, keyed by path.
+    cbor_item_ptr root_;
+    std::unordered_map<std::string, const cbor_item_t*> encodedEntries_;
+
+    // Entries added with `insert()`.
+    std::unordered_map<std::string, model_index_entry> entries_;
+};
+
+
+/**
+ *  Loads the model index from the user cache directory, if it exists.
+ *
+ *  Returns an empty object if the cache directory could not be determined
+ *  or there is no index.
+ */
+std::optional<model_index> load_user_model_index();
+
+
+#endif
@@ -0,0 +1,78 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#ifndef COSIM_PARALLEL_HPP
+#define COSIM_PARALLEL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/// Returns `requested` if it is positive, or the number of hardware cores otherwise.
+inline unsigned int thread_count_or_default(int requested)
+{
+    if (requested > 0) return static_cast<unsigned int>(requested);
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+
+/**
+ *  Calls `function(state, i)` for each `i` in the range [0, count),
+ *  distributing the calls over up to `threadCount` threads, one of which is
+ *  the calling thread.  Each thread first obtains its own `state` by
+ *  calling `makeState()`, e.g. to open a file handle that can't be shared.
+ *
+ *  The threads pick indices one by one, so uneven workloads are balanced
+ *  automatically.  If a call throws, the remaining indices are skipped, and
+ *  the first exception is rethrown once all threads have finished.
+ */
+template<typename MakeState, typename Function>
+void parallel_for_with_state(
+    std::size_t count,
+    unsigned int threadCount,
+    MakeState&& makeState,
+    Function&& function)
+{
+    std::atomic<std::size_t> next = 0;
+    std::exception_ptr error;
+    std::mutex errorMutex;
+    const auto worker = [&]() {
+        try {
+            auto state = makeState();
+            for (auto i = next++; i < count; i = next++) function(state, i);
+        } catch (...) {
+            next = count;
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (!error) error = std::current_exception();
+        }
+    };
+
+    const auto extraThreads =
+        std::max<std::size_t>(1, std::min<std::size_t>(threadCount, count)) - 1;
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < extraThreads; ++t) threads.emplace_back(worker);
+    worker();
+    for (auto& t : threads) t.join();
+    if (error) std::rethrow_exception(error);
+}
+
+
+/// Like `parallel_for_with_state()`, but calls `function(i)` without any state.
+template<typename Function>
+void parallel_for(std::size_t count, unsigned int threadCount, Function&& function)
+{
+    parallel_for_with_state(
+        count,
+        threadCount,
+        [] { return 0; },
+        [&](int, std::size_t i) { function(i); });
+}
+
+#endif
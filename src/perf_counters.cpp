@@ -0,0 +1,253 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#include "perf_counters.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef __linux__
+#    include <linux/perf_event.h>
+#    include <sys/resource.h>
+#    include <sys/syscall.h>
+#    include <unistd.h>
+#endif
+
+
+namespace
+{
+
+struct event_counts
+{
+    std::uint64_t cycles = 0;
+    std::uint64_t instructions = 0;
+    std::uint64_t cache_misses = 0;
+    std::uint64_t context_switches = 0;
+};
+
+struct simulator_totals
+{
+    std::string name;
+    std::uint64_t steps = 0;
+    event_counts counts;
+};
+
+} // namespace
+
+
+struct perf_counter_profile::totals
+{
+    std::mutex mutex;
+    std::vector<simulator_totals> simulators;
+    std::unordered_map<const simulator_metrics*, std::size_t> indexes;
+    std::uint64_t unmeasuredSteps = 0;
+};
+
+
+namespace
+{
+
+#ifdef __linux__
+
+// A group of hardware counters for the calling thread.
+class thread_counters
+{
+public:
+    thread_counters()
+    {
+        constexpr std::array<std::uint64_t, 3> events = {
+            PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES,
+        };
+        for (const auto event : events) {
+            perf_event_attr attr{};
+            attr.size = sizeof attr;
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = event;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+            // The leader is pinned, so the counters are never multiplexed
+            // with other users of the PMU.  Reads fail instead.
+            attr.pinned = fds_.empty() ? 1 : 0;
+            const auto groupFd = fds_.empty() ? -1 : fds_.front();
+            const auto fd = static_cast<int>(
+                ::syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, 0));
+            if (fd < 0) {
+                error_ = errno;
+                return;
+            }
+            fds_.push_back(fd);
+        }
+    }
+
+    thread_counters(const thread_counters&) = delete;
+    thread_counters& operator=(const thread_counters&) = delete;
+
+    ~thread_counters()
+    {
+        for (const auto fd : fds_) ::close(fd);
+    }
+
+    // The `errno` value from opening the counters, or 0 on success.
+    int error() const noexcept { return error_; }
+
+    bool read(event_counts& counts) const noexcept
+    {
+        if (error_) return false;
+        std::array<std::uint64_t, 4> values; // count, followed by values
+        const auto bytesRead = ::read(fds_.front(), values.data(), sizeof values);
+        if (bytesRead != static_cast<ssize_t>(sizeof values)) return false;
+        counts.cycles = values[1];
+        counts.instructions = values[2];
+        counts.cache_misses = values[3];
+
+        rusage usage;
+        if (::getrusage(RUSAGE_THREAD, &usage) != 0) return false;
+        counts.context_switches =
+            static_cast<std::uint64_t>(usage.ru_nvcsw + usage.ru_nivcsw);
+        return true;
+    }
+
+private:
+    std::vector<int> fds_;
+    int error_ = 0;
+};
+
+struct thread_state
+{
+    thread_counters counters;
+    event_counts atStepStart;
+    bool started = false;
+};
+
+thread_state& current_thread_state()
+{
+    thread_local thread_state state;
+    return state;
+}
+
+std::string counter_error_message(int error)
+{
+    auto message = std::string("Unable to open hardware performance counters: ") +
+        std::strerror(error);
+    if (error == EACCES || error == EPERM) {
+        message += " (see the kernel.perf_event_paranoid sysctl)";
+    } else if (error == ENOENT || error == EOPNOTSUPP) {
+        message += " (the CPU or virtual machine does not provide them)";
+    }
+    return message;
+}
+
+#endif // __linux__
+
+double per_step(std::uint64_t count, std::uint64_t steps)
+{
+    return static_cast<double>(count) / static_cast<double>(steps);
+}
+
+} // namespace
+
+
+perf_counter_profile::perf_counter_profile()
+    : totals_(std::make_shared<totals>())
+{
+#ifdef __linux__
+    const auto& counters = current_thread_state().counters;
+    if (counters.error()) throw std::runtime_error(counter_error_message(counters.error()));
+#else
+    throw std::runtime_error("Hardware performance counters are only supported on Linux");
+#endif
+}
+
+
+void perf_counter_profile::attach(instrumentation& instr)
+{
+#ifdef __linux__
+    instr.add_step_start_hook([](const simulator_metrics&) {
+        auto& state = current_thread_state();
+        state.started = state.counters.read(state.atStepStart);
+    });
+    instr.add_step_hook([totals = totals_](const simulator_metrics& simulator, auto, auto) {
+        auto& state = current_thread_state();
+        event_counts atStepEnd;
+        const bool measured = state.started && state.counters.read(atStepEnd);
+        state.started = false;
+
+        std::lock_guard<std::mutex> lock(totals->mutex);
+        if (!measured) {
+            ++totals->unmeasuredSteps;
+            return;
+        }
+        const auto [index, isNew] =
+            totals->indexes.try_emplace(&simulator, totals->simulators.size());
+        if (isNew) totals->simulators.push_back({simulator.name, 0, {}});
+        auto& t = totals->simulators[index->second];
+        ++t.steps;
+        t.counts.cycles += atStepEnd.cycles - state.atStepStart.cycles;
+        t.counts.instructions += atStepEnd.instructions - state.atStepStart.instructions;
+        t.counts.cache_misses += atStepEnd.cache_misses - state.atStepStart.cache_misses;
+        t.counts.context_switches +=
+            atStepEnd.context_switches - state.atStepStart.context_switches;
+    });
+#else
+    (void)instr;
+#endif
+}
+
+
+void perf_counter_profile::print_report(std::ostream& out) const
+{
+    std::lock_guard<std::mutex> lock(totals_->mutex);
+    auto simulators = totals_->simulators;
+    std::sort(simulators.begin(), simulators.end(), [](const auto& a, const auto& b) {
+        return a.counts.cycles > b.counts.cycles;
+    });
+
+    std::size_t nameWidth = 9;
+    for (const auto& s : simulators) nameWidth = std::max(nameWidth, s.name.size());
+
+    out << std::left << std::setw(nameWidth) << "simulator" << "  "
+        << std::right << std::setw(8) << "steps" << "  "
+        << std::setw(12) << "cycles/step" << "  "
+        << std::setw(12) << "instr./step" << "  "
+        << std::setw(6) << "IPC" << "  "
+        << std::setw(12) << "misses/step" << "  "
+        << std::setw(8) << "MPKI" << "  "
+        << std::setw(10) << "csw/step" << '\n';
+    out << std::fixed;
+    for (const auto& s : simulators) {
+        const auto& c = s.counts;
+        out << std::left << std::setw(nameWidth) << s.name << "  "
+            << std::right << std::setw(8) << s.steps << "  "
+            << std::setprecision(0)
+            << std::setw(12) << per_step(c.cycles, s.steps) << "  "
+            << std::setw(12) << per_step(c.instructions, s.steps) << "  "
+            << std::setprecision(2)
+            << std::setw(6) << (c.cycles > 0 ? per_step(c.instructions, c.cycles) : 0.0) << "  "
+            << std::setprecision(1)
+            << std::setw(12) << per_step(c.cache_misses, s.steps) << "  "
+            << std::setprecision(2)
+            << std::setw(8)
+            << (c.instructions > 0 ? 1000.0 * per_step(c.cache_misses, c.instructions) : 0.0)
+            << "  "
+            << std::setw(10) << per_step(c.context_switches, s.steps) << '\n';
+    }
+    out << std::defaultfloat << std::setprecision(6);
+    if (totals_->unmeasuredSteps > 0) {
+        out << totals_->unmeasuredSteps
+            << " step(s) could not be measured, because the counters were unavailable\n";
+    }
+}
@@ -0,0 +1,52 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#ifndef COSIM_PERF_COUNTERS_HPP
+#define COSIM_PERF_COUNTERS_HPP
+
+#include "instrumentation.hpp"
+
+#include <memory>
+#include <ostream>
+
+
+/**
+ *  Counts hardware events during the steps of each simulator.
+ *
+ *  CPU cycles, instructions and cache misses are counted in user space
+ *  with the Linux `perf_event_open()` interface, using one set of counters
+ *  for each thread that steps simulators.  Context switches are taken
+ *  from the thread's resource usage.  Time spent outside `do_step()`,
+ *  e.g. in variable transfers, is not counted.
+ */
+class perf_counter_profile
+{
+public:
+    /**
+     *  Checks that the counters are available.
+     *
+     *  \throws std::runtime_error
+     *      If the platform does not support the counters, or if the user
+     *      is not allowed to use them.
+     */
+    perf_counter_profile();
+
+    /**
+     *  Starts counting events for the simulators that are instantiated
+     *  from models obtained through `instr` from now on.
+     */
+    void attach(instrumentation& instr);
+
+    /// Prints a table with per-step averages for each simulator.
+    void print_report(std::ostream& out) const;
+
+    struct totals;
+
+private:
+    std::shared_ptr<totals> totals_;
+};
+
+
+#endif
@@ -0,0 +1,55 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#ifndef COSIM_PROBES_HPP
+#define COSIM_PROBES_HPP
+
+/*
+ *  Static tracepoints (USDT probes) for tools such as bpftrace, SystemTap
+ *  and perf.
+ *
+ *  When the program is built with the `COSIM_USDT_PROBES` CMake option,
+ *  the `COSIM_PROBE*` macros define probes in the `cosim` provider, which
+ *  cost a single no-op instruction until a tracer attaches to them.  For
+ *  example, the following prints a histogram of the wall-clock time of
+ *  each `run-single` step:
+ *
+ *      bpftrace -e '
+ *          usdt:./cosim:cosim:step__start { @start[tid] = nsecs; }
+ *          usdt:./cosim:cosim:step__done /@start[tid]/ {
+ *              @us = hist((nsecs - @start[tid]) / 1000); delete(@start[tid]);
+ *          }' -c './cosim run-single model.fmu'
+ *
+ *  Otherwise, the macros expand to nothing, and their arguments are not
+ *  evaluated.
+ *
+ *  Logical times and durations are passed as integer nanoseconds.  The
+ *  probes are:
+ *
+ *    - `fmu__lookup__start(path)`, `fmu__lookup__done(path)`: Resolution
+ *      of a local FMU through the FMU cache.
+ *    - `fmu__unpack__start(path)`, `fmu__unpack__done(path)`: Unpacking of
+ *      an FMU into the cache, within a lookup, or of an SSP archive before
+ *      it is loaded.
+ *    - `simulation__initialized(time)`: `run` has initialized the
+ *      simulation.
+ *    - `macro__step__done(step, time)`: `run` has completed a macro step.
+ *    - `step__start(time, step_size)`, `step__done(time)`: A `run-single`
+ *      step.
+ *    - `csv__output__start(time)`, `csv__output__done(time)`: `run-single`
+ *      writing a line of output.
+ */
+
+#ifdef COSIM_USDT_PROBES
+#    include <sys/sdt.h>
+#    define COSIM_PROBE1(name, arg1) STAP_PROBE1(cosim, name, arg1)
+#    define COSIM_PROBE2(name, arg1, arg2) STAP_PROBE2(cosim, name, arg1, arg2)
+#else
+// `sizeof` counts as a use of the arguments, without evaluating them.
+#    define COSIM_PROBE1(name, arg1) ((void)sizeof(arg1))
+#    define COSIM_PROBE2(name, arg1, arg2) ((void)sizeof(arg1), (void)sizeof(arg2))
+#endif
+
+#endif
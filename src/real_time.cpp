@@ -0,0 +1,179 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#include "real_time.hpp"
+
+#include "trace.hpp"
+
+#include <cosim/log/logger.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ios>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#ifdef __linux__
+#    include <sched.h>
+#    include <sys/mman.h>
+#endif
+
+
+namespace
+{
+
+double to_microseconds(std::chrono::nanoseconds d)
+{
+    return std::chrono::duration<double, std::micro>(d).count();
+}
+
+// With the `slow_down` overrun policy, the simulation may run this much
+// faster than the target RTF while it catches up.
+constexpr double slowDownRecoveryRate = 0.1;
+
+} // namespace
+
+
+real_time_pacer::real_time_pacer(
+    double rtfTarget,
+    std::chrono::microseconds spinDuration,
+    overrun_policy overrunPolicy)
+    : rtfTarget_(rtfTarget)
+    , spinDuration_(spinDuration)
+    , overrunPolicy_(overrunPolicy)
+{}
+
+
+void real_time_pacer::start(cosim::time_point currentTime)
+{
+    startLogicalTime_ = currentTime;
+    lastLogicalTime_ = currentTime;
+    startRealTime_ = clock::now();
+}
+
+
+void real_time_pacer::sleep(cosim::time_point currentTime)
+{
+    trace_span span("real_time", "sleep");
+    if (overrunPolicy_ == overrun_policy::slow_down && scheduleOffset_ > clock::duration(0)) {
+        const auto recovery = std::chrono::duration_cast<clock::duration>(
+            slowDownRecoveryRate * to_real_duration(currentTime - lastLogicalTime_));
+        scheduleOffset_ -= std::min(scheduleOffset_, recovery);
+    }
+    lastLogicalTime_ = currentTime;
+    const auto deadline = startRealTime_ + scheduleOffset_ +
+        to_real_duration(currentTime - startLogicalTime_);
+
+    ++statistics_.steps;
+    auto now = clock::now();
+    if (now > deadline) {
+        const auto overrun = std::chrono::duration_cast<std::chrono::nanoseconds>(now - deadline);
+        ++statistics_.deadline_misses;
+        statistics_.worst_overrun = std::max(statistics_.worst_overrun, overrun);
+        switch (overrunPolicy_) {
+            case overrun_policy::catch_up:
+                statistics_.current_lag = overrun;
+                break;
+            case overrun_policy::drop_sync:
+            case overrun_policy::slow_down:
+                scheduleOffset_ += now - deadline;
+                statistics_.cumulative_slip += overrun;
+                statistics_.current_lag = std::chrono::nanoseconds(0);
+                break;
+            case overrun_policy::abort:
+                throw std::runtime_error(
+                    "Real-time deadline missed by " +
+                    std::to_string(to_microseconds(overrun)) + " us at t=" +
+                    std::to_string(cosim::to_double_time_point(currentTime)));
+        }
+        return;
+    }
+    statistics_.current_lag = std::chrono::nanoseconds(0);
+
+    if (deadline - now > spinDuration_) {
+        std::this_thread::sleep_until(deadline - spinDuration_);
+    }
+    do {
+        now = clock::now();
+    } while (now < deadline);
+
+    const auto jitter = std::chrono::duration_cast<std::chrono::nanoseconds>(now - deadline);
+    const auto jitterMicros = std::chrono::duration_cast<std::chrono::microseconds>(jitter).count();
+    const auto& limits = real_time_statistics::jitter_bucket_limits;
+    const auto bucket = std::upper_bound(limits.begin(), limits.end(), jitterMicros) - limits.begin();
+    ++statistics_.jitter_histogram[bucket];
+    statistics_.total_jitter += jitter;
+    statistics_.max_jitter = std::max(statistics_.max_jitter, jitter);
+}
+
+
+void real_time_pacer::report() const
+{
+    const auto& s = statistics_;
+    if (s.steps == 0) return;
+    BOOST_LOG_SEV(cosim::log::logger(), cosim::log::info)
+        << "Real-time pacing: " << s.steps << " steps, "
+        << s.deadline_misses << " deadline misses ("
+        << std::fixed << 100.0 * s.deadline_misses / s.steps << std::defaultfloat
+        << "%), worst overrun " << to_microseconds(s.worst_overrun) << " us, "
+        << "cumulative slip " << to_microseconds(s.cumulative_slip) << " us";
+
+    const auto onTimeSteps = s.steps - s.deadline_misses;
+    if (onTimeSteps == 0) return;
+    BOOST_LOG_SEV(cosim::log::logger(), cosim::log::info)
+        << "Wake-up jitter: mean " << to_microseconds(s.total_jitter) / onTimeSteps
+        << " us, max " << to_microseconds(s.max_jitter) << " us";
+    const auto& limits = real_time_statistics::jitter_bucket_limits;
+    for (std::size_t i = 0; i < s.jitter_histogram.size(); ++i) {
+        if (s.jitter_histogram[i] == 0) continue;
+        BOOST_LOG_SEV(cosim::log::logger(), cosim::log::info)
+            << "  "
+            << (i < limits.size() ? "< " + std::to_string(limits[i]) : ">= " + std::to_string(limits.back()))
+            << " us: " << s.jitter_histogram[i];
+    }
+}
+
+
+real_time_pacer::clock::duration real_time_pacer::to_real_duration(
+    cosim::duration logicalDuration) const
+{
+    return std::chrono::duration_cast<clock::duration>(
+        std::chrono::duration<double, std::nano>(logicalDuration.count()) / rtfTarget_);
+}
+
+
+void configure_real_time_process(std::optional<int> fifoPriority, bool lockMemory)
+{
+#ifdef __linux__
+    if (fifoPriority) {
+        sched_param param{};
+        param.sched_priority = *fifoPriority;
+        if (::sched_setscheduler(0, SCHED_FIFO, &param) == 0) {
+            BOOST_LOG_SEV(cosim::log::logger(), cosim::log::info)
+                << "Using SCHED_FIFO scheduling with priority " << *fifoPriority;
+        } else {
+            BOOST_LOG_SEV(cosim::log::logger(), cosim::log::warning)
+                << "Unable to enable SCHED_FIFO scheduling: " << std::strerror(errno);
+        }
+    }
+    if (lockMemory) {
+        if (::mlockall(MCL_CURRENT | MCL_FUTURE) == 0) {
+            BOOST_LOG_SEV(cosim::log::logger(), cosim::log::info)
+                << "Locked process memory in RAM";
+        } else {
+            BOOST_LOG_SEV(cosim::log::logger(), cosim::log::warning)
+                << "Unable to lock process memory: " << std::strerror(errno);
+        }
+    }
+#else
+    if (fifoPriority || lockMemory) {
+        BOOST_LOG_SEV(cosim::log::logger(), cosim::log::warning)
+            << "Real-time scheduling and memory locking are not supported "
+               "on this platform";
+    }
+#endif
+}
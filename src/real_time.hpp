@@ -0,0 +1,158 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#ifndef COSIM_REAL_TIME_HPP
+#define COSIM_REAL_TIME_HPP
+
+#include <cosim/time.hpp>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+
+
+/// What to do when a simulation falls behind real time.
+enum class overrun_policy
+{
+    /// Run the following steps without pausing until the simulation has caught up.
+    catch_up,
+
+    /// Give up on catching up, and resynchronise the clock at the current time.
+    drop_sync,
+
+    /**
+     *  Resynchronise the clock as for `drop_sync`, but then catch up
+     *  gradually, by running at most 10% faster than the target RTF.
+     */
+    slow_down,
+
+    /// Throw an exception.
+    abort
+};
+
+
+/// Statistics about the real-time accuracy of a simulation.
+struct real_time_statistics
+{
+    /// Upper bounds (exclusive) of the jitter histogram buckets, in microseconds.
+    static constexpr std::array<std::int64_t, 13> jitter_bucket_limits = {
+        1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000};
+
+    /// The number of steps that were paced.
+    std::uint64_t steps = 0;
+
+    /**
+     *  The number of steps which were completed after their real-time
+     *  deadline, so that there was no time left to wait.
+     */
+    std::uint64_t deadline_misses = 0;
+
+    /// The largest amount by which a step overran its deadline.
+    std::chrono::nanoseconds worst_overrun{0};
+
+    /**
+     *  Histogram of wake-up jitter, i.e., how late the timer woke up
+     *  relative to the deadline for steps that were on time.  The last
+     *  bucket counts everything above the last limit.
+     */
+    std::array<std::uint64_t, jitter_bucket_limits.size() + 1> jitter_histogram = {};
+
+    std::chrono::nanoseconds total_jitter{0};
+    std::chrono::nanoseconds max_jitter{0};
+
+    /// How far the simulation was behind schedule after the last step.
+    std::chrono::nanoseconds current_lag{0};
+
+    /**
+     *  The total amount of time by which the schedule has been shifted
+     *  because of overruns, with the `drop_sync` and `slow_down` policies.
+     */
+    std::chrono::nanoseconds cumulative_slip{0};
+};
+
+
+/**
+ *  A timer that keeps a simulation synchronised with real time.
+ *
+ *  The timer sleeps until shortly before each deadline, and then spins
+ *  (busy-waits) for the remainder.  This is much more accurate than
+ *  sleeping alone, since the operating system typically wakes sleeping
+ *  threads up tens or hundreds of microseconds late, at the cost of
+ *  keeping one core busy while spinning.
+ */
+class real_time_pacer
+{
+public:
+    /**
+     *  Constructor.
+     *
+     *  \param rtfTarget
+     *      The target real time factor.
+     *  \param spinDuration
+     *      How long before each deadline to stop sleeping and start
+     *      spinning.  Zero means that the timer only sleeps.
+     *  \param overrunPolicy
+     *      What to do when a deadline is missed.
+     */
+    real_time_pacer(
+        double rtfTarget,
+        std::chrono::microseconds spinDuration,
+        overrun_policy overrunPolicy = overrun_policy::catch_up);
+
+    /// Starts the clock.  `currentTime` is the logical start time.
+    void start(cosim::time_point currentTime);
+
+    /**
+     *  Waits until the real time that corresponds to the logical time
+     *  `currentTime`, and updates the statistics.  Throws
+     *  `std::runtime_error` if the deadline was missed and the overrun
+     *  policy is `abort`.
+     */
+    void sleep(cosim::time_point currentTime);
+
+    /// Returns the statistics collected so far.
+    const real_time_statistics& statistics() const noexcept { return statistics_; }
+
+    /// Logs a summary of the statistics.
+    void report() const;
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    // Converts an amount of logical time to real time.
+    clock::duration to_real_duration(cosim::duration logicalDuration) const;
+
+    const double rtfTarget_;
+    const std::chrono::microseconds spinDuration_;
+    const overrun_policy overrunPolicy_;
+    cosim::time_point startLogicalTime_;
+    cosim::time_point lastLogicalTime_;
+    clock::time_point startRealTime_;
+
+    // How far the schedule is currently shifted.  Equal to the cumulative
+    // slip, except with the `slow_down` policy.
+    clock::duration scheduleOffset_{0};
+    real_time_statistics statistics_;
+};
+
+
+/**
+ *  Configures the current process for real-time simulation.
+ *
+ *  If `fifoPriority` is set, the calling thread is switched to the
+ *  `SCHED_FIFO` scheduling policy with the given priority.  Threads it
+ *  creates afterwards inherit the policy.  If `lockMemory` is true, all
+ *  current and future memory pages of the process are locked in RAM, so
+ *  the simulation is never stalled by page faults.
+ *
+ *  Both usually require special privileges.  Failures are logged as
+ *  warnings, and the simulation runs with normal settings.  Only
+ *  supported on Linux.
+ */
+void configure_real_time_process(std::optional<int> fifoPriority, bool lockMemory);
+
+
+#endif
@@ -5,24 +5,40 @@
  */
 #include "run.hpp"
 
-#include "cache.hpp"
+#include "allocation_profile.hpp"
+#include "flight_recorder.hpp"
+#include "instrumentation.hpp"
+#include "memoization.hpp"
+#include "metrics.hpp"
+#include "parallel.hpp"
+#include "probes.hpp"
 #include "run_common.hpp"
+#include "system_config.hpp"
+#include "system_run.hpp"
+#include "trace.hpp"
 
-#include <cosim/algorithm/fixed_step_algorithm.hpp>
 #include <cosim/execution.hpp>
 #include <cosim/fs_portability.hpp>
-#include <cosim/manipulator/scenario_manager.hpp>
-#include <cosim/observer/file_observer.hpp>
+#include <cosim/log/logger.hpp>
 #include <cosim/observer/observer.hpp>
-#include <cosim/orchestration.hpp>
-#include <cosim/osp_config_parser.hpp>
-#include <cosim/ssp/ssp_loader.hpp>
 #include <cosim/time.hpp>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
 #include <chrono>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <map>
 #include <memory>
-#include <variant>
-#include <type_traits>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
 
 
 void run_subcommand::setup_options(
@@ -56,7 +72,62 @@ void run_subcommand::setup_options(
         ("scenario-start",
             boost::program_options::value<double>()->default_value(0.0),
             "The logical time at which the scenario will start.  "
-            "Only used if --scenario is specified.");
+            "Only used if --scenario is specified.")
+        ("parameter-set",
+            boost::program_options::value<std::string>()->value_name("name"),
+            "The name of an SSP parameter set whose values will be used as "
+            "initial values.  By default, the default (unnamed) parameter "
+            "set is used.")
+        ("all-parameter-sets",
+            "Run one simulation for each named parameter set in an SSP "
+            "system structure.  The simulations run concurrently, and the "
+            "results of each are stored in a subdirectory of the output "
+            "directory that is named after the parameter set, with "
+            "characters that are unsafe in file names replaced by "
+            "underscores.  It is an error if two parameter sets then get "
+            "the same directory name.  In this "
+            "mode, --worker-threads specifies the total number of worker "
+            "threads, which is divided between the simulations, and "
+            "instead of progress reports, the completion of each "
+            "simulation is logged.  Options for profiling and "
+            "diagnosing a single simulation, and the real-time options "
+            "other than --real-time, can't be used in this mode.")
+        ("memoize",
+            "Reuse the results of an earlier simulation with identical "
+            "inputs instead of running the simulation, if such results "
+            "exist, and store the results of new simulations for later "
+            "reuse.  The inputs comprise the system structure definition, "
+            "the FMUs, the initial values, the scenario, the output "
+            "configuration, and the begin and end times.  Results are "
+            "stored in the program cache directory.")
+        ("memoize-verify",
+            boost::program_options::value<double>()->implicit_value(1.0)->value_name("probability"),
+            "When --memoize finds earlier results, run the simulation anyway "
+            "with the given probability (1 if omitted), and compare the new "
+            "results with the earlier ones.  If they differ, the simulation "
+            "is not deterministic, and the program exits with an error.")
+        ("resource-usage",
+            boost::program_options::value<std::string>()->implicit_value("")->value_name("file"),
+            "Measure the memory, threads and CPU time used by each simulator, "
+            "and print a table of them after the simulation, with the "
+            "largest memory users first.  If a file name is given, the "
+            "measurements are written to that file as JSON instead.  "
+            "Memory and threads are measured as the growth of the process "
+            "during instantiation and initialization of each simulator, "
+            "which are therefore done one simulator at a time.  "
+            "Only supported on Linux.")
+        ("flight-recorder",
+            boost::program_options::value<double>()->value_name("seconds"),
+            "Keep the values of all real, integer and boolean variables "
+            "from the given number of seconds of logical time before the "
+            "current time in memory, after every step of every simulator.  "
+            "If the simulation fails, or the program receives SIGTERM, the "
+            "values are written to a binary file named 'flight_recorder.bin' "
+            "in the output directory.  This makes it possible to investigate "
+            "failures of simulations that store little or no other output.  "
+            "With this option, SIGTERM stops the simulation at the end of "
+            "the current macro step, and a second SIGTERM terminates the "
+            "program immediately.");
     positionalOptions.add_options()
         ("system_structure_path",
             boost::program_options::value<std::string>()->required(),
@@ -74,105 +145,16 @@ void run_subcommand::setup_options(
 namespace
 {
 
-template<class... Ts>
-struct overloaded : Ts... { using Ts::operator()...; };
-
-template<class... Ts>
-overloaded(Ts...) -> overloaded<Ts...>;
-
-cosim::execution load_system_structure(
-    const cosim::filesystem::path& path,
-    cosim::model_uri_resolver& uriResolver,
-    cosim::time_point startTime,
-    std::optional<unsigned int> workerThreadCount)
-{
-    if (path.extension() == ".xml" ||
-        (cosim::filesystem::is_directory(path) &&
-            cosim::filesystem::exists(path / "OspSystemStructure.xml"))) {
-        const auto config = cosim::load_osp_config(path, uriResolver);
-        std::shared_ptr<cosim::algorithm> algorithm;
-
-        std::visit(
-            overloaded{
-                [&algorithm, &workerThreadCount](const cosim::fixed_step_algorithm_params& params) {
-                    algorithm = std::make_shared<cosim::fixed_step_algorithm>(params, workerThreadCount);
-                },
-                [&algorithm, &workerThreadCount](const cosim::ecco_algorithm_params& params) {
-                    algorithm = std::make_shared<cosim::ecco_algorithm>(params, workerThreadCount);
-                }},
-            config.algorithm_configuration);
-
-        auto execution = cosim::execution(startTime, algorithm);
-        cosim::inject_system_structure(
-            execution,
-            config.system_structure,
-            config.initial_values);
-        return execution;
-    } else {
-        cosim::ssp_loader loader;
-        loader.set_model_uri_resolver(std::shared_ptr<cosim::model_uri_resolver>(&uriResolver, [](void*) {}));
-        const auto config = loader.load(path);
-        auto execution = cosim::execution(
-            startTime,
-            config.algorithm);
-        cosim::inject_system_structure(
-            execution,
-            config.system_structure,
-            config.parameter_sets.at(""));
-        return execution;
-    }
-}
-
-
-std::unique_ptr<cosim::observer> make_file_observer(
-    const cosim::filesystem::path& outputDir,
-    const std::string& outputConfigArg,
-    const cosim::filesystem::path& systemStructurePath)
-{
-    if (outputConfigArg == "auto") {
-        const auto systemStructureDir =
-            cosim::filesystem::is_directory(systemStructurePath)
-            ? systemStructurePath
-            : systemStructurePath.parent_path();
-        const auto autoConfigFile = systemStructureDir / "LogConfig.xml";
-        if (cosim::filesystem::exists(autoConfigFile)) {
-            return std::make_unique<cosim::file_observer>(outputDir, autoConfigFile);
-        } else {
-            return std::make_unique<cosim::file_observer>(outputDir);
-        }
-    } else if (outputConfigArg == "all") {
-        return std::make_unique<cosim::file_observer>(outputDir);
-    } else if (outputConfigArg == "none") {
-        return nullptr;
-    } else {
-        return std::make_unique<cosim::file_observer>(outputDir, outputConfigArg);
-    }
-}
-
-
-void load_scenario(
-    cosim::execution& execution,
-    const cosim::filesystem::path& scenarioPath,
-    cosim::time_point startTime)
-{
-    auto s = std::make_shared<cosim::scenario_manager>();
-    execution.add_manipulator(s);
-    s->load_scenario(scenarioPath, startTime);
-}
-
-
-class progress_monitor : public cosim::observer
+// Calls a function at the start of the simulation and after each macro
+// step.  This is used to drive progress reporting, real-time pacing and
+// metrics, all of which happen on the thread that runs the simulation.
+class step_observer : public cosim::observer
 {
 public:
-    progress_monitor(
-        cosim::time_point startTime,
-        cosim::duration duration,
-        int percentIncrement,
-        std::optional<int> mrProgressResolution)
-        : logger_(startTime, duration, percentIncrement, mrProgressResolution)
+    explicit step_observer(std::function<void(cosim::time_point)> onStep)
+        : onStep_(std::move(onStep))
     {}
 
-
 private:
     void simulator_added(cosim::simulator_index, cosim::observable*, cosim::time_point) override {}
     void simulator_removed(cosim::simulator_index, cosim::time_point) override {}
@@ -183,16 +165,18 @@ private:
         cosim::step_number /*firstStep*/,
         cosim::time_point startTime) override
     {
-        logger_.update(startTime);
+        COSIM_PROBE1(simulation__initialized, startTime.time_since_epoch().count());
+        onStep_(startTime);
     }
 
     void step_complete(
-        cosim::step_number /*lastStep*/,
+        cosim::step_number lastStep,
         cosim::duration /*lastStepSize*/,
         cosim::time_point currentTime)
         override
     {
-        logger_.update(currentTime);
+        COSIM_PROBE2(macro__step__done, lastStep, currentTime.time_since_epoch().count());
+        onStep_(currentTime);
     }
 
     void simulator_step_complete(
@@ -205,49 +189,285 @@ private:
 
     void state_restored(cosim::step_number, cosim::time_point) override {}
 
-    progress_logger logger_;
+    std::function<void(cosim::time_point)> onStep_;
+};
+
+
+// Options that only make sense for a single simulation, or which are not
+// implemented for multiple concurrent simulations, and which therefore
+// can't be combined with --all-parameter-sets.  The real-time options
+// other than --real-time need the `real_time_pacer`, which only `run`
+// uses, while --all-parameter-sets leaves pacing to libcosim.
+constexpr std::array<const char*, 16> singleRunOptions = {
+    "parameter-set",
+    "memoize",
+    "pin-threads",
+    "rt-spin",
+    "rt-fifo",
+    "rt-lock-memory",
+    "rt-overrun-policy",
+    "mr-progress",
+    "progress-interval",
+    "metrics-file",
+    "trace",
+    "perf-counters",
+    "allocation-profile",
+    "resource-usage",
+    "flight-recorder",
+    "numa",
 };
+
+
+// Returns `name` with all characters that are not safe to use in file
+// names replaced by underscores.
+std::string safe_file_name(const std::string& name)
+{
+    auto safeName = name;
+    for (auto& c : safeName) {
+        const auto uc = static_cast<unsigned char>(c);
+        if (!std::isalnum(uc) && c != '-' && c != '_' && c != '.') c = '_';
+    }
+    if (safeName.find_first_not_of('.') == std::string::npos) safeName += '_';
+    return safeName;
+}
+
+
+// Returns the output subdirectory names for the given parameter sets.
+// Throws if two of them would get the same directory, also on file
+// systems that are not case sensitive.
+std::vector<std::string> output_subdirectory_names(const std::vector<std::string>& names)
+{
+    std::vector<std::string> dirNames;
+    std::map<std::string, std::string> namesByDir;
+    for (const auto& name : names) {
+        auto& dirName = dirNames.emplace_back(safe_file_name(name));
+        auto key = dirName;
+        for (auto& c : key) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        const auto [it, inserted] = namesByDir.emplace(key, name);
+        if (!inserted) {
+            throw std::runtime_error(
+                "The results of parameter sets '" + it->second + "' and '" + name +
+                "' would be stored in the same output directory ('" + dirName + "')");
+        }
+    }
+    return dirNames;
+}
+
+
+int run_all_parameter_sets(
+    const system_run_options& baseOptions,
+    const common_run_option_values& runOptions)
+{
+    execution_factory executionFactory;
+    auto names = executionFactory.parameter_set_names(baseOptions.system_structure_path);
+    names.erase(std::remove(names.begin(), names.end(), ""), names.end());
+    if (names.empty()) {
+        throw std::runtime_error("The system structure has no named parameter sets");
+    }
+    const auto dirNames = output_subdirectory_names(names);
+
+    // The application thread of each simulation counts towards the total
+    // thread budget, and the remaining threads are divided evenly.
+    const auto threadBudget = 1 + runOptions.worker_thread_count.value_or(
+                                      std::max(1u, std::thread::hardware_concurrency()) - 1);
+    const auto concurrency = static_cast<unsigned int>(
+        std::min<std::size_t>(names.size(), threadBudget));
+    const auto workersPerRun = threadBudget / concurrency - 1;
+    BOOST_LOG_SEV(cosim::log::logger(), cosim::log::info)
+        << "Running " << names.size() << " parameter sets, "
+        << concurrency << " at a time with "
+        << workersPerRun << " worker thread(s) each";
+
+    std::atomic<std::size_t> failureCount = 0;
+    std::atomic<std::size_t> finishedCount = 0;
+    parallel_for(names.size(), concurrency, [&](std::size_t i) {
+        auto options = baseOptions;
+        options.parameter_set = names[i];
+        options.output_dir = baseOptions.output_dir / dirNames[i];
+        options.worker_thread_count = workersPerRun;
+        try {
+            cosim::filesystem::create_directories(options.output_dir);
+            auto execution = executionFactory.make_execution(options);
+            execution.simulate_until(options.end_time);
+            BOOST_LOG_SEV(cosim::log::logger(), cosim::log::info)
+                << "Simulation with parameter set '" << names[i] << "' complete ("
+                << ++finishedCount << " of " << names.size() << " finished)";
+        } catch (const std::exception& e) {
+            ++failureCount;
+            BOOST_LOG_SEV(cosim::log::logger(), cosim::log::error)
+                << "Simulation with parameter set '" << names[i] << "' failed ("
+                << ++finishedCount << " of " << names.size() << " finished): "
+                << e.what();
+        }
+    });
+
+    if (failureCount > 0) {
+        BOOST_LOG_SEV(cosim::log::logger(), cosim::log::error)
+            << failureCount << " of " << names.size() << " simulations failed";
+        return 1;
+    }
+    return 0;
+}
+
 } // namespace
 
 
 int run_subcommand::run(const boost::program_options::variables_map& args) const
 {
-    const auto runOptions = get_common_run_options(args);
-    const auto systemStructurePath =
-        cosim::filesystem::path(args["system_structure_path"].as<std::string>());
-
-    const auto uriResolver = caching_model_uri_resolver();
-    auto execution = load_system_structure(
-        systemStructurePath,
-        *uriResolver,
-        runOptions.begin_time,
-        runOptions.worker_thread_count);
-    if (runOptions.rtf_target) {
-        auto rtConfig = execution.get_real_time_config();
-        rtConfig->real_time_factor_target.store(*runOptions.rtf_target);
-        rtConfig->real_time_simulation.store(true);
-    }
-
-    auto outputObserver = make_file_observer(
-        args["output-dir"].as<std::string>(),
-        args["output-config"].as<std::string>(),
-        systemStructurePath);
-    if (outputObserver) execution.add_observer(std::move(outputObserver));
-
+    auto runOptions = get_common_run_options(args);
+    acquire_worker_thread_slots(runOptions);
+
+    system_run_options options;
+    options.system_structure_path = args["system_structure_path"].as<std::string>();
+    options.begin_time = runOptions.begin_time;
+    options.end_time = runOptions.end_time;
+    options.rtf_target = runOptions.rtf_target;
+    options.worker_thread_count = runOptions.worker_thread_count;
+    options.output_dir = args["output-dir"].as<std::string>();
+    options.output_config = args["output-config"].as<std::string>();
     if (args.count("scenario")) {
-        load_scenario(
-            execution,
-            args["scenario"].as<std::string>(),
-            cosim::to_time_point(args["scenario-start"].as<double>()));
+        options.scenario = args["scenario"].as<std::string>();
+        options.scenario_start = cosim::to_time_point(args["scenario-start"].as<double>());
+    }
+    if (args.count("parameter-set")) {
+        options.parameter_set = args["parameter-set"].as<std::string>();
+    }
+    const bool memoize = args.count("memoize") > 0;
+    double verifyProbability = 0.0;
+    if (args.count("memoize-verify")) {
+        if (!memoize) {
+            throw boost::program_options::error(
+                "Option '--memoize-verify' requires '--memoize'");
+        }
+        verifyProbability = args["memoize-verify"].as<double>();
+        if (verifyProbability < 0.0 || verifyProbability > 1.0) {
+            throw boost::program_options::error(
+                "Invalid verification probability (must be between 0 and 1)");
+        }
+    }
+    std::optional<std::string> resourceUsage;
+    if (args.count("resource-usage")) {
+        resourceUsage = args["resource-usage"].as<std::string>();
+    }
+    std::optional<cosim::duration> flightRecorderWindow;
+    if (args.count("flight-recorder")) {
+        const auto seconds = args["flight-recorder"].as<double>();
+        if (!(seconds > 0.0)) {
+            throw boost::program_options::error(
+                "Invalid flight recorder duration (must be positive)");
+        }
+        flightRecorderWindow = cosim::to_duration(seconds);
+    }
+    if (args.count("all-parameter-sets")) {
+        for (const auto option : singleRunOptions) {
+            if (args.count(option) && !args[option].defaulted()) {
+                throw boost::program_options::error(
+                    std::string("Options '--") + option +
+                    "' and '--all-parameter-sets' cannot be used simultaneously");
+            }
+        }
+        return run_all_parameter_sets(options, runOptions);
     }
 
-    execution.add_observer(
-        std::make_shared<progress_monitor>(
-            runOptions.begin_time,
-            runOptions.end_time - runOptions.begin_time,
-            10,
-            runOptions.mr_progress_resolution));
+    run_session session(runOptions, resourceUsage.has_value());
+    trace_span loadSpan("startup", "load system");
+    const auto config = load_system_config(options.system_structure_path, session.model_resolver());
+    loadSpan.end();
+
+    // With memoization, the simulation writes its output to a recording
+    // directory in the cache, which is copied to the output directory
+    // afterwards.
+    const auto outputDir = options.output_dir;
+    std::optional<memoized_result> memo;
+    if (memoize) {
+        memo.emplace(config, options);
+        if (memo->exists()) {
+            std::random_device randomDevice;
+            std::mt19937 generator(randomDevice());
+            if (!std::bernoulli_distribution(verifyProbability)(generator)) {
+                cosim::filesystem::create_directories(outputDir);
+                memo->restore(outputDir);
+                BOOST_LOG_SEV(cosim::log::logger(), cosim::log::info)
+                    << "Restored memoized results (input key " << memo->key() << ")";
+                return 0;
+            }
+            BOOST_LOG_SEV(cosim::log::logger(), cosim::log::info)
+                << "Running simulation to verify memoized results (input key "
+                << memo->key() << ")";
+        }
+        options.output_dir = memo->begin_recording();
+    }
 
-    execution.simulate_until(runOptions.end_time);
+    // The execution's own real-time timer is replaced by the session's
+    // `real_time_pacer`.
+    options.rtf_target.reset();
+    session.prepare_simulation(options.output_dir);
+
+    auto execution = prepare_execution(config, options);
+    session.pin_new_threads();
+    std::shared_ptr<flight_recorder> recorder;
+    if (flightRecorderWindow) {
+        recorder = std::make_shared<flight_recorder>(*flightRecorderWindow);
+        execution.add_observer(recorder);
+    }
+
+    // In the trace, a macro step lasts from the end of one step callback
+    // to the start of the next, and so includes the work of the other
+    // observers.
+    bool started = false;
+    std::chrono::steady_clock::time_point stepStart;
+    execution.add_observer(std::make_shared<step_observer>([&](cosim::time_point t) {
+        if (tracing_enabled()) {
+            allocation_phase_scope observerPhase(allocation_phase::observers);
+            trace_complete(
+                started ? "execution" : "startup",
+                started ? "macro step" : "initialize",
+                stepStart,
+                std::chrono::steady_clock::now(),
+                "{\"time\": " + std::to_string(cosim::to_double_time_point(t)) + "}");
+        }
+        if (started) {
+            session.step_complete(t);
+        } else {
+            session.simulation_started(t);
+        }
+        started = true;
+        stepStart = std::chrono::steady_clock::now();
+    }));
+
+    trace_span simulationSpan("execution", "simulate");
+    stepStart = std::chrono::steady_clock::now();
+    try {
+        execution.simulate_until(runOptions.end_time);
+    } catch (...) {
+        if (recorder) recorder->dump(outputDir / "flight_recorder.bin");
+        throw;
+    }
+    simulationSpan.end();
+    session.simulation_finished();
+    if (resourceUsage) {
+        const auto simulators = session.model_instrumentation()->simulators();
+        if (resourceUsage->empty()) {
+            print_resource_usage(std::cout, simulators);
+        } else {
+            write_resource_usage_file(*resourceUsage, simulators);
+        }
+    }
+
+    if (memo) {
+        const bool verifying = memo->exists();
+        const bool deterministic = !verifying || memo->recording_matches_stored();
+        memo->finish_recording(outputDir);
+        if (!deterministic) {
+            BOOST_LOG_SEV(cosim::log::logger(), cosim::log::error)
+                << "Simulation results differ from memoized results (input key "
+                << memo->key() << "); the simulation is not deterministic";
+            return 1;
+        }
+        if (verifying) {
+            BOOST_LOG_SEV(cosim::log::logger(), cosim::log::info)
+                << "Simulation results are identical to memoized results";
+        }
+    }
     return 0;
 }
@@ -0,0 +1,381 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#include "run_batch.hpp"
+
+#include "parallel.hpp"
+#include "system_run.hpp"
+
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <cosim/execution.hpp>
+#include <cosim/fs_portability.hpp>
+#include <cosim/log/logger.hpp>
+#include <cosim/time.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+void run_batch_subcommand::setup_options(
+    boost::program_options::options_description& options,
+    boost::program_options::options_description& positionalOptions,
+    boost::program_options::positional_options_description& positions)
+    const noexcept
+{
+    // clang-format off
+    options.add_options()
+        ("cores",
+            boost::program_options::value<int>()->default_value(0),
+            "The number of CPU cores that the jobs may occupy.  "
+            "The default (represented by the value 0) is to use the number "
+            "of system hardware cores.")
+        ("summary-file",
+            boost::program_options::value<std::string>()->value_name("path"),
+            "Also write the summary to the given file, in CSV format.");
+    positionalOptions.add_options()
+        ("manifest",
+            boost::program_options::value<std::string>()->required(),
+            "The path to the manifest file.  If it has the extension .csv, "
+            "it is read as a CSV file, otherwise as a JSON file.");
+    // clang-format on
+    positions.add("manifest", 1);
+}
+
+
+namespace
+{
+
+struct batch_job
+{
+    std::string id;
+    system_run_options options;
+
+    // The number of cores the job occupies.
+    unsigned int cores = 1;
+};
+
+struct job_result
+{
+    std::optional<std::string> error;
+    double load_time = 0.0;
+    double simulation_time = 0.0;
+    double simulated_time = 0.0;
+};
+
+
+// Splits a line of CSV into fields.  Fields may be quoted, in which case
+// they may contain commas, and quotes are written as "".
+std::vector<std::string> split_csv_line(std::string_view line)
+{
+    std::vector<std::string> fields(1);
+    bool quoted = false;
+    for (std::size_t i = 0; i < line.size(); ++i) {
+        const auto c = line[i];
+        if (quoted) {
+            if (c != '"') {
+                fields.back() += c;
+            } else if (i + 1 < line.size() && line[i + 1] == '"') {
+                fields.back() += '"';
+                ++i;
+            } else {
+                quoted = false;
+            }
+        } else if (c == '"') {
+            quoted = true;
+        } else if (c == ',') {
+            fields.emplace_back();
+        } else if (c != '\r') {
+            fields.back() += c;
+        }
+    }
+    if (quoted) throw std::runtime_error("Unterminated quoted field");
+    for (auto& f : fields) {
+        const auto begin = f.find_first_not_of(" \t");
+        const auto end = f.find_last_not_of(" \t");
+        f = begin == std::string::npos ? std::string() : f.substr(begin, end - begin + 1);
+    }
+    return fields;
+}
+
+std::string csv_field(const std::string& value)
+{
+    if (value.find_first_of(",\"\n") == std::string::npos) return value;
+    std::string quoted = "\"";
+    for (const auto c : value) {
+        if (c == '"') quoted += '"';
+        quoted += c;
+    }
+    return quoted + '"';
+}
+
+// Reads the jobs of a CSV manifest, with one property tree per job.
+std::vector<boost::property_tree::ptree> read_csv_manifest(const cosim::filesystem::path& file)
+{
+    std::ifstream stream(file.string());
+    if (!stream) throw std::runtime_error("Unable to open manifest file: " + file.string());
+    std::vector<boost::property_tree::ptree> jobs;
+    std::vector<std::string> columns;
+    int lineNumber = 0;
+    for (std::string line; std::getline(stream, line);) {
+        ++lineNumber;
+        if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+        try {
+            auto fields = split_csv_line(line);
+            if (columns.empty()) {
+                columns = std::move(fields);
+                continue;
+            }
+            if (fields.size() != columns.size()) {
+                throw std::runtime_error("Wrong number of fields");
+            }
+            auto& job = jobs.emplace_back();
+            for (std::size_t i = 0; i < columns.size(); ++i) {
+                if (!fields[i].empty()) job.put(columns[i], fields[i]);
+            }
+        } catch (const std::runtime_error& e) {
+            throw std::runtime_error(
+                file.string() + ':' + std::to_string(lineNumber) + ": " + e.what());
+        }
+    }
+    return jobs;
+}
+
+// Reads the jobs of a JSON manifest, with one property tree per job.
+std::vector<boost::property_tree::ptree> read_json_manifest(const cosim::filesystem::path& file)
+{
+    boost::property_tree::ptree root;
+    try {
+        boost::property_tree::read_json(file.string(), root);
+    } catch (const boost::property_tree::json_parser_error& e) {
+        throw std::runtime_error(e.what());
+    }
+    std::vector<boost::property_tree::ptree> jobs;
+    for (const auto& element : root) {
+        if (!element.first.empty()) {
+            throw std::runtime_error(file.string() + ": Expected an array of jobs");
+        }
+        jobs.push_back(element.second);
+    }
+    return jobs;
+}
+
+std::vector<batch_job> read_manifest(
+    const cosim::filesystem::path& file,
+    unsigned int coreCount)
+{
+    const auto trees = file.extension() == ".csv"
+        ? read_csv_manifest(file)
+        : read_json_manifest(file);
+    const auto baseDir = cosim::filesystem::absolute(file).parent_path();
+
+    std::vector<batch_job> jobs;
+    for (std::size_t i = 0; i < trees.size(); ++i) {
+        auto& job = jobs.emplace_back();
+        job.id = trees[i].get<std::string>("id", "job" + std::to_string(i + 1));
+        try {
+            job.options = parse_system_run_options(trees[i], baseDir);
+        } catch (const std::runtime_error& e) {
+            throw std::runtime_error(
+                file.string() + ": Invalid job '" + job.id + "': " + e.what());
+        }
+        // Unlike the 'run' command, we don't use extra worker threads
+        // unless asked to.
+        if (!job.options.worker_thread_count) job.options.worker_thread_count = 0;
+        if (*job.options.worker_thread_count >= coreCount) {
+            // The job would either exceed the core budget or never start.
+            throw std::runtime_error(
+                file.string() + ": Invalid job '" + job.id + "': It needs " +
+                std::to_string(*job.options.worker_thread_count) +
+                " worker threads plus a main thread, but only " +
+                std::to_string(coreCount) + " cores are available");
+        }
+        job.cores = *job.options.worker_thread_count + 1;
+    }
+    return jobs;
+}
+
+job_result run_job(const batch_job& job, execution_factory& executionFactory)
+{
+    job_result result;
+    try {
+        BOOST_LOG_SEV(cosim::log::logger(), cosim::log::info)
+            << "Starting job '" << job.id << "' on " << job.cores << " core(s)";
+        const auto t0 = std::chrono::steady_clock::now();
+        auto execution = std::optional<cosim::execution>(
+            executionFactory.make_execution(job.options));
+        const auto t1 = std::chrono::steady_clock::now();
+        execution->simulate_until(job.options.end_time);
+        execution.reset();
+        const auto t2 = std::chrono::steady_clock::now();
+
+        result.load_time = std::chrono::duration<double>(t1 - t0).count();
+        result.simulation_time = std::chrono::duration<double>(t2 - t1).count();
+        result.simulated_time = std::chrono::duration<double>(
+            job.options.end_time - job.options.begin_time).count();
+        BOOST_LOG_SEV(cosim::log::logger(), cosim::log::info)
+            << "Job '" << job.id << "' finished in "
+            << result.load_time + result.simulation_time << " s";
+    } catch (const std::exception& e) {
+        result.error = e.what();
+        BOOST_LOG_SEV(cosim::log::logger(), cosim::log::error)
+            << "Job '" << job.id << "' failed: " << e.what();
+    }
+    return result;
+}
+
+// Runs the jobs in parallel, such that the sum of the core counts of the
+// running jobs never exceeds `coreCount`.  Jobs are started in order of
+// decreasing core count, and whenever a job finishes, the first waiting
+// job that fits in the freed cores is started.  This keeps the cores busy
+// without letting small jobs starve the big ones.
+std::vector<job_result> run_jobs(const std::vector<batch_job>& jobs, unsigned int coreCount)
+{
+    std::vector<std::size_t> waiting(jobs.size());
+    std::iota(waiting.begin(), waiting.end(), std::size_t(0));
+    std::stable_sort(waiting.begin(), waiting.end(), [&](std::size_t a, std::size_t b) {
+        return jobs[a].cores > jobs[b].cores;
+    });
+
+    execution_factory executionFactory;
+    std::vector<job_result> results(jobs.size());
+    std::mutex mutex;
+    std::condition_variable jobFinished;
+    auto freeCores = coreCount;
+    std::map<std::size_t, std::thread> running;
+    std::vector<std::size_t> finished;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!waiting.empty() || !running.empty()) {
+        for (const auto i : finished) {
+            running.at(i).join();
+            running.erase(i);
+        }
+        finished.clear();
+
+        const auto next = std::find_if(waiting.begin(), waiting.end(), [&](std::size_t i) {
+            return jobs[i].cores <= freeCores;
+        });
+        if (next == waiting.end()) {
+            if (!running.empty()) jobFinished.wait(lock);
+            continue;
+        }
+        const auto i = *next;
+        waiting.erase(next);
+        freeCores -= jobs[i].cores;
+        running.emplace(i, std::thread([&, i] {
+            auto result = run_job(jobs[i], executionFactory);
+            std::lock_guard<std::mutex> guard(mutex);
+            results[i] = std::move(result);
+            freeCores += jobs[i].cores;
+            finished.push_back(i);
+            jobFinished.notify_one();
+        }));
+    }
+    return results;
+}
+
+void print_summary(
+    std::ostream& out,
+    const std::vector<batch_job>& jobs,
+    const std::vector<job_result>& results)
+{
+    std::size_t idWidth = 2;
+    for (const auto& job : jobs) idWidth = std::max(idWidth, job.id.size());
+
+    out << std::left << std::setw(idWidth) << "id" << "  "
+        << std::setw(6) << "status" << "  "
+        << std::right << std::setw(10) << "load [s]" << "  "
+        << std::setw(10) << "sim. [s]" << "  "
+        << std::setw(10) << "RTF" << '\n';
+    out << std::fixed << std::setprecision(3);
+    for (std::size_t i = 0; i < jobs.size(); ++i) {
+        const auto& r = results[i];
+        out << std::left << std::setw(idWidth) << jobs[i].id << "  "
+            << std::setw(6) << (r.error ? "failed" : "ok") << "  " << std::right;
+        if (r.error) {
+            out << r.error.value() << '\n';
+            continue;
+        }
+        out << std::setw(10) << r.load_time << "  "
+            << std::setw(10) << r.simulation_time << "  "
+            << std::setw(10) << r.simulated_time / r.simulation_time << '\n';
+    }
+    out << std::defaultfloat;
+}
+
+void write_summary_file(
+    const cosim::filesystem::path& file,
+    const std::vector<batch_job>& jobs,
+    const std::vector<job_result>& results)
+{
+    std::ofstream out;
+    out.exceptions(std::ofstream::badbit | std::ofstream::failbit);
+    out.open(file.string(), std::ios::trunc);
+    out << "id,system,status,load_time,simulation_time,simulated_time,rtf,error\n";
+    out << std::setprecision(9);
+    for (std::size_t i = 0; i < jobs.size(); ++i) {
+        const auto& r = results[i];
+        out << csv_field(jobs[i].id) << ','
+            << csv_field(jobs[i].options.system_structure_path.string()) << ','
+            << (r.error ? "failed" : "ok") << ',';
+        if (r.error) {
+            out << ",,,," << csv_field(*r.error) << '\n';
+        } else {
+            out << r.load_time << ','
+                << r.simulation_time << ','
+                << r.simulated_time << ','
+                << r.simulated_time / r.simulation_time << ",\n";
+        }
+    }
+}
+
+} // namespace
+
+
+int run_batch_subcommand::run(const boost::program_options::variables_map& args) const
+{
+    const auto cores = args["cores"].as<int>();
+    if (cores < 0) {
+        throw boost::program_options::error("Invalid number of cores (must be >=0)");
+    }
+    const auto coreCount = thread_count_or_default(cores);
+    const auto jobs = read_manifest(args["manifest"].as<std::string>(), coreCount);
+    if (jobs.empty()) throw std::runtime_error("The manifest contains no jobs");
+
+    const auto results = run_jobs(jobs, coreCount);
+
+    print_summary(std::cout, jobs, results);
+    std::cout << std::flush;
+    if (args.count("summary-file")) {
+        write_summary_file(args["summary-file"].as<std::string>(), jobs, results);
+    }
+
+    const auto failureCount = std::count_if(
+        results.begin(),
+        results.end(),
+        [](const job_result& r) { return r.error.has_value(); });
+    if (failureCount > 0) {
+        BOOST_LOG_SEV(cosim::log::logger(), cosim::log::error)
+            << failureCount << " of " << jobs.size() << " jobs failed";
+        return 1;
+    }
+    return 0;
+}
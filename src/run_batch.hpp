@@ -0,0 +1,73 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#ifndef COSIM_RUN_BATCH_HPP
+#define COSIM_RUN_BATCH_HPP
+
+#include "cli_application.hpp"
+
+
+/// The `run-batch` subcommand.
+class run_batch_subcommand : public cli_subcommand
+{
+public:
+    std::string name() const noexcept override
+    {
+        return "run-batch";
+    }
+
+    std::string brief_description() const noexcept override
+    {
+        return "Runs a batch of simulations";
+    }
+
+    std::string long_description() const noexcept override
+    {
+        return "This command runs a number of simulations, or jobs, which are "
+               "listed in a manifest file.  The jobs are run in parallel "
+               "within a single process, so models which are used by several "
+               "jobs only have to be loaded once.\n"
+               "\n"
+               "The manifest may be a JSON file which contains an array of "
+               "objects, one per job, or a CSV file with a header line that "
+               "names the columns, followed by one line per job.  The "
+               "fields of a job are:\n"
+               "\n"
+               "id              A name for the job (default: 'job<N>')\n"
+               "system          The path to the system structure (required)\n"
+               "begin           The start time (default: 0)\n"
+               "end             The end time (required)\n"
+               "output_dir      The output directory (default: '.')\n"
+               "output_config   As '--output-config' for 'run' (default: 'auto')\n"
+               "scenario        The path to a scenario file\n"
+               "scenario_start  The scenario start time (default: 0)\n"
+               "parameter_set   The SSP parameter set to use (default: the unnamed one)\n"
+               "worker_threads  The number of worker threads (default: 0)\n"
+               "rtf             The real time factor target\n"
+               "\n"
+               "Relative paths are interpreted relative to the directory of "
+               "the manifest file.\n"
+               "\n"
+               "Each job occupies one CPU core for its application thread, "
+               "plus one for each of its worker threads.  Jobs are started, "
+               "largest first, whenever enough cores are free, so that the "
+               "number of busy threads never exceeds the number of cores.  "
+               "When all jobs have finished, a summary with the status, "
+               "wall-clock time and achieved real time factor of each job is "
+               "printed.  A job that fails does not stop the others, but it "
+               "causes a nonzero exit code.";
+    }
+
+    void setup_options(
+        boost::program_options::options_description& options,
+        boost::program_options::options_description& positionalOptions,
+        boost::program_options::positional_options_description& positions)
+        const noexcept override;
+
+    int run(const boost::program_options::variables_map& args) const override;
+};
+
+
+#endif
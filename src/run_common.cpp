@@ -5,10 +5,18 @@
  */
 #include "run_common.hpp"
 
+#include "cache.hpp"
+
 #include <cosim/log/logger.hpp>
 
+#include <algorithm>
+#include <cctype>
+#include <iomanip>
 #include <ios>
 #include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
 
 
 void setup_common_run_options(
@@ -35,7 +43,25 @@ void setup_common_run_options(
             "where N is the resolution given as an argument to this option.  "
             "t is the current logical time and d is the amount of logical "
             "time that has passed since the start of the simulation.  "
-            "t and d are floating-point numbers while n is an integer.")
+            "t and d are floating-point numbers while n is an integer.  "
+            "See also --mr-progress-version.")
+        ("mr-progress-version",
+            boost::program_options::value<int>()->value_name("version")->default_value(1),
+            "The format of the machine-readable progress lines.  "
+            "Version 2 prints lines on the form '@progress2 n t d r s w e', "
+            "where n, t and d are as for version 1, r is the achieved real "
+            "time factor, s is the number of macro steps per second, w is "
+            "the moving average of the wall-clock time per step in seconds, "
+            "and e is the estimated remaining wall-clock time in seconds "
+            "(-1 if unknown).  If several progress points are passed in a "
+            "single step, only one line is printed for them.")
+        ("progress-interval",
+            boost::program_options::value<double>()->value_name("seconds")->default_value(0.0),
+            "Print progress messages (and version 2 machine-readable "
+            "progress lines) at least this often, in wall-clock seconds, "
+            "in addition to the messages for every 10% of progress.  "
+            "This makes it possible to spot slow or stalled simulations.  "
+            "The default value 0 disables this.")
         ("worker-threads",
             boost::program_options::value<int>()->value_name("worker-threads")->default_value(-1),
             "Enables spawning worker-threads to parallelize the work load. "
@@ -43,11 +69,113 @@ void setup_common_run_options(
             "of system hardware cores minus one. Worker-threads comes "
             "in addition to the application thread. --worker-threads=0 "
             "will result in one application thread and no additional "
-            "worker threads.")
+            "worker threads.  When run by GNU make with a jobserver, one "
+            "job slot is acquired from make for each worker thread, and "
+            "the number of worker threads is reduced if not enough slots "
+            "are available.")
         ("real-time",
             boost::program_options::value<double>()->value_name("target_rtf")->implicit_value(1),
             "Enables real-time-synchronised simulations.  A target RTF may "
-            "optionally be specified, with a default value of 1.");
+            "optionally be specified, with a default value of 1.  "
+            "The accuracy of the synchronisation, i.e., the distribution "
+            "of wake-up jitter, the number of deadline misses and the worst "
+            "overrun, is reported at the end of the simulation.")
+        ("rt-spin",
+            boost::program_options::value<int>()->value_name("microseconds")->implicit_value(200),
+            "In real-time simulations, stop sleeping this long before each "
+            "step deadline and busy-wait for the rest of the time.  "
+            "This reduces jitter considerably, at the cost of keeping one "
+            "processor core busy.  The default is to only sleep, and 200 "
+            "microseconds is used if the option is given without a value.")
+        ("rt-fifo",
+            boost::program_options::value<int>()->value_name("priority")->implicit_value(50),
+            "In real-time simulations, use the SCHED_FIFO real-time "
+            "scheduling policy with the given priority (50 if omitted) for "
+            "all simulation threads.  Usually requires special privileges.  "
+            "Linux only.")
+        ("rt-lock-memory",
+            "In real-time simulations, lock all process memory in RAM so "
+            "the simulation is not stalled by paging.  Usually requires "
+            "special privileges.  Linux only.")
+        ("rt-overrun-policy",
+            boost::program_options::value<std::string>()->value_name("policy")->default_value("catch-up"),
+            "What to do when a real-time simulation falls behind.  "
+            "'catch-up' runs the following steps without pausing until the "
+            "simulation is back on schedule.  "
+            "'drop-sync' gives up the lost time and resynchronises with "
+            "the clock.  "
+            "'slow-down' resynchronises too, but then catches up gradually "
+            "by running at most 10% faster than the target RTF.  "
+            "'abort' stops the simulation with an error.  "
+            "The current lag and the cumulative slip (time given up by "
+            "'drop-sync' and 'slow-down') are shown in progress messages.")
+        ("pin-threads",
+            boost::program_options::value<std::string>()->value_name("layout"),
+            "Pin the application thread and the worker threads to CPUs.  "
+            "The layout may be 'compact', which fills the physical cores "
+            "of one NUMA node (socket) before using hyperthreads and then "
+            "the next node, 'scatter', which alternates between nodes, or "
+            "a list of CPUs such as '0-3,8,10-11', which are used in the "
+            "given order.  The application thread gets the first CPU.  "
+            "The resulting placement is logged.  Linux only.")
+        ("numa",
+            boost::program_options::value<std::string>()->value_name("policy")->default_value("first-touch"),
+            "The NUMA memory policy to use with --pin-threads.  "
+            "'first-touch' is the operating system default, where memory "
+            "is allocated on the node of the thread that first uses it.  "
+            "Since simulators are instantiated by the application thread, "
+            "their memory is then placed on its node.  "
+            "'bind' only allocates memory on the nodes of the CPUs in the "
+            "layout, and 'interleave' spreads it evenly across them.")
+        ("metrics-file",
+            boost::program_options::value<std::string>()->value_name("path"),
+            "Write simulation metrics to this file, for scraping by a "
+            "monitoring system.  The file is rewritten atomically at "
+            "regular intervals (see --metrics-interval) and at the end of "
+            "the simulation.  If the file name ends with '.json', it is a "
+            "JSON object.  Otherwise, it uses the Prometheus text format, "
+            "as read by e.g. the node exporter's textfile collector.  The "
+            "metrics are the number of completed steps, the logical time, "
+            "the achieved real time factor, the size of the output, the "
+            "number of simulators currently performing a step, the "
+            "resident memory size, and step counts and step times for each "
+            "simulator.")
+        ("metrics-interval",
+            boost::program_options::value<double>()->value_name("seconds")->default_value(1.0),
+            "The minimum wall-clock time between rewrites of the metrics file.")
+        ("metrics-label",
+            boost::program_options::value<std::vector<std::string>>()->value_name("name=value")->composing(),
+            "A label to attach to all metrics, to tell simulations apart "
+            "when several write metrics to the same monitoring system.  "
+            "May be specified multiple times, with different names.  The name "
+            "'simulator' is reserved for the per-simulator metrics.")
+        ("trace",
+            boost::program_options::value<std::string>()->value_name("path"),
+            "Record a timeline of the run and write it to this file in the "
+            "Chrome trace event format, for viewing in e.g. Perfetto "
+            "(https://ui.perfetto.dev).  The timeline shows the startup "
+            "phases, macro steps, the steps of each simulator on the thread "
+            "that performed them, output and progress reporting, real-time "
+            "sleeps and scenario activity.  All events are kept in memory "
+            "until the program exits, so this is best suited for short runs.")
+        ("perf-counters",
+            "Count CPU cycles, instructions, cache misses and context "
+            "switches during the steps of each simulator, and print a table "
+            "with per-step averages at the end.  The table also shows "
+            "instructions per cycle (IPC) and cache misses per thousand "
+            "instructions (MPKI); a low IPC combined with a high MPKI "
+            "suggests that a model is limited by memory access rather than "
+            "computation.  Only supported on Linux, and may require a "
+            "lowered kernel.perf_event_paranoid setting.");
+#ifdef COSIM_ALLOCATION_PROFILER
+    options.add_options()
+        ("allocation-profile",
+            "Count memory allocations during startup, macro steps, "
+            "observers (output and progress reporting) and teardown, and "
+            "print the counts at the end, along with the number of "
+            "allocations per macro step.  Allocations made by worker "
+            "threads count towards the phase of the application thread.");
+#endif
     // clang-format on
 }
 
@@ -72,9 +200,118 @@ common_run_option_values get_common_run_options(
     if (args.count("mr-progress")) {
         values.mr_progress_resolution = args["mr-progress"].as<int>();
     }
+    values.mr_progress_version = args["mr-progress-version"].as<int>();
+    if (values.mr_progress_version != 1 && values.mr_progress_version != 2) {
+        throw boost::program_options::error(
+            "Invalid machine-readable progress version (must be 1 or 2)");
+    }
+    const auto progressInterval = args["progress-interval"].as<double>();
+    if (progressInterval < 0.0) {
+        throw boost::program_options::error("Invalid progress interval (must be >=0)");
+    }
+    values.progress_interval = std::chrono::duration<double>(progressInterval);
     if (args.count("real-time")) {
         values.rtf_target = args["real-time"].as<double>();
+        if (*values.rtf_target <= 0.0) {
+            throw boost::program_options::error("Invalid real time factor target (must be >0)");
+        }
+    }
+    if (args.count("rt-spin") || args.count("rt-fifo") || args.count("rt-lock-memory") ||
+        !args["rt-overrun-policy"].defaulted()) {
+        if (!values.rtf_target) {
+            throw boost::program_options::error(
+                "Options '--rt-spin', '--rt-fifo', '--rt-lock-memory' and "
+                "'--rt-overrun-policy' require '--real-time'");
+        }
+    }
+    if (args.count("rt-spin")) {
+        const auto spin = args["rt-spin"].as<int>();
+        if (spin < 0) {
+            throw boost::program_options::error("Invalid spin duration (must be >=0)");
+        }
+        values.rt_spin_duration = std::chrono::microseconds(spin);
+    }
+    if (args.count("rt-fifo")) {
+        values.rt_fifo_priority = args["rt-fifo"].as<int>();
+    }
+    values.rt_lock_memory = args.count("rt-lock-memory") > 0;
+    const auto overrunPolicy = args["rt-overrun-policy"].as<std::string>();
+    if (overrunPolicy == "catch-up") {
+        values.rt_overrun_policy = overrun_policy::catch_up;
+    } else if (overrunPolicy == "drop-sync") {
+        values.rt_overrun_policy = overrun_policy::drop_sync;
+    } else if (overrunPolicy == "slow-down") {
+        values.rt_overrun_policy = overrun_policy::slow_down;
+    } else if (overrunPolicy == "abort") {
+        values.rt_overrun_policy = overrun_policy::abort;
+    } else {
+        throw boost::program_options::error(
+            "Invalid overrun policy: '" + overrunPolicy + "'");
+    }
+    if (args.count("pin-threads")) {
+        try {
+            values.pinned_cpus = cpu_layout(args["pin-threads"].as<std::string>());
+        } catch (const std::runtime_error& e) {
+            throw boost::program_options::error(e.what());
+        }
+    }
+    const auto numa = args["numa"].as<std::string>();
+    if (!args["numa"].defaulted() && values.pinned_cpus.empty()) {
+        throw boost::program_options::error("Option '--numa' requires '--pin-threads'");
+    }
+    if (numa == "first-touch") {
+        values.numa = numa_policy::first_touch;
+    } else if (numa == "bind") {
+        values.numa = numa_policy::bind;
+    } else if (numa == "interleave") {
+        values.numa = numa_policy::interleave;
+    } else {
+        throw boost::program_options::error("Invalid NUMA policy: '" + numa + "'");
+    }
+
+    if (args.count("metrics-file")) {
+        values.metrics_file = args["metrics-file"].as<std::string>();
+        const auto interval = args["metrics-interval"].as<double>();
+        if (interval < 0.0) {
+            throw boost::program_options::error("Invalid metrics interval (must be >=0)");
+        }
+        values.metrics_interval = std::chrono::duration<double>(interval);
+    }
+    if (args.count("metrics-label")) {
+        for (const auto& label : args["metrics-label"].as<std::vector<std::string>>()) {
+            const auto equalsPos = label.find('=');
+            const auto name = label.substr(0, equalsPos);
+            const bool validName = !name.empty() &&
+                !std::isdigit(static_cast<unsigned char>(name[0])) &&
+                std::all_of(name.begin(), name.end(), [](char c) {
+                    return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+                });
+            if (equalsPos == std::string::npos || !validName) {
+                throw boost::program_options::error(
+                    "Invalid metrics label: '" + label + "' (correct syntax: name=value, "
+                    "where the name consists of letters, digits and underscores)");
+            }
+            // The exporter adds the "simulator" label itself, Prometheus
+            // reserves names starting with "__", and a label can only
+            // appear once in a sample.
+            if (name == "simulator" || name.rfind("__", 0) == 0 ||
+                std::any_of(
+                    values.metrics_labels.begin(),
+                    values.metrics_labels.end(),
+                    [&](const auto& l) { return l.first == name; })) {
+                throw boost::program_options::error(
+                    "Invalid metrics label: '" + label + "' (the name '" + name +
+                    "' is reserved or used more than once)");
+            }
+            values.metrics_labels.emplace_back(name, label.substr(equalsPos + 1));
+        }
+    }
+    if (args.count("trace")) {
+        values.trace_file = args["trace"].as<std::string>();
     }
+    values.perf_counters = args.count("perf-counters") > 0;
+    values.allocation_profile = args.count("allocation-profile") > 0;
+
     auto worker_threads = args["worker-threads"].as<int>();
     if (worker_threads >= 0) {
         values.worker_thread_count = static_cast<unsigned int>(worker_threads);
@@ -83,45 +320,288 @@ common_run_option_values get_common_run_options(
 }
 
 
+void acquire_worker_thread_slots(common_run_option_values& values)
+{
+    // The default number of worker threads mirrors that of libcosim.
+    const auto wantedWorkerThreads = values.worker_thread_count.value_or(
+        std::max(1u, std::thread::hardware_concurrency()) - 1);
+    if (auto tokens = acquire_jobserver_tokens(wantedWorkerThreads)) {
+        values.worker_thread_count = tokens->count();
+        values.jobserver_slots = std::move(tokens);
+    }
+}
+
+
+namespace
+{
+
+double to_milliseconds(std::chrono::nanoseconds d)
+{
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+// The weight of the latest step in the moving averages of step times,
+// which makes them reflect roughly the last 100 steps.
+constexpr double stepTimeSmoothing = 0.02;
+
+} // namespace
+
+
 progress_logger::progress_logger(
     cosim::time_point startTime,
     cosim::duration duration,
     int percentIncrement,
-    std::optional<int> mrProgressResolution)
+    std::optional<int> mrProgressResolution,
+    int mrProgressVersion,
+    std::chrono::duration<double> interval,
+    const real_time_statistics* realTimeStatistics)
     : startTime_(startTime)
     , fullDuration_(cosim::to_double_duration(duration, startTime))
     , percentIncrement_(percentIncrement)
     , mrProgressResolution_(mrProgressResolution)
+    , mrProgressVersion_(mrProgressVersion)
+    , interval_(interval)
+    , realTimeStatistics_(realTimeStatistics)
     , nextPercentage_(percentIncrement)
 {}
 
 
 void progress_logger::update(cosim::time_point currentTime)
 {
+    const auto now = clock::now();
+    if (!wallStartTime_) {
+        wallStartTime_ = now;
+        lastWallTime_ = now;
+        lastReportTime_ = now;
+        lastTime_ = currentTime;
+    } else if (currentTime > lastTime_) {
+        const auto stepWallTime = std::chrono::duration<double>(now - lastWallTime_).count();
+        const auto stepLogicalTime = cosim::to_double_duration(currentTime - lastTime_, lastTime_);
+        ++stepCount_;
+        if (stepCount_ == 1) {
+            meanStepWallTime_ = stepWallTime;
+            meanStepLogicalTime_ = stepLogicalTime;
+        } else {
+            meanStepWallTime_ += stepTimeSmoothing * (stepWallTime - meanStepWallTime_);
+            meanStepLogicalTime_ += stepTimeSmoothing * (stepLogicalTime - meanStepLogicalTime_);
+        }
+        lastWallTime_ = now;
+        lastTime_ = currentTime;
+    }
+
     const auto currentDuration =
         cosim::to_double_duration(currentTime - startTime_, startTime_);
     const auto progress = currentDuration / fullDuration_;
+    const auto intervalElapsed = interval_.count() > 0.0 &&
+        now - lastReportTime_ >= interval_ &&
+        progress < 1.0;
+    const auto stats = current_throughput(now, currentDuration);
 
     const auto percentProgress = 100.0 * progress;
-    while (nextPercentage_ <= percentProgress) {
-        BOOST_LOG_SEV(cosim::log::logger(), cosim::log::info)
-            << nextPercentage_ << "% complete, t="
-            << std::fixed << cosim::to_double_time_point(currentTime)
-            << std::defaultfloat;
-        nextPercentage_ += percentIncrement_;
+    if (nextPercentage_ <= percentProgress || intervalElapsed) {
+        std::ostringstream status;
+        status
+            << std::fixed << std::setprecision(1)
+            << ", RTF=" << stats.rtf
+            << ", " << stats.steps_per_second << " steps/s, "
+            << std::setprecision(3) << 1000.0 * stats.mean_step_time << " ms/step, ETA ";
+        if (stats.eta) {
+            const auto eta = static_cast<long long>(*stats.eta + 0.5);
+            status
+                << std::setfill('0')
+                << eta / 3600 << ':' << std::setw(2) << eta / 60 % 60 << ':'
+                << std::setw(2) << eta % 60;
+        } else {
+            status << "unknown";
+        }
+        status << real_time_status();
+
+        if (nextPercentage_ > percentProgress) {
+            BOOST_LOG_SEV(cosim::log::logger(), cosim::log::info)
+                << std::fixed << std::setprecision(1) << percentProgress << "% complete, t="
+                << std::setprecision(6) << cosim::to_double_time_point(currentTime)
+                << std::defaultfloat << status.str();
+        }
+        while (nextPercentage_ <= percentProgress) {
+            BOOST_LOG_SEV(cosim::log::logger(), cosim::log::info)
+                << nextPercentage_ << "% complete, t="
+                << std::fixed << cosim::to_double_time_point(currentTime)
+                << std::defaultfloat << status.str();
+            nextPercentage_ += percentIncrement_;
+        }
+        lastReportTime_ = now;
     }
 
     if (mrProgressResolution_) {
         const auto mrProgress = *mrProgressResolution_ * progress;
-        while (nextMRProgress_ <= mrProgress) {
+        if (mrProgressVersion_ == 1) {
+            while (nextMRProgress_ <= mrProgress) {
+                std::cout
+                    << "@progress "
+                    << nextMRProgress_ << ' '
+                    << std::fixed
+                    << cosim::to_double_time_point(currentTime) << ' '
+                    << currentDuration
+                    << std::defaultfloat << std::endl;
+                ++nextMRProgress_;
+            }
+        } else if (nextMRProgress_ <= mrProgress || intervalElapsed) {
+            const auto n = static_cast<int>(mrProgress);
             std::cout
-                << "@progress "
-                << nextMRProgress_ << ' '
+                << "@progress2 "
+                << n << ' '
                 << std::fixed
                 << cosim::to_double_time_point(currentTime) << ' '
-                << currentDuration
+                << currentDuration << ' '
+                << stats.rtf << ' '
+                << stats.steps_per_second << ' '
+                << std::scientific << stats.mean_step_time << ' '
+                << std::fixed << stats.eta.value_or(-1.0)
                 << std::defaultfloat << std::endl;
-            ++nextMRProgress_;
+            nextMRProgress_ = std::max(nextMRProgress_, n + 1);
         }
     }
 }
+
+
+progress_logger::throughput progress_logger::current_throughput(
+    clock::time_point now,
+    double currentDuration) const
+{
+    throughput t;
+    const auto wallElapsed = std::chrono::duration<double>(now - *wallStartTime_).count();
+    if (wallElapsed > 0.0) {
+        t.rtf = currentDuration / wallElapsed;
+        t.steps_per_second = stepCount_ / wallElapsed;
+    }
+    t.mean_step_time = meanStepWallTime_;
+    // The estimate is based on the recent rate of progress, so that it
+    // adapts quickly when the simulation slows down or stalls.
+    if (meanStepWallTime_ > 0.0 && meanStepLogicalTime_ > 0.0) {
+        t.eta = std::max(0.0, fullDuration_ - currentDuration) *
+            meanStepWallTime_ / meanStepLogicalTime_;
+    }
+    return t;
+}
+
+
+std::string progress_logger::real_time_status() const
+{
+    if (!realTimeStatistics_) return {};
+    std::ostringstream status;
+    status
+        << std::fixed << std::setprecision(3)
+        << ", lag=" << to_milliseconds(realTimeStatistics_->current_lag)
+        << " ms, slip=" << to_milliseconds(realTimeStatistics_->cumulative_slip)
+        << " ms";
+    return status.str();
+}
+
+
+run_session::run_session(
+    const common_run_option_values& options,
+    bool resourceAccounting)
+    : options_(options)
+{
+    if (options_.allocation_profile) allocationProfile_.emplace();
+    if (options_.trace_file) trace_.emplace(*options_.trace_file);
+    if (!options_.pinned_cpus.empty()) pinning_.emplace(options_.pinned_cpus, options_.numa);
+    if (options_.perf_counters) perfCounters_.emplace();
+
+    uriResolver_ = caching_model_uri_resolver();
+    if (options_.metrics_file || trace_ || perfCounters_ || resourceAccounting) {
+        instrumentation_ = std::make_shared<instrumentation>();
+        uriResolver_ = instrumentation_->wrap_resolver(uriResolver_);
+    }
+    if (resourceAccounting) instrumentation_->enable_resource_accounting();
+    if (trace_) {
+        instrumentation_->add_step_hook([](const simulator_metrics& simulator, auto start, auto end) {
+            trace_complete("simulator", simulator.name, start, end);
+        });
+    }
+    if (perfCounters_) perfCounters_->attach(*instrumentation_);
+}
+
+
+cosim::model_uri_resolver& run_session::model_resolver() const noexcept
+{
+    return *uriResolver_;
+}
+
+
+const std::shared_ptr<instrumentation>& run_session::model_instrumentation() const noexcept
+{
+    return instrumentation_;
+}
+
+
+void run_session::pin_new_threads()
+{
+    if (pinning_) pinning_->pin_new_threads();
+}
+
+
+void run_session::prepare_simulation(const cosim::filesystem::path& outputPath)
+{
+    if (options_.rtf_target) {
+        configure_real_time_process(options_.rt_fifo_priority, options_.rt_lock_memory);
+        pacer_.emplace(
+            *options_.rtf_target,
+            options_.rt_spin_duration,
+            options_.rt_overrun_policy);
+    }
+    progress_.emplace(
+        options_.begin_time,
+        options_.end_time - options_.begin_time,
+        10,
+        options_.mr_progress_resolution,
+        options_.mr_progress_version,
+        options_.progress_interval,
+        pacer_ ? &pacer_->statistics() : nullptr);
+    if (options_.metrics_file) {
+        metrics_.emplace(
+            *options_.metrics_file,
+            instrumentation_,
+            outputPath,
+            options_.metrics_labels,
+            options_.metrics_interval);
+    }
+}
+
+
+void run_session::simulation_started(cosim::time_point currentTime)
+{
+    // This must not happen within an `allocation_phase_scope`, which would
+    // return to the startup phase when it ends.
+    if (allocationProfile_) allocationProfile_->simulation_started();
+    allocation_phase_scope observerPhase(allocation_phase::observers);
+    if (pacer_) pacer_->start(currentTime);
+    report_progress(currentTime);
+}
+
+
+void run_session::step_complete(cosim::time_point currentTime)
+{
+    allocation_phase_scope observerPhase(allocation_phase::observers);
+    if (pacer_) pacer_->sleep(currentTime);
+    report_progress(currentTime);
+    // Each step's allocations are counted from one call to the next.
+    if (allocationProfile_) allocationProfile_->step_complete();
+}
+
+
+void run_session::simulation_finished()
+{
+    if (allocationProfile_) allocationProfile_->simulation_finished();
+    if (pacer_) pacer_->report();
+    if (metrics_) metrics_->write();
+    if (perfCounters_) perfCounters_->print_report(std::cout);
+}
+
+
+void run_session::report_progress(cosim::time_point currentTime)
+{
+    trace_span span("observer", "progress and metrics");
+    progress_->update(currentTime);
+    if (metrics_) metrics_->update(currentTime);
+}
@@ -6,12 +6,28 @@
 #ifndef COSIM_RUN_COMMON_HPP
 #define COSIM_RUN_COMMON_HPP
 
+#include "allocation_profile.hpp"
+#include "instrumentation.hpp"
+#include "jobserver.hpp"
+#include "metrics.hpp"
+#include "perf_counters.hpp"
+#include "real_time.hpp"
+#include "thread_pinning.hpp"
+#include "trace.hpp"
+
 #include <boost/program_options.hpp>
 #include <cosim/execution.hpp>
+#include <cosim/fs_portability.hpp>
+#include <cosim/orchestration.hpp>
 #include <cosim/time.hpp>
 
 #include <chrono>
+#include <cstdint>
+#include <memory>
 #include <optional>
+#include <string>
+#include <utility>
+#include <vector>
 
 
 /// Adds the command-line options that are common to all 'run' subcommands.
@@ -26,7 +42,52 @@ struct common_run_option_values
     cosim::time_point end_time;
     std::optional<double> rtf_target;
     std::optional<int> mr_progress_resolution;
+    int mr_progress_version = 1;
+    std::chrono::duration<double> progress_interval{0};
     std::optional<unsigned int> worker_thread_count;
+
+    /// How long to spin before each real-time deadline.
+    std::chrono::microseconds rt_spin_duration{0};
+
+    /// `SCHED_FIFO` priority for real-time simulations, if requested.
+    std::optional<int> rt_fifo_priority;
+
+    /// Whether to lock the process memory for real-time simulations.
+    bool rt_lock_memory = false;
+
+    /// What to do when a real-time simulation falls behind.
+    overrun_policy rt_overrun_policy = overrun_policy::catch_up;
+
+    /// The CPUs to pin simulation threads to, or empty for no pinning.
+    std::vector<int> pinned_cpus;
+
+    /// The NUMA memory policy to use with thread pinning.
+    numa_policy numa = numa_policy::first_touch;
+
+    /// A file to which metrics should be written, if any.
+    std::optional<cosim::filesystem::path> metrics_file;
+
+    /// The minimum interval between rewrites of the metrics file.
+    std::chrono::duration<double> metrics_interval{1.0};
+
+    /// Labels to attach to all metrics.
+    std::vector<std::pair<std::string, std::string>> metrics_labels;
+
+    /// A file to which a trace of the run should be written, if any.
+    std::optional<cosim::filesystem::path> trace_file;
+
+    /// Whether to count hardware events during simulator steps.
+    bool perf_counters = false;
+
+    /// Whether to count memory allocations in each phase of the run.
+    bool allocation_profile = false;
+
+    /**
+     *  Job slots acquired by `acquire_worker_thread_slots()`.  They are
+     *  returned to the jobserver when the last copy of this object is
+     *  destroyed.
+     */
+    std::shared_ptr<jobserver_tokens> jobserver_slots;
 };
 
 
@@ -35,7 +96,36 @@ common_run_option_values get_common_run_options(
     const boost::program_options::variables_map& args);
 
 
-/// Simulation progress logger.
+/**
+ *  Acquires job slots for the worker threads from a make jobserver, if
+ *  the program is run by GNU make with one.  The number of worker threads
+ *  is then limited to the number of slots that were available.  Does
+ *  nothing otherwise.
+ */
+void acquire_worker_thread_slots(common_run_option_values& values);
+
+
+/**
+ *  Simulation progress logger.
+ *
+ *  Besides the progress itself, the messages contain the achieved real
+ *  time factor, the number of macro steps per second, the moving average
+ *  of the wall-clock time per step, and the estimated remaining time.
+ *  Messages are written every `percentIncrement` percent and, if
+ *  `interval` is nonzero, at least that often in wall-clock time.
+ *
+ *  With machine-readable progress enabled, lines on the form
+ *  '@progress n t d' are printed for `mrProgressVersion` 1, and lines on
+ *  the form '@progress2 n t d r s w e' for version 2, where r is the
+ *  achieved real time factor, s the number of steps per second, w the
+ *  average wall-clock time per step in seconds and e the estimated
+ *  remaining time in seconds (-1 if unknown).  Version 2 lines are only
+ *  printed for the last of several resolution points passed in a single
+ *  step.
+ *
+ *  If `realTimeStatistics` is not null, the current lag and cumulative
+ *  slip of a real-time simulation are included in the progress messages.
+ */
 class progress_logger
 {
 public:
@@ -43,17 +133,124 @@ public:
         cosim::time_point startTime,
         cosim::duration duration,
         int percentIncrement,
-        std::optional<int> mrProgressResolution);
+        std::optional<int> mrProgressResolution,
+        int mrProgressVersion = 1,
+        std::chrono::duration<double> interval = {},
+        const real_time_statistics* realTimeStatistics = nullptr);
 
+    /**
+     *  Updates the progress.  Should be called at the start of the
+     *  simulation and after each macro step.
+     */
     void update(cosim::time_point currentTime);
 
 private:
+    using clock = std::chrono::steady_clock;
+
+    struct throughput
+    {
+        double rtf = 0.0;
+        double steps_per_second = 0.0;
+        double mean_step_time = 0.0;
+        std::optional<double> eta;
+    };
+
+    throughput current_throughput(clock::time_point now, double currentDuration) const;
+    std::string real_time_status() const;
+
     const cosim::time_point startTime_;
     const double fullDuration_;
     const int percentIncrement_;
     const std::optional<int> mrProgressResolution_;
+    const int mrProgressVersion_;
+    const std::chrono::duration<double> interval_;
+    const real_time_statistics* const realTimeStatistics_;
     int nextPercentage_;
     int nextMRProgress_ = 1;
+
+    std::optional<clock::time_point> wallStartTime_;
+    clock::time_point lastWallTime_;
+    clock::time_point lastReportTime_;
+    cosim::time_point lastTime_;
+    std::uint64_t stepCount_ = 0;
+    double meanStepWallTime_ = 0.0;
+    double meanStepLogicalTime_ = 0.0;
+};
+
+
+/**
+ *  The profiling, tracing, thread pinning, real-time pacing and reporting
+ *  facilities that the common run options ask for, for a single
+ *  simulation run by 'run' or 'run-single'.
+ *
+ *  The allocation profile is the first member, so that its report
+ *  includes the destruction of everything else.
+ */
+class run_session
+{
+public:
+    /**
+     *  Starts the allocation profile, the trace and the counting of
+     *  hardware events, and pins the application thread, as requested by
+     *  `options`.  The thread is pinned now, so that the models are loaded
+     *  into memory on its NUMA node.  If `resourceAccounting` is true,
+     *  resource accounting is enabled for the simulators instantiated from
+     *  models obtained through `model_resolver()`.
+     */
+    explicit run_session(
+        const common_run_option_values& options,
+        bool resourceAccounting = false);
+
+    run_session(const run_session&) = delete;
+    run_session& operator=(const run_session&) = delete;
+
+    /**
+     *  Returns the model URI resolver to use.  It instruments the models
+     *  if anything needs measurements from their simulators.
+     */
+    cosim::model_uri_resolver& model_resolver() const noexcept;
+
+    /// Returns the instrumentation of the models, or null if there is none.
+    const std::shared_ptr<instrumentation>& model_instrumentation() const noexcept;
+
+    /// Pins the threads created since the last call, if pinning is enabled.
+    void pin_new_threads();
+
+    /**
+     *  Configures the process for real-time simulation, and sets up
+     *  pacing, progress reporting and the metrics file.  Must be called
+     *  once, after the models have been loaded and before the simulation
+     *  is initialized.  The total size of `outputPath` is reported as the
+     *  amount of output written.
+     */
+    void prepare_simulation(const cosim::filesystem::path& outputPath);
+
+    /**
+     *  Starts pacing and reporting.  Called when the simulation is
+     *  initialized, outside any `allocation_phase_scope`, since it enters
+     *  the step phase of the allocation profile.
+     */
+    void simulation_started(cosim::time_point currentTime);
+
+    /// Paces and reports a completed macro step, with the work of its observers.
+    void step_complete(cosim::time_point currentTime);
+
+    /// Writes the final reports after the last step.
+    void simulation_finished();
+
+private:
+    void report_progress(cosim::time_point currentTime);
+
+    common_run_option_values options_;
+    std::optional<allocation_profile> allocationProfile_;
+    std::optional<trace_file> trace_;
+    std::optional<thread_pinning> pinning_;
+    std::optional<perf_counter_profile> perfCounters_;
+    std::shared_ptr<instrumentation> instrumentation_;
+    std::shared_ptr<cosim::model_uri_resolver> uriResolver_;
+    std::optional<real_time_pacer> pacer_;
+    std::optional<progress_logger> progress_;
+    std::optional<metrics_file> metrics_;
 };
 
 
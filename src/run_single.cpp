@@ -8,9 +8,13 @@
 #endif
 #include "run_single.hpp"
 
-#include "cache.hpp"
+#include "allocation_profile.hpp"
+#include "fingerprint.hpp"
+#include "model_index.hpp"
+#include "probes.hpp"
 #include "run_common.hpp"
 #include "tools.hpp"
+#include "trace.hpp"
 
 #include <boost/container/vector.hpp>
 #include <boost/lexical_cast.hpp>
@@ -18,12 +22,12 @@
 #include <cosim/model_description.hpp>
 #include <cosim/orchestration.hpp>
 #include <cosim/time.hpp>
-#include <cosim/timer.hpp>
 #include <gsl/span>
 
 #include <algorithm>
 #include <cassert>
 #include <fstream>
+#include <memory>
 #include <optional>
 #include <sstream>
 #include <stdexcept>
@@ -199,6 +203,7 @@ public:
 
     void update(cosim::time_point t)
     {
+        COSIM_PROBE1(csv__output__start, t.time_since_epoch().count());
         cosim::slave::variable_values values;
         simulator_->get_variables(
             &values,
@@ -221,6 +226,7 @@ public:
             outputStream_ << ',' << v;
         }
         outputStream_ << '\n';
+        COSIM_PROBE1(csv__output__done, t.time_since_epoch().count());
     }
 
 private:
@@ -245,33 +251,40 @@ int run_single_subcommand::run(const boost::program_options::variables_map& args
         throw boost::program_options::error("Invalid step size (must be >0)");
     }
 
-    progress_logger progress(
-        runOptions.begin_time,
-        runOptions.end_time - runOptions.begin_time,
-        10,
-        runOptions.mr_progress_resolution);
-
-    cosim::real_time_timer timer;
-    if (runOptions.rtf_target) {
-        auto rtConfig = timer.get_real_time_config();
-        rtConfig->real_time_factor_target.store(*runOptions.rtf_target);
-        rtConfig->real_time_simulation.store(true);
-    }
+    // There are no worker threads here, so only the application thread
+    // is pinned.
+    run_session session(runOptions);
 
     auto currentPath = cosim::filesystem::current_path();
     currentPath += cosim::filesystem::path::preferred_separator;
     const auto baseUri = cosim::path_to_file_uri(currentPath);
     const auto uriReference = to_uri(args["uri_or_path"].as<std::string>());
-    const auto uriResolver = caching_model_uri_resolver();
-    const auto model = uriResolver->lookup_model(baseUri, uriReference);
 
+    // If the model index has an up-to-date entry for the FMU, we use it to
+    // validate the initial values before loading the model, so that errors
+    // are reported without delay.
     std::optional<variable_values> initialValues;
     if (args.count("initial_value") > 0) {
+        const auto fmuPath = local_fmu_path(cosim::resolve_reference(baseUri, uriReference));
+        if (const auto index = fmuPath ? load_user_model_index() : std::nullopt) {
+            if (const auto entry = index->find(fingerprint_file(*fmuPath))) {
+                initialValues = parse_initial_values(
+                    args["initial_value"].as<std::vector<std::string>>(),
+                    entry->description);
+            }
+        }
+    }
+
+    trace_span loadSpan("startup", "load model");
+    const auto model = session.model_resolver().lookup_model(baseUri, uriReference);
+    loadSpan.end();
+    if (args.count("initial_value") > 0 && !initialValues) {
         initialValues = parse_initial_values(
             args["initial_value"].as<std::vector<std::string>>(),
             *model->description());
     }
 
+    trace_span instantiationSpan("startup", "instantiate simulator");
     const auto simulator = model->instantiate("simulator");
     if (initialValues) {
         simulator
@@ -286,15 +299,20 @@ int run_single_subcommand::run(const boost::program_options::variables_map& args
                 gsl::make_span(initialValues->stringValues));
     }
     simulator->setup(runOptions.begin_time, runOptions.end_time, {});
+    instantiationSpan.end();
 
-    auto output = csv_output_writer(
-        simulator,
-        args["output-file"].as<std::string>());
+    const auto outputFile = cosim::filesystem::path(args["output-file"].as<std::string>());
+    auto output = csv_output_writer(simulator, outputFile);
+    session.prepare_simulation(outputFile);
 
+    trace_span initializationSpan("startup", "initialize");
     simulator->start_simulation();
+    initializationSpan.end();
     output.update(runOptions.begin_time);
+    session.simulation_started(runOptions.begin_time);
     for (auto t = runOptions.begin_time; t < runOptions.end_time;) {
         const auto dt = std::min(runOptions.end_time - t, stepSize);
+        COSIM_PROBE2(step__start, t.time_since_epoch().count(), dt.count());
         const auto stepResult = simulator->do_step(t, stepSize);
         if (stepResult != cosim::step_result::complete) {
             simulator->end_simulation();
@@ -303,10 +321,14 @@ int run_single_subcommand::run(const boost::program_options::variables_map& args
                 std::to_string(cosim::to_double_time_point(t)));
         }
         t += dt;
+        COSIM_PROBE1(step__done, t.time_since_epoch().count());
+        allocation_phase_scope observerPhase(allocation_phase::observers);
+        trace_span outputSpan("observer", "CSV output");
         output.update(t);
-        timer.sleep(t);
-        progress.update(t);
+        outputSpan.end();
+        session.step_complete(t);
     }
+    session.simulation_finished();
     simulator->end_simulation();
     return 0;
 }
@@ -0,0 +1,448 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#include "serve.hpp"
+
+#include "parallel.hpp"
+#include "system_run.hpp"
+#include "tools.hpp"
+
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <cosim/execution.hpp>
+#include <cosim/fs_portability.hpp>
+#include <cosim/log/logger.hpp>
+#include <cosim/time.hpp>
+
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+
+#ifndef _WIN32
+#    include <poll.h>
+#    include <sys/socket.h>
+#    include <sys/stat.h>
+#    include <sys/un.h>
+#    include <unistd.h>
+#endif
+
+
+void serve_subcommand::setup_options(
+    boost::program_options::options_description& options,
+    boost::program_options::options_description& positionalOptions,
+    boost::program_options::positional_options_description& positions)
+    const noexcept
+{
+    // clang-format off
+    options.add_options()
+        ("jobs,j",
+            boost::program_options::value<int>()->default_value(0),
+            "The maximum number of simulations to run in parallel.  "
+            "Requests received while this many simulations are running are "
+            "queued.  The default (represented by the value 0) is to use "
+            "the number of system hardware cores.");
+    positionalOptions.add_options()
+        ("socket_path",
+            boost::program_options::value<std::string>()->required(),
+            "The path to the socket on which the server will listen.  "
+            "It is created when the server starts, and removed when it stops.  "
+            "Only the user who runs the server may connect to it, since "
+            "clients can run simulations and write files as that user.");
+    // clang-format on
+    positions.add("socket_path", 1);
+}
+
+
+#ifdef _WIN32
+
+int serve_subcommand::run(const boost::program_options::variables_map&) const
+{
+    throw std::runtime_error("The 'serve' command is not supported on this platform");
+}
+
+#else
+
+namespace
+{
+
+// Set by the signal handler when the server should stop.
+volatile std::sig_atomic_t stopSignalled = 0;
+
+extern "C" void handle_stop_signal(int)
+{
+    stopSignalled = 1;
+}
+
+[[noreturn]] void throw_system_error(const std::string& what)
+{
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+// An owned file descriptor.
+class file_descriptor
+{
+public:
+    explicit file_descriptor(int fd = -1) noexcept
+        : fd_(fd)
+    {}
+
+    file_descriptor(const file_descriptor&) = delete;
+    file_descriptor& operator=(const file_descriptor&) = delete;
+
+    file_descriptor(file_descriptor&& other) noexcept
+        : fd_(std::exchange(other.fd_, -1))
+    {}
+
+    file_descriptor& operator=(file_descriptor&& other) noexcept
+    {
+        if (fd_ >= 0) ::close(fd_);
+        fd_ = std::exchange(other.fd_, -1);
+        return *this;
+    }
+
+    ~file_descriptor()
+    {
+        if (fd_ >= 0) ::close(fd_);
+    }
+
+    int get() const noexcept { return fd_; }
+
+private:
+    int fd_;
+};
+
+sockaddr_un make_socket_address(const std::string& path)
+{
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof address.sun_path) {
+        throw std::runtime_error("Socket path too long: " + path);
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return address;
+}
+
+// Creates a listening socket at `path`, which only the current user may
+// connect to.  If a file already exists there, it is removed, unless it
+// is a socket on which another server is listening.
+file_descriptor listen_on(const std::string& path)
+{
+    const auto address = make_socket_address(path);
+    const auto addressPtr = reinterpret_cast<const sockaddr*>(&address);
+    auto fd = file_descriptor(::socket(AF_UNIX, SOCK_STREAM, 0));
+    if (fd.get() < 0) throw_system_error("Unable to create socket");
+
+    if (cosim::filesystem::exists(path)) {
+        auto probe = file_descriptor(::socket(AF_UNIX, SOCK_STREAM, 0));
+        if (::connect(probe.get(), addressPtr, sizeof address) == 0) {
+            throw std::runtime_error("Another server is already listening on " + path);
+        }
+        cosim::filesystem::remove(path);
+    }
+    // The socket file gets its permissions from the umask, so we restrict
+    // them while it is created, rather than changing them afterwards and
+    // leaving a window in which others may connect.  This is called
+    // before the server starts any threads, so changing the process-wide
+    // umask is safe.
+    const auto oldMask = ::umask(S_IRWXG | S_IRWXO);
+    const auto bindResult = ::bind(fd.get(), addressPtr, sizeof address);
+    const auto bindError = errno;
+    ::umask(oldMask);
+    if (bindResult != 0) {
+        errno = bindError;
+        throw_system_error("Unable to bind socket to " + path);
+    }
+    if (::listen(fd.get(), SOMAXCONN) != 0) {
+        throw_system_error("Unable to listen on " + path);
+    }
+    return fd;
+}
+
+void send_all(int fd, std::string_view data)
+{
+    while (!data.empty()) {
+        const auto n = ::send(fd, data.data(), data.size(), 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw_system_error("Error writing to socket");
+        }
+        data.remove_prefix(static_cast<std::size_t>(n));
+    }
+}
+
+void append_seconds(std::string& out, std::chrono::steady_clock::duration d)
+{
+    char buffer[32];
+    const auto result = std::to_chars(
+        buffer,
+        buffer + sizeof buffer,
+        std::chrono::duration<double>(d).count());
+    out.append(buffer, result.ptr);
+}
+
+// Limits the number of simultaneously running jobs.
+class job_slots
+{
+public:
+    explicit job_slots(unsigned int count)
+        : available_(count)
+    {}
+
+    void acquire()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        released_.wait(lock, [this] { return available_ > 0; });
+        --available_;
+    }
+
+    void release()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++available_;
+        }
+        released_.notify_one();
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable released_;
+    unsigned int available_;
+};
+
+
+class simulation_server
+{
+public:
+    simulation_server(std::string socketPath, unsigned int maxJobs)
+        : socketPath_(std::move(socketPath))
+        , listener_(listen_on(socketPath_))
+        , jobSlots_(maxJobs)
+    {}
+
+    ~simulation_server()
+    {
+        std::error_code ignored;
+        cosim::filesystem::remove(socketPath_, ignored);
+    }
+
+    void run()
+    {
+        BOOST_LOG_SEV(cosim::log::logger(), cosim::log::info)
+            << "Listening on " << socketPath_;
+        // The connection threads must be joined also if we fail, since
+        // destroying a joinable thread terminates the program.
+        try {
+            accept_connections();
+        } catch (...) {
+            shut_down();
+            throw;
+        }
+        shut_down();
+    }
+
+private:
+    void accept_connections()
+    {
+        while (!stopSignalled && !stopRequested_) {
+            join_finished_threads();
+            pollfd pfd = {listener_.get(), POLLIN, 0};
+            const auto ready = ::poll(&pfd, 1, 200);
+            if (ready < 0 && errno != EINTR) throw_system_error("Error waiting for connections");
+            if (ready <= 0) continue;
+
+            auto connection = file_descriptor(::accept(listener_.get(), nullptr, nullptr));
+            if (connection.get() < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) continue;
+                throw_system_error("Error accepting connection");
+            }
+            std::lock_guard<std::mutex> lock(connectionsMutex_);
+            connections_.insert(connection.get());
+            connectionThreads_.emplace_back(
+                [this, c = std::move(connection)]() { serve_connection(c.get()); });
+        }
+    }
+
+    // Wakes up the connection threads which are waiting for requests, and
+    // waits for them to finish.  Simulations that are in progress are
+    // allowed to finish.
+    void shut_down()
+    {
+        BOOST_LOG_SEV(cosim::log::logger(), cosim::log::info) << "Shutting down";
+        std::list<std::thread> threads;
+        {
+            std::lock_guard<std::mutex> lock(connectionsMutex_);
+            for (const auto fd : connections_) ::shutdown(fd, SHUT_RD);
+            threads.swap(connectionThreads_);
+        }
+        for (auto& t : threads) t.join();
+    }
+
+    void join_finished_threads()
+    {
+        std::lock_guard<std::mutex> lock(connectionsMutex_);
+        for (auto it = connectionThreads_.begin(); it != connectionThreads_.end();) {
+            if (finishedThreads_.count(it->get_id())) {
+                finishedThreads_.erase(it->get_id());
+                it->join();
+                it = connectionThreads_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    // Handles newline-delimited requests until the client closes the
+    // connection.
+    void serve_connection(int fd)
+    {
+        constexpr std::size_t maxRequestSize = 1 << 20;
+        std::string buffer;
+        char chunk[4096];
+        try {
+            for (;;) {
+                const auto n = ::recv(fd, chunk, sizeof chunk, 0);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) break;
+                buffer.append(chunk, static_cast<std::size_t>(n));
+                for (auto eol = buffer.find('\n'); eol != std::string::npos; eol = buffer.find('\n')) {
+                    const auto request = buffer.substr(0, eol);
+                    buffer.erase(0, eol + 1);
+                    if (request.find_first_not_of(" \t\r") == std::string::npos) continue;
+                    send_all(fd, handle_request(request));
+                }
+                if (buffer.size() > maxRequestSize) {
+                    send_all(fd, "{\"status\":\"error\",\"message\":\"Request too large\"}\n");
+                    break;
+                }
+            }
+        } catch (const std::exception& e) {
+            BOOST_LOG_SEV(cosim::log::logger(), cosim::log::warning)
+                << "Error serving client: " << e.what();
+        }
+        std::lock_guard<std::mutex> lock(connectionsMutex_);
+        connections_.erase(fd);
+        finishedThreads_.insert(std::this_thread::get_id());
+    }
+
+    std::string handle_request(const std::string& requestLine)
+    {
+        std::optional<std::string> id;
+        std::string response;
+        try {
+            boost::property_tree::ptree request;
+            std::istringstream stream(requestLine);
+            boost::property_tree::read_json(stream, request);
+            if (const auto idValue = request.get_optional<std::string>("id")) id = *idValue;
+
+            const auto command = request.get<std::string>("command", "run");
+            if (command == "shutdown") {
+                stopRequested_ = true;
+                response = "\"status\":\"ok\"";
+            } else if (command == "run") {
+                response = run_job(request);
+            } else {
+                throw std::runtime_error("Unknown command: " + command);
+            }
+        } catch (const std::exception& e) {
+            response = "\"status\":\"error\",\"message\":" + quoted_string(e.what());
+        }
+        return '{' + (id ? "\"id\":" + quoted_string(*id) + ',' : std::string()) + response + "}\n";
+    }
+
+    std::string run_job(const boost::property_tree::ptree& request)
+    {
+        const auto clock = std::chrono::steady_clock();
+        const auto t0 = clock.now();
+
+        auto options = parse_system_run_options(request, cosim::filesystem::current_path());
+        // Like 'run-batch', we leave the cores to the parallel jobs rather
+        // than using extra worker threads, unless asked to.
+        if (!options.worker_thread_count) options.worker_thread_count = 0;
+
+        jobSlots_.acquire();
+        struct slot_guard
+        {
+            job_slots& slots;
+            ~slot_guard() { slots.release(); }
+        } slotGuard{jobSlots_};
+        const auto t1 = clock.now();
+
+        auto execution = std::optional<cosim::execution>(executionFactory_.make_execution(options));
+        const auto t2 = clock.now();
+
+        execution->simulate_until(options.end_time);
+        execution.reset();
+        const auto t3 = clock.now();
+
+        BOOST_LOG_SEV(cosim::log::logger(), cosim::log::info)
+            << "Simulated " << options.system_structure_path << " in "
+            << std::chrono::duration<double>(t3 - t0).count() << " s";
+
+        std::string response = "\"status\":\"ok\",\"output_dir\":";
+        response += quoted_string(options.output_dir.string());
+        response += ",\"timings\":{\"queued\":";
+        append_seconds(response, t1 - t0);
+        response += ",\"load\":";
+        append_seconds(response, t2 - t1);
+        response += ",\"simulate\":";
+        append_seconds(response, t3 - t2);
+        response += ",\"total\":";
+        append_seconds(response, t3 - t0);
+        response += '}';
+        return response;
+    }
+
+    const std::string socketPath_;
+    const file_descriptor listener_;
+    job_slots jobSlots_;
+    std::atomic<bool> stopRequested_ = false;
+
+    std::mutex connectionsMutex_;
+    std::set<int> connections_;
+    std::list<std::thread> connectionThreads_;
+    std::set<std::thread::id> finishedThreads_;
+
+    execution_factory executionFactory_;
+};
+
+} // namespace
+
+
+int serve_subcommand::run(const boost::program_options::variables_map& args) const
+{
+    const auto jobs = args["jobs"].as<int>();
+    if (jobs < 0) {
+        throw boost::program_options::error("Invalid number of jobs (must be >=0)");
+    }
+
+    // Clients that disconnect early should not kill the server.
+    std::signal(SIGPIPE, SIG_IGN);
+    std::signal(SIGINT, handle_stop_signal);
+    std::signal(SIGTERM, handle_stop_signal);
+
+    simulation_server server(
+        args["socket_path"].as<std::string>(),
+        thread_count_or_default(jobs));
+    server.run();
+    return 0;
+}
+
+#endif
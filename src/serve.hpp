@@ -0,0 +1,76 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#ifndef COSIM_SERVE_HPP
+#define COSIM_SERVE_HPP
+
+#include "cli_application.hpp"
+
+
+/// The `serve` subcommand.
+class serve_subcommand : public cli_subcommand
+{
+public:
+    std::string name() const noexcept override
+    {
+        return "serve";
+    }
+
+    std::string brief_description() const noexcept override
+    {
+        return "Runs simulations on request from other processes";
+    }
+
+    std::string long_description() const noexcept override
+    {
+        return "This command starts a server which listens for simulation "
+               "jobs on a local (UNIX domain) socket, and runs them like the "
+               "'run' command would.  The models used by a system are kept "
+               "loaded between jobs, so running many short simulations of "
+               "the same system is much faster this way than starting the "
+               "program once per simulation.\n"
+               "\n"
+               "Clients send requests as JSON objects, one per line, and "
+               "the server sends one JSON object per line in response.  "
+               "A connection may be used for any number of requests, which "
+               "are handled one at a time, while separate connections are "
+               "served in parallel.  A request to run a simulation has the "
+               "following fields:\n"
+               "\n"
+               "system          The path to the system structure (required)\n"
+               "begin           The start time (default: 0)\n"
+               "end             The end time (required)\n"
+               "output_dir      The output directory (default: '.')\n"
+               "output_config   As '--output-config' for 'run' (default: 'auto')\n"
+               "scenario        The path to a scenario file\n"
+               "scenario_start  The scenario start time (default: 0)\n"
+               "parameter_set   The SSP parameter set to use (default: the unnamed one)\n"
+               "worker_threads  The number of worker threads (default: 0)\n"
+               "rtf             The real time factor target\n"
+               "id              An arbitrary string which is included in the response\n"
+               "\n"
+               "Relative paths are interpreted relative to the working "
+               "directory of the server.  The response contains a 'status' "
+               "field, which is either 'ok' or 'error'.  For successful "
+               "runs, it also contains the absolute path to the output "
+               "directory and the time spent waiting, loading the system, "
+               "and simulating.  For errors, it contains an error message.\n"
+               "\n"
+               "The server stops when it receives the request "
+               "{\"command\": \"shutdown\"}, or when it is interrupted.  "
+               "This command is only available on POSIX systems.";
+    }
+
+    void setup_options(
+        boost::program_options::options_description& options,
+        boost::program_options::options_description& positionalOptions,
+        boost::program_options::positional_options_description& positions)
+        const noexcept override;
+
+    int run(const boost::program_options::variables_map& args) const override;
+};
+
+
+#endif
@@ -0,0 +1,266 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#include "system_analysis.hpp"
+
+#include <cosim/log/logger.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <numeric>
+#include <queue>
+#include <stdexcept>
+#include <utility>
+
+
+namespace
+{
+
+// The maximum number of macro steps to analyse.  Systems with
+// relatively prime decimation factors can have very long cycles, but
+// these are dominated by their beginning anyway.
+constexpr std::int64_t maxCycleLength = 100000;
+
+template<class... Ts>
+struct overloaded : Ts... { using Ts::operator()...; };
+
+template<class... Ts>
+overloaded(Ts...) -> overloaded<Ts...>;
+
+double to_seconds(cosim::duration d)
+{
+    return std::chrono::duration<double>(d).count();
+}
+
+int decimation_factor(cosim::duration stepSizeHint, cosim::duration baseStepSize)
+{
+    if (stepSizeHint <= cosim::duration::zero() || baseStepSize <= cosim::duration::zero()) {
+        return 1;
+    }
+    const auto ratio = std::round(to_seconds(stepSizeHint) / to_seconds(baseStepSize));
+    return std::max(1, static_cast<int>(ratio));
+}
+
+// Returns the time it takes to execute jobs with the given costs, which
+// must be sorted in descending order, on `threadCount` threads, using the
+// "longest processing time first" rule.
+double makespan(const std::vector<double>& sortedCosts, std::size_t threadCount)
+{
+    std::priority_queue<double, std::vector<double>, std::greater<double>> loads;
+    for (std::size_t t = 0; t < threadCount; ++t) loads.push(0.0);
+    for (const auto cost : sortedCosts) {
+        const auto load = loads.top();
+        loads.pop();
+        loads.push(load + cost);
+    }
+    double result = 0.0;
+    while (!loads.empty()) {
+        result = loads.top();
+        loads.pop();
+    }
+    return result;
+}
+
+// `costs` contains the step cost of each simulator in `simulators`.
+parallelism_estimate estimate_parallelism(
+    const std::vector<simulator_summary>& simulators,
+    const std::vector<double>& costs,
+    bool measuredCosts)
+{
+    parallelism_estimate estimate;
+    estimate.measured_costs = measuredCosts;
+    if (simulators.empty()) return estimate;
+
+    std::int64_t cycleLength = 1;
+    for (const auto& s : simulators) {
+        cycleLength = std::lcm(cycleLength, static_cast<std::int64_t>(s.decimation_factor));
+        if (cycleLength > maxCycleLength) {
+            cycleLength = maxCycleLength;
+            estimate.cycle_truncated = true;
+            break;
+        }
+    }
+    estimate.cycle_length = cycleLength;
+
+    // The cost of a macro step only depends on which simulators step in
+    // it, and there are usually few distinct combinations, so we count
+    // those first.
+    std::map<std::vector<bool>, std::int64_t> patterns;
+    estimate.min_concurrency = simulators.size();
+    std::size_t totalSteps = 0;
+    for (std::int64_t step = 0; step < cycleLength; ++step) {
+        std::vector<bool> pattern(simulators.size());
+        std::size_t concurrency = 0;
+        for (std::size_t i = 0; i < simulators.size(); ++i) {
+            if (step % simulators[i].decimation_factor == 0) {
+                pattern[i] = true;
+                ++concurrency;
+            }
+        }
+        estimate.min_concurrency = std::min(estimate.min_concurrency, concurrency);
+        estimate.max_concurrency = std::max(estimate.max_concurrency, concurrency);
+        totalSteps += concurrency;
+        ++patterns[std::move(pattern)];
+    }
+    estimate.mean_concurrency = static_cast<double>(totalSteps) / cycleLength;
+
+    estimate.cycle_costs.assign(estimate.max_concurrency, 0.0);
+    for (const auto& [pattern, count] : patterns) {
+        std::vector<double> stepCosts;
+        for (std::size_t i = 0; i < simulators.size(); ++i) {
+            if (pattern[i]) stepCosts.push_back(costs[i]);
+        }
+        std::sort(stepCosts.begin(), stepCosts.end(), std::greater<double>());
+        for (std::size_t t = 1; t <= estimate.max_concurrency; ++t) {
+            estimate.cycle_costs[t - 1] += count * makespan(stepCosts, t);
+        }
+    }
+
+    const auto criticalPath = estimate.cycle_costs.back();
+    for (std::size_t t = 1; t <= estimate.cycle_costs.size(); ++t) {
+        if (estimate.cycle_costs[t - 1] <= 1.05 * criticalPath) {
+            estimate.suggested_worker_threads = static_cast<unsigned int>(t);
+            break;
+        }
+    }
+    return estimate;
+}
+
+} // namespace
+
+
+system_analysis analyse_system(
+    const system_config& config,
+    const step_cost_map& stepCosts)
+{
+    system_analysis analysis;
+    std::visit(
+        overloaded{
+            [&analysis](const std::shared_ptr<cosim::algorithm>&) {
+                analysis.algorithm = "predefined";
+            },
+            [&analysis](const cosim::fixed_step_algorithm_params& params) {
+                analysis.algorithm = "fixed-step";
+                analysis.base_step_size = params.base_step_size;
+            },
+            [&analysis](const cosim::ecco_algorithm_params&) {
+                analysis.algorithm = "ecco";
+            }},
+        config.algorithm);
+
+    for (const auto& entity : config.structure.entities()) {
+        const auto model = std::get_if<std::shared_ptr<cosim::model>>(&entity.type);
+        if (!model) {
+            ++analysis.function_count;
+            continue;
+        }
+        simulator_summary s;
+        s.name = entity.name;
+        s.model_name = (*model)->description()->name;
+        s.step_size_hint = entity.step_size_hint;
+        if (const auto it = stepCosts.find(entity.name); it != stepCosts.end()) {
+            s.step_cost = it->second;
+        }
+        analysis.simulators.push_back(std::move(s));
+    }
+
+    // The ECCO algorithm steps all simulators in every macro step, with an
+    // adaptive step size.  When the algorithm is predefined (as is the
+    // case for SSP), we don't know the base step size, so we assume it is
+    // the smallest step size hint.
+    if (analysis.algorithm != "ecco") {
+        auto baseStepSize = analysis.base_step_size.value_or(cosim::duration::max());
+        if (!analysis.base_step_size) {
+            for (const auto& s : analysis.simulators) {
+                if (s.step_size_hint > cosim::duration::zero()) {
+                    baseStepSize = std::min(baseStepSize, s.step_size_hint);
+                }
+            }
+        }
+        for (auto& s : analysis.simulators) {
+            s.decimation_factor = decimation_factor(s.step_size_hint, baseStepSize);
+        }
+    }
+
+    for (const auto& entry : stepCosts) {
+        const auto it = std::find_if(
+            analysis.simulators.begin(),
+            analysis.simulators.end(),
+            [&entry](const simulator_summary& s) { return s.name == entry.first; });
+        if (it == analysis.simulators.end()) {
+            BOOST_LOG_SEV(cosim::log::logger(), cosim::log::warning)
+                << "Step cost given for unknown simulator: " << entry.first;
+        }
+    }
+
+    double knownCostSum = 0.0;
+    std::size_t knownCostCount = 0;
+    for (const auto& s : analysis.simulators) {
+        if (s.step_cost) {
+            knownCostSum += *s.step_cost;
+            ++knownCostCount;
+        }
+    }
+    const auto measuredCosts = knownCostCount > 0;
+    const auto defaultCost = measuredCosts ? knownCostSum / knownCostCount : 1.0;
+    std::vector<double> costs;
+    for (const auto& s : analysis.simulators) {
+        if (measuredCosts && !s.step_cost) {
+            BOOST_LOG_SEV(cosim::log::logger(), cosim::log::warning)
+                << "No step cost given for simulator '" << s.name
+                << "'; assuming the mean cost (" << defaultCost << " s)";
+        }
+        costs.push_back(s.step_cost.value_or(defaultCost));
+    }
+    analysis.parallelism = estimate_parallelism(analysis.simulators, costs, measuredCosts);
+
+    std::map<std::pair<std::string, std::string>, std::size_t> couplings;
+    for (const auto& c : config.structure.connections()) {
+        ++couplings[{c.source.entity_name, c.target.entity_name}];
+        ++analysis.connection_count;
+    }
+    for (const auto& [entities, count] : couplings) {
+        analysis.couplings.push_back({entities.first, entities.second, count});
+    }
+    return analysis;
+}
+
+
+step_cost_map read_step_costs(const cosim::filesystem::path& file)
+{
+    std::ifstream stream(file.string());
+    if (!stream) {
+        throw std::runtime_error("Unable to open step cost file: " + file.string());
+    }
+    step_cost_map costs;
+    int lineNumber = 0;
+    for (std::string line; std::getline(stream, line);) {
+        ++lineNumber;
+        const auto begin = line.find_first_not_of(" \t\r");
+        if (begin == std::string::npos || line[begin] == '#') continue;
+        const auto end = line.find_last_not_of(" \t\r") + 1;
+        const auto separator = line.find_last_of(" \t", end - 1);
+        double cost = -1.0;
+        if (separator != std::string::npos && separator > begin) {
+            try {
+                cost = std::stod(line.substr(separator + 1, end - separator - 1));
+            } catch (const std::logic_error&) {
+                // Reported below
+            }
+        }
+        if (!(cost >= 0.0)) {
+            throw std::runtime_error(
+                file.string() + ':' + std::to_string(lineNumber) +
+                ": Expected a simulator name and a nonnegative step cost");
+        }
+        const auto nameEnd = line.find_last_not_of(" \t", separator) + 1;
+        costs[line.substr(begin, nameEnd - begin)] = cost;
+    }
+    return costs;
+}
@@ -0,0 +1,134 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#ifndef COSIM_SYSTEM_ANALYSIS_HPP
+#define COSIM_SYSTEM_ANALYSIS_HPP
+
+#include "system_config.hpp"
+
+#include <cosim/fs_portability.hpp>
+#include <cosim/time.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+/// Per-simulator step costs, in seconds of wall-clock time per step.
+using step_cost_map = std::unordered_map<std::string, double>;
+
+
+/// Information about one simulator in a system.
+struct simulator_summary
+{
+    std::string name;
+    std::string model_name;
+
+    /// The step size hint, or zero if none was given.
+    cosim::duration step_size_hint = {};
+
+    /// The number of base steps per simulator step.
+    int decimation_factor = 1;
+
+    /// The cost of one step, in seconds, if it was specified.
+    std::optional<double> step_cost;
+};
+
+
+/// The connections from one entity to another.
+struct coupling_summary
+{
+    std::string source;
+    std::string target;
+    std::size_t variable_count = 0;
+};
+
+
+/**
+ *  A static estimate of how well a system parallelises under the
+ *  fixed-step algorithm.
+ *
+ *  The simulators that are due to step in a given macro step are stepped
+ *  concurrently, so the pattern of concurrently stepping simulators
+ *  repeats every `cycle_length` macro steps, the least common multiple of
+ *  the decimation factors.  All costs are given per cycle; they are in
+ *  seconds if `measured_costs` is true, and in units of one simulator step
+ *  otherwise.
+ */
+struct parallelism_estimate
+{
+    /// The number of macro steps in one cycle.
+    std::int64_t cycle_length = 0;
+
+    /// Whether the cycle was too long, so only its beginning was analysed.
+    bool cycle_truncated = false;
+
+    /// The minimum, mean and maximum number of simulators per macro step.
+    std::size_t min_concurrency = 0;
+    double mean_concurrency = 0.0;
+    std::size_t max_concurrency = 0;
+
+    /// Whether the costs are based on measured step costs.
+    bool measured_costs = false;
+
+    /**
+     *  The cost of a cycle when stepping with 1, 2, ... `max_concurrency`
+     *  threads, in that order.  The last element is the critical path,
+     *  i.e., the sum of the most expensive step in each macro step.
+     */
+    std::vector<double> cycle_costs;
+
+    /**
+     *  The smallest number of worker threads for which the cost is within
+     *  5% of the critical path.
+     */
+    unsigned int suggested_worker_threads = 1;
+};
+
+
+/// The results of `analyse_system()`.
+struct system_analysis
+{
+    /// The algorithm type, "fixed-step", "ecco", or "predefined".
+    std::string algorithm;
+
+    /// The base step size, if it is known.
+    std::optional<cosim::duration> base_step_size;
+
+    std::vector<simulator_summary> simulators;
+    std::size_t function_count = 0;
+    std::size_t connection_count = 0;
+    std::vector<coupling_summary> couplings;
+    parallelism_estimate parallelism;
+};
+
+
+/**
+ *  Analyses a system structure.
+ *
+ *  `stepCosts` contains measured step costs for some or all of the
+ *  simulators, by name.  Simulators that are not listed are assumed to
+ *  have the mean cost of the listed ones.  If it is empty, all simulators
+ *  are assumed to have the same cost.
+ */
+system_analysis analyse_system(
+    const system_config& config,
+    const step_cost_map& stepCosts);
+
+
+/**
+ *  Reads step costs from a file.
+ *
+ *  Each line should contain a simulator name and a step cost in seconds,
+ *  separated by whitespace.  Empty lines and lines starting with '#' are
+ *  ignored.
+ */
+step_cost_map read_step_costs(const cosim::filesystem::path& file);
+
+
+#endif
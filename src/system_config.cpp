@@ -0,0 +1,464 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#include "system_config.hpp"
+
+#include "cache.hpp"
+#include "cbor_utils.hpp"
+#include "fingerprint.hpp"
+#include "tools.hpp"
+
+#include <cosim/lib_info.hpp>
+#include <cosim/log/logger.hpp>
+#include <cosim/osp_config_parser.hpp>
+#include <cosim/ssp/ssp_loader.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+
+namespace
+{
+
+template<class... Ts>
+struct overloaded : Ts... { using Ts::operator()...; };
+
+template<class... Ts>
+overloaded(Ts...) -> overloaded<Ts...>;
+
+bool is_osp_config_path(const cosim::filesystem::path& path)
+{
+    return path.extension() == ".xml" ||
+        (cosim::filesystem::is_directory(path) &&
+            cosim::filesystem::exists(path / "OspSystemStructure.xml"));
+}
+
+
+// Parsed OSP configurations are cached in the user cache directory, in
+// one CBOR file per configuration file.  An entry is used if the contents
+// of the configuration file are unchanged, and all the FMUs it refers to
+// have the same fingerprints as when it was stored.  The same goes for the
+// OSP model description files (`<model>_OspModelDescription.xml`) next to
+// the configuration file and the FMUs, which define the variable groups
+// that group connections are expanded from.  The models are still looked
+// up normally, but that is fast when the FMUs are already unpacked.
+//
+// Configurations with functions, or which use the ECCO algorithm, are not
+// cached, as we'd then have to replicate a lot of libcosim's internals.
+
+// Incremented whenever the file format changes incompatibly.
+constexpr std::uint64_t systemCacheFormatVersion = 2;
+
+// Records the absolute URIs of the models that are looked up through it.
+class recording_sub_resolver : public cosim::model_uri_sub_resolver
+{
+public:
+    explicit recording_sub_resolver(cosim::model_uri_resolver& resolver)
+        : resolver_(resolver)
+    {}
+
+    std::shared_ptr<cosim::model> lookup_model(const cosim::uri& modelUri) override
+    {
+        auto model = resolver_.lookup_model(modelUri);
+        if (model) uris_.insert_or_assign(model.get(), modelUri);
+        return model;
+    }
+
+    const std::unordered_map<const cosim::model*, cosim::uri>& uris() const noexcept
+    {
+        return uris_;
+    }
+
+private:
+    cosim::model_uri_resolver& resolver_;
+    std::unordered_map<const cosim::model*, cosim::uri> uris_;
+};
+
+std::string library_version_string()
+{
+    const auto v = cosim::library_version();
+    return std::to_string(v.major) + '.' + std::to_string(v.minor) + '.' +
+        std::to_string(v.patch);
+}
+
+std::string read_file(const cosim::filesystem::path& path)
+{
+    std::ifstream stream(path.string(), std::ios::binary);
+    if (!stream) throw std::runtime_error("Unable to read file: " + path.string());
+    return std::string(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+}
+
+cbor_item_ptr encode_fingerprint(const file_fingerprint& fp)
+{
+    auto item = make_cbor_map(4);
+    add_to_cbor_map(item.get(), "path", make_cbor_string(fp.path));
+    add_to_cbor_map(item.get(), "size", make_cbor_uint(fp.size));
+    add_to_cbor_map(item.get(), "mtime", make_cbor_int(fp.mtime));
+    add_to_cbor_map(item.get(), "inode", make_cbor_uint(fp.inode));
+    return item;
+}
+
+file_fingerprint decode_fingerprint(const cbor_item_t* item)
+{
+    file_fingerprint fp;
+    fp.path = get_cbor_string(get_from_cbor_map(item, "path"));
+    fp.size = get_cbor_uint(get_from_cbor_map(item, "size"));
+    fp.mtime = get_cbor_int(get_from_cbor_map(item, "mtime"));
+    fp.inode = get_cbor_uint(get_from_cbor_map(item, "inode"));
+    return fp;
+}
+
+// Returns the fingerprints of the OSP model description files that
+// `cosim::load_osp_config()` may read for a configuration, sorted by path.
+// These are all the files named `*_OspModelDescription.xml` in the
+// directory of the configuration file and in the directories of its FMUs,
+// so that adding a file also invalidates a cache entry.
+std::vector<file_fingerprint> osp_model_description_fingerprints(
+    const cosim::filesystem::path& configFile,
+    const std::vector<cosim::filesystem::path>& fmuPaths)
+{
+    constexpr std::string_view suffix = "_OspModelDescription.xml";
+    std::vector<cosim::filesystem::path> dirs = {configFile.parent_path()};
+    for (const auto& fmuPath : fmuPaths) dirs.push_back(fmuPath.parent_path());
+    std::sort(dirs.begin(), dirs.end());
+    dirs.erase(std::unique(dirs.begin(), dirs.end()), dirs.end());
+
+    std::vector<file_fingerprint> fingerprints;
+    for (const auto& dir : dirs) {
+        if (!cosim::filesystem::is_directory(dir)) continue;
+        for (const auto& entry : cosim::filesystem::directory_iterator(dir)) {
+            const auto name = entry.path().filename().string();
+            if (name.size() > suffix.size() &&
+                name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0) {
+                fingerprints.push_back(fingerprint_file(entry.path()));
+            }
+        }
+    }
+    std::sort(fingerprints.begin(), fingerprints.end(), [](const auto& a, const auto& b) {
+        return a.path < b.path;
+    });
+    return fingerprints;
+}
+
+// Information that identifies a particular version of a configuration file.
+struct config_file_info
+{
+    // The path to the cache entry
+    cosim::filesystem::path cacheFile;
+    std::string path;
+    std::string contentHash;
+};
+
+std::optional<config_file_info> get_config_file_info(const cosim::filesystem::path& configPath)
+{
+    const auto cacheDir = system_config_cache_path();
+    if (!cacheDir || !cosim::filesystem::exists(configPath)) return std::nullopt;
+    auto file = cosim::filesystem::canonical(configPath);
+    if (cosim::filesystem::is_directory(file)) file /= "OspSystemStructure.xml";
+    config_file_info info;
+    info.path = file.string();
+    info.cacheFile = *cacheDir / (hash_string(info.path) + ".cbor");
+    info.contentHash = hash_string(read_file(file));
+    return info;
+}
+
+// Stores an OSP configuration in the cache, if possible.
+void store_cached_config(
+    const config_file_info& fileInfo,
+    const system_config& config)
+{
+    const auto& modelUris = config.model_uris;
+    const auto params = std::get_if<cosim::fixed_step_algorithm_params>(&config.algorithm);
+    if (!params) return;
+
+    std::vector<const cosim::model*> models;
+    auto entities = make_cbor_array(config.structure.entities().size());
+    for (const auto& entity : config.structure.entities()) {
+        const auto model = std::get_if<std::shared_ptr<cosim::model>>(&entity.type);
+        if (!model || !modelUris.count(model->get())) return;
+        auto modelIndex = std::find(models.begin(), models.end(), model->get()) - models.begin();
+        if (modelIndex == static_cast<std::ptrdiff_t>(models.size())) models.push_back(model->get());
+        auto item = make_cbor_array(3);
+        append_to_cbor_array(item.get(), make_cbor_string(entity.name));
+        append_to_cbor_array(item.get(), make_cbor_uint(modelIndex));
+        append_to_cbor_array(item.get(), make_cbor_int(entity.step_size_hint.count()));
+        append_to_cbor_array(entities.get(), std::move(item));
+    }
+
+    auto modelItems = make_cbor_array(models.size());
+    std::vector<cosim::filesystem::path> fmuPaths;
+    for (const auto model : models) {
+        const auto& uri = modelUris.at(model);
+        const auto fmuPath = local_fmu_path(uri);
+        auto item = make_cbor_map(fmuPath ? 2 : 1);
+        add_to_cbor_map(item.get(), "uri", make_cbor_string(uri.view()));
+        if (fmuPath) {
+            const auto fingerprint = fingerprint_file(*fmuPath);
+            add_to_cbor_map(item.get(), "fingerprint", encode_fingerprint(fingerprint));
+            fmuPaths.emplace_back(fingerprint.path);
+        }
+        append_to_cbor_array(modelItems.get(), std::move(item));
+    }
+
+    const auto descriptionFingerprints = osp_model_description_fingerprints(fileInfo.path, fmuPaths);
+    auto descriptionItems = make_cbor_array(descriptionFingerprints.size());
+    for (const auto& fp : descriptionFingerprints) {
+        append_to_cbor_array(descriptionItems.get(), encode_fingerprint(fp));
+    }
+
+    auto connections = make_cbor_array(config.structure.connections().size());
+    for (const auto& c : config.structure.connections()) {
+        auto item = make_cbor_array(4);
+        append_to_cbor_array(item.get(), make_cbor_string(c.source.entity_name));
+        append_to_cbor_array(item.get(), make_cbor_string(c.source.variable_name));
+        append_to_cbor_array(item.get(), make_cbor_string(c.target.entity_name));
+        append_to_cbor_array(item.get(), make_cbor_string(c.target.variable_name));
+        append_to_cbor_array(connections.get(), std::move(item));
+    }
+
+    const auto& initialValueMap = config.parameter_sets.at("");
+    auto initialValues = make_cbor_array(initialValueMap.size());
+    for (const auto& [name, value] : initialValueMap) {
+        auto item = make_cbor_array(3);
+        append_to_cbor_array(item.get(), make_cbor_string(name.entity_name));
+        append_to_cbor_array(item.get(), make_cbor_string(name.variable_name));
+        append_to_cbor_array(item.get(), make_cbor_scalar(value));
+        append_to_cbor_array(initialValues.get(), std::move(item));
+    }
+
+    auto root = make_cbor_map(10);
+    add_to_cbor_map(root.get(), "format_version", make_cbor_uint(systemCacheFormatVersion));
+    add_to_cbor_map(root.get(), "libcosim_version", make_cbor_string(library_version_string()));
+    add_to_cbor_map(root.get(), "path", make_cbor_string(fileInfo.path));
+    add_to_cbor_map(root.get(), "content_hash", make_cbor_string(fileInfo.contentHash));
+    add_to_cbor_map(root.get(), "base_step_size", make_cbor_int(params->base_step_size.count()));
+    add_to_cbor_map(root.get(), "models", std::move(modelItems));
+    add_to_cbor_map(root.get(), "osp_model_descriptions", std::move(descriptionItems));
+    add_to_cbor_map(root.get(), "entities", std::move(entities));
+    add_to_cbor_map(root.get(), "connections", std::move(connections));
+    add_to_cbor_map(root.get(), "initial_values", std::move(initialValues));
+    cosim::filesystem::create_directories(fileInfo.cacheFile.parent_path());
+    write_cbor_file(fileInfo.cacheFile, root.get());
+}
+
+// Loads an OSP configuration from the cache, or returns an empty object
+// if there is no up-to-date cache entry for it.
+std::optional<system_config> load_cached_config(
+    const config_file_info& fileInfo,
+    cosim::model_uri_resolver& uriResolver)
+{
+    const auto root = read_cbor_file(fileInfo.cacheFile);
+    if (!root) return std::nullopt;
+    if (get_cbor_uint(get_from_cbor_map(root.get(), "format_version")) != systemCacheFormatVersion ||
+        get_cbor_string(get_from_cbor_map(root.get(), "libcosim_version")) != library_version_string() ||
+        get_cbor_string(get_from_cbor_map(root.get(), "path")) != fileInfo.path ||
+        get_cbor_string(get_from_cbor_map(root.get(), "content_hash")) != fileInfo.contentHash) {
+        return std::nullopt;
+    }
+
+    const auto modelItems = get_from_cbor_map(root.get(), "models");
+    std::vector<cosim::uri> modelUris;
+    std::vector<cosim::filesystem::path> fmuPaths;
+    for (std::size_t i = 0; i < get_cbor_array_size(modelItems); ++i) {
+        const auto item = get_cbor_array_element(modelItems, i);
+        if (const auto fpItem = find_in_cbor_map(item, "fingerprint")) {
+            const auto fp = decode_fingerprint(fpItem);
+            if (!cosim::filesystem::exists(fp.path) || fingerprint_file(fp.path) != fp) {
+                return std::nullopt;
+            }
+            fmuPaths.emplace_back(fp.path);
+        }
+        modelUris.emplace_back(get_cbor_string(get_from_cbor_map(item, "uri")));
+    }
+
+    const auto descriptionItems = get_from_cbor_map(root.get(), "osp_model_descriptions");
+    std::vector<file_fingerprint> storedDescriptions;
+    for (std::size_t i = 0; i < get_cbor_array_size(descriptionItems); ++i) {
+        storedDescriptions.push_back(decode_fingerprint(get_cbor_array_element(descriptionItems, i)));
+    }
+    if (storedDescriptions != osp_model_description_fingerprints(fileInfo.path, fmuPaths)) {
+        return std::nullopt;
+    }
+
+    system_config config;
+    std::vector<std::shared_ptr<cosim::model>> models(modelUris.size());
+    const auto entities = get_from_cbor_map(root.get(), "entities");
+    for (std::size_t i = 0; i < get_cbor_array_size(entities); ++i) {
+        const auto item = get_cbor_array_element(entities, i);
+        const auto modelIndex = get_cbor_uint(get_cbor_array_element(item, 1));
+        if (modelIndex >= models.size()) throw std::runtime_error("Invalid model index");
+        auto& model = models[modelIndex];
+        if (!model) {
+            model = uriResolver.lookup_model(modelUris[modelIndex]);
+            config.model_uris.insert_or_assign(model.get(), modelUris[modelIndex]);
+        }
+        config.structure.add_entity(
+            get_cbor_string(get_cbor_array_element(item, 0)),
+            model,
+            cosim::duration(get_cbor_int(get_cbor_array_element(item, 2))));
+    }
+
+    const auto connections = get_from_cbor_map(root.get(), "connections");
+    for (std::size_t i = 0; i < get_cbor_array_size(connections); ++i) {
+        const auto item = get_cbor_array_element(connections, i);
+        config.structure.connect_variables(
+            cosim::full_variable_name(
+                get_cbor_string(get_cbor_array_element(item, 0)),
+                get_cbor_string(get_cbor_array_element(item, 1))),
+            cosim::full_variable_name(
+                get_cbor_string(get_cbor_array_element(item, 2)),
+                get_cbor_string(get_cbor_array_element(item, 3))));
+    }
+
+    auto& initialValueMap = config.parameter_sets[""];
+    const auto initialValues = get_from_cbor_map(root.get(), "initial_values");
+    for (std::size_t i = 0; i < get_cbor_array_size(initialValues); ++i) {
+        const auto item = get_cbor_array_element(initialValues, i);
+        const auto name = cosim::full_variable_name(
+            get_cbor_string(get_cbor_array_element(item, 0)),
+            get_cbor_string(get_cbor_array_element(item, 1)));
+        const auto& variable = config.structure.get_variable_description(name);
+        cosim::add_parameter_value(
+            initialValueMap,
+            config.structure,
+            name,
+            get_cbor_scalar(get_cbor_array_element(item, 2), variable.type));
+    }
+
+    config.algorithm = cosim::fixed_step_algorithm_params(
+        cosim::duration(get_cbor_int(get_from_cbor_map(root.get(), "base_step_size"))));
+    return config;
+}
+
+system_config load_osp_system_config(
+    const cosim::filesystem::path& path,
+    cosim::model_uri_resolver& uriResolver)
+{
+    std::optional<config_file_info> fileInfo;
+    try {
+        fileInfo = get_config_file_info(path);
+        if (fileInfo) {
+            if (auto config = load_cached_config(*fileInfo, uriResolver)) {
+                BOOST_LOG_SEV(cosim::log::logger(), cosim::log::info)
+                    << "Using cached system structure: " << fileInfo->cacheFile;
+                return std::move(*config);
+            }
+        }
+    } catch (const std::exception& e) {
+        BOOST_LOG_SEV(cosim::log::logger(), cosim::log::warning)
+            << "Ignoring cached system structure for " << path << ": " << e.what();
+    }
+
+    cosim::model_uri_resolver recordingResolver;
+    const auto recorder = std::make_shared<recording_sub_resolver>(uriResolver);
+    recordingResolver.add_sub_resolver(recorder);
+    auto ospConfig = cosim::load_osp_config(path, recordingResolver);
+
+    system_config config;
+    config.structure = std::move(ospConfig.system_structure);
+    config.parameter_sets.emplace("", std::move(ospConfig.initial_values));
+    std::visit(
+        [&config](const auto& params) { config.algorithm = params; },
+        ospConfig.algorithm_configuration);
+    config.model_uris = recorder->uris();
+
+    if (fileInfo) {
+        try {
+            store_cached_config(*fileInfo, config);
+        } catch (const std::exception& e) {
+            BOOST_LOG_SEV(cosim::log::logger(), cosim::log::warning)
+                << "Unable to cache system structure for " << path << ": " << e.what();
+        }
+    }
+    return config;
+}
+
+} // namespace
+
+
+bool is_system_structure_path(const cosim::filesystem::path& path)
+{
+    return is_osp_config_path(path) ||
+        path.extension() == ".ssp" ||
+        (cosim::filesystem::is_directory(path) &&
+            cosim::filesystem::exists(path / "SystemStructure.ssd"));
+}
+
+
+system_config load_system_config(
+    const cosim::filesystem::path& path,
+    cosim::model_uri_resolver& uriResolver)
+{
+    if (is_osp_config_path(path)) return load_osp_system_config(path, uriResolver);
+
+    const auto recordingResolver = std::make_shared<cosim::model_uri_resolver>();
+    const auto recorder = std::make_shared<recording_sub_resolver>(uriResolver);
+    recordingResolver->add_sub_resolver(recorder);
+    cosim::ssp_loader loader;
+    loader.set_model_uri_resolver(recordingResolver);
+
+    // The SSP loader would unpack an archive into a new temporary directory
+    // every time, so the FMUs in it would get new paths and cache entries.
+    // Instead, we unpack it into the cache, where it gets the same path
+    // every time, and keep it there while it is loaded.
+    std::optional<unpacked_archive> unpacked;
+    if (path.extension() == ".ssp" && !cosim::filesystem::is_directory(path)) {
+        try {
+            unpacked = unpack_to_cache(path);
+        } catch (const std::exception& e) {
+            BOOST_LOG_SEV(cosim::log::logger(), cosim::log::warning)
+                << "Unable to unpack " << path << " into the cache: " << e.what();
+        }
+    }
+    auto sspConfig = loader.load(unpacked ? unpacked->directory() : path);
+    system_config config;
+    config.structure = std::move(sspConfig.system_structure);
+    config.parameter_sets = std::move(sspConfig.parameter_sets);
+    config.algorithm = std::move(sspConfig.algorithm);
+    config.model_uris = recorder->uris();
+    return config;
+}
+
+
+cosim::execution make_execution(
+    const system_config& config,
+    cosim::time_point startTime,
+    std::optional<unsigned int> workerThreadCount,
+    const std::string& parameterSet)
+{
+    std::shared_ptr<cosim::algorithm> algorithm;
+    std::visit(
+        overloaded{
+            [&algorithm](const std::shared_ptr<cosim::algorithm>& readyMade) {
+                algorithm = readyMade;
+            },
+            [&algorithm, &workerThreadCount](const cosim::fixed_step_algorithm_params& params) {
+                algorithm = std::make_shared<cosim::fixed_step_algorithm>(params, workerThreadCount);
+            },
+            [&algorithm, &workerThreadCount](const cosim::ecco_algorithm_params& params) {
+                algorithm = std::make_shared<cosim::ecco_algorithm>(params, workerThreadCount);
+            }},
+        config.algorithm);
+
+    const auto parameterSetIt = config.parameter_sets.find(parameterSet);
+    if (parameterSetIt == config.parameter_sets.end()) {
+        throw std::runtime_error("No such parameter set: '" + parameterSet + "'");
+    }
+
+    auto execution = cosim::execution(startTime, algorithm);
+    cosim::inject_system_structure(
+        execution,
+        config.structure,
+        parameterSetIt->second);
+    return execution;
+}
@@ -0,0 +1,97 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#ifndef COSIM_SYSTEM_CONFIG_HPP
+#define COSIM_SYSTEM_CONFIG_HPP
+
+#include <cosim/algorithm/fixed_step_algorithm.hpp>
+#include <cosim/execution.hpp>
+#include <cosim/fs_portability.hpp>
+#include <cosim/orchestration.hpp>
+#include <cosim/system_structure.hpp>
+#include <cosim/time.hpp>
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <variant>
+
+
+/// Algorithm settings of a `system_config`.
+using algorithm_config = std::variant<
+    std::shared_ptr<cosim::algorithm>,
+    cosim::fixed_step_algorithm_params,
+    cosim::ecco_algorithm_params>;
+
+
+/**
+ *  A system structure definition, as loaded from an OSP or SSP
+ *  configuration.
+ */
+struct system_config
+{
+    /// The simulators, functions, and connections between them.
+    cosim::system_structure structure;
+
+    /**
+     *  Named sets of initial values.  OSP configurations have only one,
+     *  which is unnamed (i.e., has an empty name), while SSP
+     *  configurations may have any number.
+     */
+    std::unordered_map<std::string, cosim::variable_value_map> parameter_sets;
+
+    /**
+     *  The co-simulation algorithm.  SSP configurations come with a
+     *  ready-made algorithm object, which can only be used for a single
+     *  execution.  For OSP configurations, this contains the algorithm
+     *  parameters.
+     */
+    algorithm_config algorithm;
+
+    /// The URIs from which the models in `structure` were loaded.
+    std::unordered_map<const cosim::model*, cosim::uri> model_uris;
+};
+
+
+/// Returns whether `path` looks like an OSP or SSP system structure definition.
+bool is_system_structure_path(const cosim::filesystem::path& path);
+
+
+/**
+ *  Loads a system structure definition.
+ *
+ *  If `path` is a file with .xml extension, or a directory that contains a
+ *  file named OspSystemStructure.xml, it is interpreted as an OSP system
+ *  structure definition.  Otherwise, it is interpreted as an SSP system
+ *  structure definition.
+ */
+system_config load_system_config(
+    const cosim::filesystem::path& path,
+    cosim::model_uri_resolver& uriResolver);
+
+
+/**
+ *  Creates an execution based on a system structure definition.
+ *
+ *  \param [in] config
+ *      The system structure definition.
+ *  \param [in] startTime
+ *      The start time of the execution.
+ *  \param [in] workerThreadCount
+ *      The number of worker threads for the algorithm, if it is created
+ *      from algorithm parameters.
+ *  \param [in] parameterSet
+ *      The name of the parameter set whose values should be used as initial
+ *      values.
+ */
+cosim::execution make_execution(
+    const system_config& config,
+    cosim::time_point startTime,
+    std::optional<unsigned int> workerThreadCount,
+    const std::string& parameterSet = {});
+
+
+#endif
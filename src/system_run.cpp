@@ -0,0 +1,307 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#include "system_run.hpp"
+
+#include "allocation_profile.hpp"
+#include "cache.hpp"
+#include "trace.hpp"
+
+#include <boost/property_tree/ptree.hpp>
+#include <cosim/manipulator/manipulator.hpp>
+#include <cosim/manipulator/scenario_manager.hpp>
+#include <cosim/observer/file_observer.hpp>
+#include <cosim/observer/observer.hpp>
+
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+
+namespace
+{
+
+std::unique_ptr<cosim::observer> make_file_observer(
+    const cosim::filesystem::path& outputDir,
+    const std::string& outputConfigArg,
+    const cosim::filesystem::path& systemStructurePath)
+{
+    if (outputConfigArg == "auto") {
+        const auto systemStructureDir =
+            cosim::filesystem::is_directory(systemStructurePath)
+            ? systemStructurePath
+            : systemStructurePath.parent_path();
+        const auto autoConfigFile = systemStructureDir / "LogConfig.xml";
+        if (cosim::filesystem::exists(autoConfigFile)) {
+            return std::make_unique<cosim::file_observer>(outputDir, autoConfigFile);
+        } else {
+            return std::make_unique<cosim::file_observer>(outputDir);
+        }
+    } else if (outputConfigArg == "all") {
+        return std::make_unique<cosim::file_observer>(outputDir);
+    } else if (outputConfigArg == "none") {
+        return nullptr;
+    } else {
+        return std::make_unique<cosim::file_observer>(outputDir, outputConfigArg);
+    }
+}
+
+
+// Forwards everything to another observer, records the time it spends on
+// each step in the trace, and attributes its allocations to the observer
+// phase in allocation profiles.
+class traced_observer : public cosim::observer
+{
+public:
+    traced_observer(std::shared_ptr<cosim::observer> observer, const char* name)
+        : observer_(std::move(observer))
+        , name_(name)
+    {}
+
+    void simulator_added(
+        cosim::simulator_index index,
+        cosim::observable* simulator,
+        cosim::time_point currentTime) override
+    {
+        observer_->simulator_added(index, simulator, currentTime);
+    }
+
+    void simulator_removed(cosim::simulator_index index, cosim::time_point currentTime) override
+    {
+        observer_->simulator_removed(index, currentTime);
+    }
+
+    void variables_connected(
+        cosim::variable_id output,
+        cosim::variable_id input,
+        cosim::time_point currentTime) override
+    {
+        observer_->variables_connected(output, input, currentTime);
+    }
+
+    void variable_disconnected(cosim::variable_id input, cosim::time_point currentTime) override
+    {
+        observer_->variable_disconnected(input, currentTime);
+    }
+
+    void simulation_initialized(
+        cosim::step_number firstStep,
+        cosim::time_point startTime) override
+    {
+        allocation_phase_scope phase(allocation_phase::observers);
+        trace_span span("observer", name_);
+        observer_->simulation_initialized(firstStep, startTime);
+    }
+
+    void step_complete(
+        cosim::step_number lastStep,
+        cosim::duration lastStepSize,
+        cosim::time_point currentTime) override
+    {
+        allocation_phase_scope phase(allocation_phase::observers);
+        trace_span span("observer", name_);
+        observer_->step_complete(lastStep, lastStepSize, currentTime);
+    }
+
+    void simulator_step_complete(
+        cosim::simulator_index index,
+        cosim::step_number lastStep,
+        cosim::duration lastStepSize,
+        cosim::time_point currentTime) override
+    {
+        allocation_phase_scope phase(allocation_phase::observers);
+        trace_span span("observer", name_);
+        observer_->simulator_step_complete(index, lastStep, lastStepSize, currentTime);
+    }
+
+    void state_restored(cosim::step_number currentStep, cosim::time_point currentTime) override
+    {
+        observer_->state_restored(currentStep, currentTime);
+    }
+
+private:
+    std::shared_ptr<cosim::observer> observer_;
+    const char* name_;
+};
+
+
+// Forwards everything to a scenario manager, and records the time it
+// spends applying the scenario, as well as the end of the scenario, in
+// the trace.
+class traced_scenario_manager : public cosim::manipulator
+{
+public:
+    explicit traced_scenario_manager(std::shared_ptr<cosim::scenario_manager> manager)
+        : manager_(std::move(manager))
+    {}
+
+    void simulator_added(
+        cosim::simulator_index index,
+        cosim::manipulable* simulator,
+        cosim::time_point currentTime) override
+    {
+        manager_->simulator_added(index, simulator, currentTime);
+    }
+
+    void simulator_removed(cosim::simulator_index index, cosim::time_point currentTime) override
+    {
+        manager_->simulator_removed(index, currentTime);
+    }
+
+    void step_commencing(cosim::time_point currentTime) override
+    {
+        if (!manager_->is_scenario_running()) {
+            manager_->step_commencing(currentTime);
+            return;
+        }
+        trace_span span("scenario", "scenario");
+        manager_->step_commencing(currentTime);
+        if (!manager_->is_scenario_running()) {
+            trace_instant(
+                "scenario",
+                "scenario finished",
+                "{\"time\": " + std::to_string(cosim::to_double_time_point(currentTime)) + "}");
+        }
+    }
+
+private:
+    std::shared_ptr<cosim::scenario_manager> manager_;
+};
+
+
+void load_scenario(
+    cosim::execution& execution,
+    const cosim::filesystem::path& scenarioPath,
+    cosim::time_point startTime)
+{
+    trace_span span("startup", "load scenario");
+    auto s = std::make_shared<cosim::scenario_manager>();
+    if (tracing_enabled()) {
+        execution.add_manipulator(std::make_shared<traced_scenario_manager>(s));
+    } else {
+        execution.add_manipulator(s);
+    }
+    s->load_scenario(scenarioPath, startTime);
+}
+
+} // namespace
+
+
+system_run_options parse_system_run_options(
+    const boost::property_tree::ptree& tree,
+    const cosim::filesystem::path& baseDir)
+{
+    try {
+        system_run_options options;
+        options.system_structure_path = baseDir / tree.get<std::string>("system");
+        options.begin_time = cosim::to_time_point(tree.get<double>("begin", 0.0));
+        options.end_time = cosim::to_time_point(tree.get<double>("end"));
+        if (options.end_time <= options.begin_time) {
+            throw std::runtime_error("End time must be greater than begin time");
+        }
+        if (const auto rtf = tree.get_optional<double>("rtf")) {
+            if (*rtf <= 0.0) throw std::runtime_error("Invalid real time factor target (must be >0)");
+            options.rtf_target = *rtf;
+        }
+        if (const auto workers = tree.get_optional<long long>("worker_threads")) {
+            if (*workers < 0) throw std::runtime_error("Invalid number of worker threads (must be >=0)");
+            options.worker_thread_count = static_cast<unsigned int>(
+                std::min<long long>(*workers, std::numeric_limits<unsigned int>::max()));
+        }
+        options.output_dir = baseDir / tree.get<std::string>("output_dir", ".");
+        options.output_config = tree.get<std::string>("output_config", "auto");
+        if (options.output_config != "auto" && options.output_config != "all" &&
+            options.output_config != "none") {
+            options.output_config = (baseDir / options.output_config).string();
+        }
+        if (const auto scenario = tree.get_optional<std::string>("scenario")) {
+            options.scenario = baseDir / *scenario;
+            options.scenario_start = cosim::to_time_point(tree.get<double>("scenario_start", 0.0));
+        }
+        options.parameter_set = tree.get<std::string>("parameter_set", "");
+        return options;
+    } catch (const boost::property_tree::ptree_error& e) {
+        throw std::runtime_error(e.what());
+    }
+}
+
+
+cosim::execution prepare_execution(
+    const system_config& config,
+    const system_run_options& options)
+{
+    trace_span instantiationSpan("startup", "instantiate simulators");
+    auto execution = make_execution(
+        config,
+        options.begin_time,
+        options.worker_thread_count,
+        options.parameter_set);
+    instantiationSpan.end();
+    if (options.rtf_target) {
+        auto rtConfig = execution.get_real_time_config();
+        rtConfig->real_time_factor_target.store(*options.rtf_target);
+        rtConfig->real_time_simulation.store(true);
+    }
+
+    std::shared_ptr<cosim::observer> outputObserver = make_file_observer(
+        options.output_dir,
+        options.output_config,
+        options.system_structure_path);
+    if (outputObserver && (tracing_enabled() || allocation_profiling_enabled())) {
+        outputObserver = std::make_shared<traced_observer>(std::move(outputObserver), "file output");
+    }
+    if (outputObserver) execution.add_observer(std::move(outputObserver));
+
+    if (options.scenario) {
+        load_scenario(execution, *options.scenario, options.scenario_start);
+    }
+    return execution;
+}
+
+
+execution_factory::execution_factory()
+    : uriResolver_(caching_model_uri_resolver())
+{}
+
+
+cosim::execution execution_factory::make_execution(const system_run_options& options)
+{
+    // Model lookup and instantiation are not necessarily thread safe, so
+    // they are serialised.  The system is loaded anew every time, since
+    // its configuration may have changed, and since SSP configurations
+    // come with an algorithm object that can only be used once.  This is
+    // fast for models which are already loaded, and for OSP configurations
+    // that are in the system structure cache.
+    std::lock_guard<std::mutex> lock(mutex_);
+    return prepare_execution(load(options.system_structure_path), options);
+}
+
+
+std::vector<std::string> execution_factory::parameter_set_names(
+    const cosim::filesystem::path& systemStructurePath)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::string> names;
+    for (const auto& entry : load(systemStructurePath).parameter_sets) {
+        names.push_back(entry.first);
+    }
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+
+const system_config& execution_factory::load(
+    const cosim::filesystem::path& systemStructurePath)
+{
+    // The previous configuration is only replaced after the new one has
+    // been loaded, so that its models are reused.
+    auto config = load_system_config(systemStructurePath, *uriResolver_);
+    auto& stored = loadedSystems_[cosim::filesystem::absolute(systemStructurePath).string()];
+    stored = std::move(config);
+    return stored;
+}
@@ -0,0 +1,113 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#ifndef COSIM_SYSTEM_RUN_HPP
+#define COSIM_SYSTEM_RUN_HPP
+
+#include "system_config.hpp"
+
+#include <boost/property_tree/ptree.hpp>
+#include <cosim/execution.hpp>
+#include <cosim/fs_portability.hpp>
+#include <cosim/orchestration.hpp>
+#include <cosim/time.hpp>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+
+/// Settings for a simulation of a system.
+struct system_run_options
+{
+    /// The path to the system structure definition file/directory.
+    cosim::filesystem::path system_structure_path;
+
+    cosim::time_point begin_time;
+    cosim::time_point end_time;
+    std::optional<double> rtf_target;
+    std::optional<unsigned int> worker_thread_count;
+
+    /// The directory where simulation results are stored.
+    cosim::filesystem::path output_dir = ".";
+
+    /**
+     *  The path to an output configuration file, or one of the special
+     *  values "auto", "all" and "none".  See the `run` command.
+     */
+    std::string output_config = "auto";
+
+    /// A scenario file to run, if any.
+    std::optional<cosim::filesystem::path> scenario;
+
+    /// The logical time at which the scenario starts.
+    cosim::time_point scenario_start;
+
+    /// The name of the parameter set to use for initial values.
+    std::string parameter_set;
+};
+
+
+/**
+ *  Reads simulation settings from a property tree, which typically
+ *  represents a JSON object.
+ *
+ *  The recognised keys are `system` (required), `begin`, `end` (required),
+ *  `output_dir`, `output_config`, `scenario`, `scenario_start`,
+ *  `parameter_set`, `worker_threads` and `rtf`, which correspond to the fields of
+ *  `system_run_options`.  Relative paths are interpreted relative to
+ *  `baseDir`.  Throws `std::runtime_error` on invalid settings.
+ */
+system_run_options parse_system_run_options(
+    const boost::property_tree::ptree& tree,
+    const cosim::filesystem::path& baseDir);
+
+
+/**
+ *  Creates an execution for a system, with output and scenario set up
+ *  according to `options`.
+ *
+ *  Simulation progress is not reported, so the caller may want to add an
+ *  observer for that.
+ */
+cosim::execution prepare_execution(
+    const system_config& config,
+    const system_run_options& options);
+
+
+/**
+ *  Prepares executions for multiple simulations, which may run in parallel.
+ *
+ *  All systems are loaded through a single model URI resolver, and the
+ *  last loaded configuration of each system is kept, so that its models
+ *  stay loaded and can be reused by subsequent simulations.  This class
+ *  is thread safe.
+ */
+class execution_factory
+{
+public:
+    execution_factory();
+
+    /// Loads the system and creates an execution as `prepare_execution()`.
+    cosim::execution make_execution(const system_run_options& options);
+
+    /// Loads a system and returns the names of its parameter sets, sorted.
+    std::vector<std::string> parameter_set_names(
+        const cosim::filesystem::path& systemStructurePath);
+
+private:
+    // Must be called with `mutex_` locked.
+    const system_config& load(const cosim::filesystem::path& systemStructurePath);
+
+    std::mutex mutex_;
+    std::shared_ptr<cosim::model_uri_resolver> uriResolver_;
+    std::map<std::string, system_config> loadedSystems_;
+};
+
+
+#endif
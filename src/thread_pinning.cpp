@@ -0,0 +1,303 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#include "thread_pinning.hpp"
+
+#include <cosim/fs_portability.hpp>
+#include <cosim/log/logger.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+
+#ifdef __linux__
+#    include <linux/mempolicy.h>
+#    include <sched.h>
+#    include <sys/syscall.h>
+#    include <unistd.h>
+#endif
+
+
+namespace
+{
+
+#ifdef __linux__
+
+// Parses a non-negative integer, or throws `std::invalid_argument`.
+int parse_cpu_number(const std::string& str)
+{
+    std::size_t end = 0;
+    const auto number = std::stoi(str, &end);
+    if (end != str.size() || number < 0) throw std::invalid_argument(str);
+    return number;
+}
+
+// Parses a list of CPU numbers and ranges on the form "0-3,8,10-11",
+// which is used both on the command line and in sysfs.
+std::vector<int> parse_cpu_list(const std::string& list)
+{
+    std::vector<int> cpus;
+    std::istringstream stream(list);
+    for (std::string item; std::getline(stream, item, ',');) {
+        if (item.empty()) continue;
+        const auto dashPos = item.find('-');
+        try {
+            const auto first = parse_cpu_number(item.substr(0, dashPos));
+            const auto last = dashPos == std::string::npos
+                ? first
+                : parse_cpu_number(item.substr(dashPos + 1));
+            if (last < first) throw std::invalid_argument(item);
+            for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+        } catch (const std::logic_error&) {
+            throw std::runtime_error("Invalid CPU list: " + list);
+        }
+    }
+    return cpus;
+}
+
+std::optional<std::string> read_line(const cosim::filesystem::path& path)
+{
+    std::ifstream stream(path.string());
+    std::string line;
+    if (!stream || !std::getline(stream, line)) return std::nullopt;
+    return line;
+}
+
+int read_int(const cosim::filesystem::path& path, int defaultValue)
+{
+    const auto line = read_line(path);
+    if (!line) return defaultValue;
+    try {
+        return std::stoi(*line);
+    } catch (const std::logic_error&) {
+        return defaultValue;
+    }
+}
+
+struct cpu_info
+{
+    int cpu;
+    int node;
+    int package;
+    int core;
+    int smtRank; // position among the hyperthreads of the same core
+};
+
+std::vector<int> allowed_cpus()
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (::sched_getaffinity(0, sizeof set, &set) != 0) {
+        throw std::runtime_error(
+            std::string("Unable to determine allowed CPUs: ") + std::strerror(errno));
+    }
+    std::vector<int> cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+// Maps CPUs to NUMA nodes.  Empty if the system has no NUMA information.
+std::map<int, int> cpu_nodes()
+{
+    std::map<int, int> nodes;
+    const auto nodeRoot = cosim::filesystem::path("/sys/devices/system/node");
+    if (!cosim::filesystem::is_directory(nodeRoot)) return nodes;
+    for (const auto& entry : cosim::filesystem::directory_iterator(nodeRoot)) {
+        const auto name = entry.path().filename().string();
+        if (name.rfind("node", 0) != 0 || name.size() == 4 ||
+            name.find_first_not_of("0123456789", 4) != std::string::npos) {
+            continue;
+        }
+        const auto node = std::stoi(name.substr(4));
+        if (const auto cpuList = read_line(entry.path() / "cpulist")) {
+            for (const auto cpu : parse_cpu_list(*cpuList)) nodes[cpu] = node;
+        }
+    }
+    return nodes;
+}
+
+std::vector<cpu_info> cpu_topology()
+{
+    const auto nodes = cpu_nodes();
+    std::vector<cpu_info> cpus;
+    std::map<std::pair<int, int>, int> threadsPerCore;
+    for (const auto cpu : allowed_cpus()) {
+        const auto topologyDir = cosim::filesystem::path("/sys/devices/system/cpu") /
+            ("cpu" + std::to_string(cpu)) / "topology";
+        cpu_info info;
+        info.cpu = cpu;
+        info.package = read_int(topologyDir / "physical_package_id", 0);
+        info.core = read_int(topologyDir / "core_id", cpu);
+        const auto node = nodes.find(cpu);
+        info.node = node == nodes.end() ? info.package : node->second;
+        info.smtRank = threadsPerCore[{info.package, info.core}]++;
+        cpus.push_back(info);
+    }
+    return cpus;
+}
+
+int cpu_node(int cpu)
+{
+    const auto nodes = cpu_nodes();
+    const auto node = nodes.find(cpu);
+    return node == nodes.end() ? 0 : node->second;
+}
+
+int current_thread_id()
+{
+    return static_cast<int>(::syscall(SYS_gettid));
+}
+
+std::vector<int> process_threads()
+{
+    std::vector<int> threads;
+    for (const auto& entry : cosim::filesystem::directory_iterator("/proc/self/task")) {
+        try {
+            threads.push_back(std::stoi(entry.path().filename().string()));
+        } catch (const std::logic_error&) {
+        }
+    }
+    std::sort(threads.begin(), threads.end());
+    return threads;
+}
+
+// Returns false if the thread no longer exists.
+bool pin_thread(int threadId, int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (::sched_setaffinity(threadId, sizeof set, &set) != 0) {
+        if (errno == ESRCH) return false;
+        throw std::runtime_error(
+            "Unable to pin thread " + std::to_string(threadId) + " to CPU " +
+            std::to_string(cpu) + ": " + std::strerror(errno));
+    }
+    return true;
+}
+
+void set_memory_policy(numa_policy policy, const std::vector<int>& cpus)
+{
+    if (policy == numa_policy::first_touch) return;
+
+    const auto nodeMap = cpu_nodes();
+    std::set<int> nodes;
+    for (const auto cpu : cpus) {
+        const auto node = nodeMap.find(cpu);
+        nodes.insert(node == nodeMap.end() ? 0 : node->second);
+    }
+    constexpr int bitsPerWord = sizeof(unsigned long) * CHAR_BIT;
+    std::vector<unsigned long> mask(*nodes.rbegin() / bitsPerWord + 1);
+    for (const auto node : nodes) mask[node / bitsPerWord] |= 1ul << (node % bitsPerWord);
+
+    const int mode = policy == numa_policy::bind ? MPOL_BIND : MPOL_INTERLEAVE;
+    if (::syscall(SYS_set_mempolicy, mode, mask.data(), mask.size() * bitsPerWord + 1) != 0) {
+        BOOST_LOG_SEV(cosim::log::logger(), cosim::log::warning)
+            << "Unable to set NUMA memory policy: " << std::strerror(errno);
+        return;
+    }
+    std::ostringstream nodeList;
+    for (const auto node : nodes) nodeList << (node == *nodes.begin() ? "" : ",") << node;
+    BOOST_LOG_SEV(cosim::log::logger(), cosim::log::info)
+        << (policy == numa_policy::bind ? "Binding" : "Interleaving")
+        << " memory on NUMA node(s) " << nodeList.str();
+}
+
+#endif // __linux__
+
+} // namespace
+
+
+std::vector<int> cpu_layout(const std::string& layout)
+{
+#ifdef __linux__
+    auto topology = cpu_topology();
+    if (topology.empty()) throw std::runtime_error("No CPUs available");
+    std::sort(topology.begin(), topology.end(), [](const cpu_info& a, const cpu_info& b) {
+        return std::tie(a.node, a.smtRank, a.package, a.core, a.cpu) <
+            std::tie(b.node, b.smtRank, b.package, b.core, b.cpu);
+    });
+
+    std::vector<int> cpus;
+    if (layout == "compact") {
+        for (const auto& info : topology) cpus.push_back(info.cpu);
+    } else if (layout == "scatter") {
+        std::map<int, std::vector<int>> nodeCPUs;
+        for (const auto& info : topology) nodeCPUs[info.node].push_back(info.cpu);
+        for (std::size_t i = 0; cpus.size() < topology.size(); ++i) {
+            for (const auto& [node, list] : nodeCPUs) {
+                if (i < list.size()) cpus.push_back(list[i]);
+            }
+        }
+    } else {
+        cpus = parse_cpu_list(layout);
+        if (cpus.empty()) throw std::runtime_error("Empty CPU list");
+        for (const auto cpu : cpus) {
+            const auto allowed = std::any_of(topology.begin(), topology.end(), [cpu](const cpu_info& info) {
+                return info.cpu == cpu;
+            });
+            if (!allowed) {
+                throw std::runtime_error("CPU " + std::to_string(cpu) + " is not available");
+            }
+        }
+    }
+    return cpus;
+#else
+    (void)layout;
+    throw std::runtime_error("Thread pinning is only supported on Linux");
+#endif
+}
+
+
+thread_pinning::thread_pinning(std::vector<int> cpus, numa_policy numaPolicy)
+    : cpus_(std::move(cpus))
+{
+    if (cpus_.empty()) throw std::invalid_argument("No CPUs given");
+#ifdef __linux__
+    std::ostringstream layout;
+    for (const auto cpu : cpus_) layout << (layout.tellp() > 0 ? "," : "") << cpu;
+    BOOST_LOG_SEV(cosim::log::logger(), cosim::log::info)
+        << "Thread layout (CPUs in order of use): " << layout.str();
+
+    pin_thread(current_thread_id(), cpus_[0]);
+    BOOST_LOG_SEV(cosim::log::logger(), cosim::log::info)
+        << "Pinned application thread to CPU " << cpus_[0]
+        << " (NUMA node " << cpu_node(cpus_[0]) << ")";
+    nextCPU_ = 1;
+    set_memory_policy(numaPolicy, cpus_);
+    knownThreads_ = process_threads();
+#else
+    (void)numaPolicy;
+    throw std::runtime_error("Thread pinning is only supported on Linux");
+#endif
+}
+
+
+void thread_pinning::pin_new_threads()
+{
+#ifdef __linux__
+    for (const auto threadId : process_threads()) {
+        if (std::binary_search(knownThreads_.begin(), knownThreads_.end(), threadId)) continue;
+        const auto cpu = cpus_[nextCPU_ % cpus_.size()];
+        if (!pin_thread(threadId, cpu)) continue;
+        ++nextCPU_;
+        BOOST_LOG_SEV(cosim::log::logger(), cosim::log::info)
+            << "Pinned thread " << threadId << " to CPU " << cpu
+            << " (NUMA node " << cpu_node(cpu) << ")";
+    }
+    knownThreads_ = process_threads();
+#endif
+}
@@ -0,0 +1,78 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#ifndef COSIM_THREAD_PINNING_HPP
+#define COSIM_THREAD_PINNING_HPP
+
+#include <string>
+#include <vector>
+
+
+/// Memory placement policies for NUMA systems.
+enum class numa_policy
+{
+    /**
+     *  The operating system default, where memory is allocated on the
+     *  node of the thread that first touches it.
+     */
+    first_touch,
+
+    /// Only allocate memory on the nodes of the CPUs that threads are pinned to.
+    bind,
+
+    /// Spread memory evenly across the nodes of the CPUs that threads are pinned to.
+    interleave
+};
+
+
+/**
+ *  Returns the CPUs that simulation threads should be pinned to, in the
+ *  order in which they should be used.
+ *
+ *  `layout` is one of:
+ *
+ *    - "compact": Fill the physical cores of one NUMA node before using
+ *      hyperthreads and then the next node.
+ *    - "scatter": Alternate between NUMA nodes.
+ *    - A list of CPU numbers and ranges, e.g. "0-3,8,10-11", which are
+ *      used in the given order.
+ *
+ *  Only CPUs that the process is allowed to run on are included.  Throws
+ *  `std::runtime_error` if the layout is invalid or on platforms other
+ *  than Linux.
+ */
+std::vector<int> cpu_layout(const std::string& layout);
+
+
+/**
+ *  Pins the threads of a simulation to CPUs.
+ *
+ *  The constructor pins the calling (application) thread to the first CPU
+ *  of the layout and applies the NUMA policy, which is inherited by
+ *  threads created afterwards.  It also records which threads exist, so
+ *  that the worker threads started by libcosim when the execution is
+ *  created can later be pinned to the following CPUs with
+ *  `pin_new_threads()`.  The placement is logged.
+ */
+class thread_pinning
+{
+public:
+    thread_pinning(std::vector<int> cpus, numa_policy numaPolicy);
+
+    /**
+     *  Pins all threads created since construction, assigning CPUs from
+     *  the layout in turn.  If there are more threads than CPUs, the
+     *  layout is reused from the start.
+     */
+    void pin_new_threads();
+
+private:
+    std::vector<int> cpus_;
+    std::vector<int> knownThreads_;
+    std::size_t nextCPU_ = 0;
+};
+
+
+#endif
@@ -7,8 +7,12 @@
 
 #include <cosim/fs_portability.hpp>
 
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <random>
+
 #ifdef _WIN32
-#    include <algorithm>
 #    include <cctype>
 #endif
 
@@ -34,3 +38,78 @@ cosim::uri to_uri(std::string_view str)
     return cosim::uri(str);
 #endif
 }
+
+
+std::optional<cosim::filesystem::path> local_fmu_path(const cosim::uri& uri)
+{
+    if (uri.scheme() != "file") return std::nullopt;
+    if (uri.authority() && !(uri.authority()->empty() || *uri.authority() == "localhost")) {
+        return std::nullopt;
+    }
+    auto path = cosim::file_uri_to_path(uri);
+    if (path.extension() != ".fmu" || !cosim::filesystem::is_regular_file(path)) {
+        return std::nullopt;
+    }
+    return path;
+}
+
+
+std::vector<cosim::filesystem::path> find_fmus(const cosim::filesystem::path& directory)
+{
+    std::vector<cosim::filesystem::path> fmus;
+    for (const auto& entry : cosim::filesystem::recursive_directory_iterator(directory)) {
+        if (entry.is_regular_file() && entry.path().extension() == ".fmu") {
+            fmus.push_back(entry.path());
+        }
+    }
+    std::sort(fmus.begin(), fmus.end());
+    return fmus;
+}
+
+
+std::string quoted_string(std::string_view str)
+{
+    std::string quoted;
+    quoted.reserve(str.size() + 2);
+    quoted += '"';
+    for (const char c : str) {
+        switch (c) {
+            case '"': quoted += "\\\""; break;
+            case '\\': quoted += "\\\\"; break;
+            case '\n': quoted += "\\n"; break;
+            case '\r': quoted += "\\r"; break;
+            case '\t': quoted += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char escaped[7];
+                    std::snprintf(escaped, sizeof escaped, "\\u%04x", static_cast<unsigned>(c));
+                    quoted += escaped;
+                } else {
+                    quoted += c;
+                }
+        }
+    }
+    quoted += '"';
+    return quoted;
+}
+
+
+void write_file_atomically(
+    const cosim::filesystem::path& file,
+    std::string_view contents)
+{
+    auto tempFile = file;
+    tempFile += ".tmp" + std::to_string(std::random_device()());
+    {
+        std::ofstream stream;
+        stream.exceptions(std::ofstream::badbit | std::ofstream::failbit);
+        stream.open(tempFile.string(), std::ios::binary | std::ios::trunc);
+        stream.write(contents.data(), static_cast<std::streamsize>(contents.size()));
+    }
+    try {
+        cosim::filesystem::rename(tempFile, file);
+    } catch (...) {
+        cosim::filesystem::remove(tempFile);
+        throw;
+    }
+}
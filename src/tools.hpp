@@ -6,9 +6,13 @@
 #ifndef COSIM_TOOLS_HPP
 #define COSIM_TOOLS_HPP
 
+#include <cosim/fs_portability.hpp>
 #include <cosim/uri.hpp>
 
+#include <optional>
+#include <string>
 #include <string_view>
+#include <vector>
 
 
 /**
@@ -18,4 +22,38 @@
 cosim::uri to_uri(std::string_view str);
 
 
+/**
+ *  Returns the path to the FMU that the given (absolute) URI refers to,
+ *  if it is a `file` URI that refers to an existing `.fmu` file on the
+ *  local machine.  Otherwise, returns an empty object.
+ */
+std::optional<cosim::filesystem::path> local_fmu_path(const cosim::uri& uri);
+
+
+/**
+ *  Searches `directory` recursively for FMU files and returns their paths,
+ *  sorted lexicographically.
+ */
+std::vector<cosim::filesystem::path> find_fmus(const cosim::filesystem::path& directory);
+
+
+/**
+ *  Returns `str` as a double-quoted string literal with all special
+ *  characters escaped, suitable for use in JSON and YAML output.
+ */
+std::string quoted_string(std::string_view str);
+
+
+/**
+ *  Replaces the contents of `file` with `contents`.
+ *
+ *  The data is first written to a temporary file in the same directory,
+ *  which is then renamed, so concurrent readers never see a partially
+ *  written file.
+ */
+void write_file_atomically(
+    const cosim::filesystem::path& file,
+    std::string_view contents);
+
+
 #endif
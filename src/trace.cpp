@@ -0,0 +1,228 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#include "trace.hpp"
+
+#include "tools.hpp"
+
+#include <cosim/log/logger.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+
+namespace
+{
+
+struct trace_event
+{
+    char phase;
+    const char* category;
+    std::string name;
+    std::int64_t timestamp; // nanoseconds since the start of the trace
+    std::int64_t duration; // nanoseconds
+    std::string args;
+};
+
+struct thread_buffer
+{
+    int threadId;
+    std::mutex mutex; // only contended while the file is being written
+    std::vector<trace_event> events;
+};
+
+} // namespace
+
+
+struct trace_file::recorder
+{
+    cosim::filesystem::path file;
+    std::chrono::steady_clock::time_point startTime;
+    std::uint64_t generation;
+
+    std::mutex mutex;
+    std::vector<std::unique_ptr<thread_buffer>> buffers;
+};
+
+
+namespace
+{
+
+std::atomic<trace_file::recorder*> activeRecorder = nullptr;
+std::atomic<std::uint64_t> lastGeneration = 0;
+
+// Returns the current thread's buffer, creating it if this is the first
+// event the thread records in this trace.
+thread_buffer& current_buffer(trace_file::recorder& recorder)
+{
+    thread_local std::uint64_t generation = 0;
+    thread_local thread_buffer* buffer = nullptr;
+    if (generation != recorder.generation) {
+        std::lock_guard<std::mutex> lock(recorder.mutex);
+        auto newBuffer = std::make_unique<thread_buffer>();
+        newBuffer->threadId = static_cast<int>(recorder.buffers.size()) + 1;
+        buffer = newBuffer.get();
+        recorder.buffers.push_back(std::move(newBuffer));
+        generation = recorder.generation;
+    }
+    return *buffer;
+}
+
+std::int64_t nanoseconds_since_start(
+    const trace_file::recorder& recorder,
+    std::chrono::steady_clock::time_point t)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t - recorder.startTime).count();
+}
+
+void record(
+    char phase,
+    const char* category,
+    std::string name,
+    std::chrono::steady_clock::time_point start,
+    std::chrono::steady_clock::time_point end,
+    std::string args)
+{
+    const auto recorder = activeRecorder.load(std::memory_order_acquire);
+    if (!recorder) return;
+    auto& buffer = current_buffer(*recorder);
+    const auto timestamp = nanoseconds_since_start(*recorder, start);
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    buffer.events.push_back({phase,
+        category,
+        std::move(name),
+        timestamp,
+        nanoseconds_since_start(*recorder, end) - timestamp,
+        std::move(args)});
+}
+
+// Formats a number of nanoseconds as microseconds, the unit of the trace
+// event format.
+std::string microseconds(std::int64_t nanoseconds)
+{
+    char buffer[32];
+    std::snprintf(buffer, sizeof buffer, "%.3f", nanoseconds * 1e-3);
+    return buffer;
+}
+
+std::string to_json(const trace_file::recorder& recorder)
+{
+    std::string json = "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    bool first = true;
+    const auto append = [&](const std::string& event) {
+        json += first ? "" : ",\n";
+        json += event;
+        first = false;
+    };
+    for (const auto& buffer : recorder.buffers) {
+        const auto tid = std::to_string(buffer->threadId);
+        append("{\"ph\": \"M\", \"pid\": 1, \"tid\": " + tid +
+            ", \"name\": \"thread_name\", \"args\": {\"name\": " +
+            quoted_string(buffer->threadId == 1 ? "main" : "thread " + tid) + "}}");
+        for (const auto& e : buffer->events) {
+            auto event = std::string("{\"ph\": \"") + e.phase + "\", \"pid\": 1, \"tid\": " +
+                tid + ", \"cat\": " + quoted_string(e.category) + ", \"name\": " +
+                quoted_string(e.name) + ", \"ts\": " + microseconds(e.timestamp);
+            if (e.phase == 'X') event += ", \"dur\": " + microseconds(e.duration);
+            if (e.phase == 'i') event += ", \"s\": \"t\"";
+            if (!e.args.empty()) event += ", \"args\": " + e.args;
+            append(event + "}");
+        }
+    }
+    json += "\n]}\n";
+    return json;
+}
+
+} // namespace
+
+
+trace_file::trace_file(cosim::filesystem::path file)
+    : recorder_(std::make_unique<recorder>())
+{
+    recorder_->file = std::move(file);
+    recorder_->startTime = std::chrono::steady_clock::now();
+    recorder_->generation = ++lastGeneration;
+    recorder* expected = nullptr;
+    if (!activeRecorder.compare_exchange_strong(expected, recorder_.get())) {
+        throw std::logic_error("A trace is already being recorded");
+    }
+    // Make sure the current thread is the first one in the file.
+    current_buffer(*recorder_);
+}
+
+
+trace_file::~trace_file() noexcept
+{
+    activeRecorder.store(nullptr, std::memory_order_release);
+    try {
+        std::size_t eventCount = 0;
+        for (const auto& buffer : recorder_->buffers) eventCount += buffer->events.size();
+        write_file_atomically(recorder_->file, to_json(*recorder_));
+        BOOST_LOG_SEV(cosim::log::logger(), cosim::log::info)
+            << "Wrote " << eventCount << " trace events to " << recorder_->file;
+    } catch (const std::exception& e) {
+        BOOST_LOG_SEV(cosim::log::logger(), cosim::log::error)
+            << "Failed to write trace file: " << e.what();
+    }
+}
+
+
+bool tracing_enabled() noexcept
+{
+    return activeRecorder.load(std::memory_order_relaxed) != nullptr;
+}
+
+
+void trace_complete(
+    const char* category,
+    std::string name,
+    std::chrono::steady_clock::time_point start,
+    std::chrono::steady_clock::time_point end,
+    std::string args)
+{
+    record('X', category, std::move(name), start, end, std::move(args));
+}
+
+
+void trace_instant(
+    const char* category,
+    std::string name,
+    std::string args)
+{
+    const auto now = std::chrono::steady_clock::now();
+    record('i', category, std::move(name), now, now, std::move(args));
+}
+
+
+trace_span::trace_span(const char* category, const char* name) noexcept
+    : category_(category)
+    , name_(name)
+{
+    if (tracing_enabled()) start_ = std::chrono::steady_clock::now();
+}
+
+
+trace_span::~trace_span() noexcept
+{
+    end();
+}
+
+
+void trace_span::end() noexcept
+{
+    if (!start_) return;
+    try {
+        trace_complete(category_, name_, *start_, std::chrono::steady_clock::now());
+    } catch (...) {
+        // Losing an event is preferable to terminating the program.
+    }
+    start_.reset();
+}
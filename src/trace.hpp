@@ -0,0 +1,97 @@
+/*
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+#ifndef COSIM_TRACE_HPP
+#define COSIM_TRACE_HPP
+
+#include <cosim/fs_portability.hpp>
+
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <string>
+
+
+/**
+ *  Records a timeline of the program's activity, and writes it to a file
+ *  in the Chrome trace event format, which can be viewed in e.g. Perfetto
+ *  (https://ui.perfetto.dev) or `chrome://tracing`.
+ *
+ *  While an object of this type exists, events recorded with the
+ *  functions below are collected in memory, in one buffer per thread.
+ *  The file is written when the object is destroyed, at which point no
+ *  other threads may be recording events.  Only one trace can be recorded
+ *  at a time.
+ */
+class trace_file
+{
+public:
+    /// Starts recording a trace which will be written to `file`.
+    explicit trace_file(cosim::filesystem::path file);
+
+    trace_file(const trace_file&) = delete;
+    trace_file& operator=(const trace_file&) = delete;
+
+    /// Stops recording and writes the file.  Errors are logged.
+    ~trace_file() noexcept;
+
+    struct recorder;
+
+private:
+    std::unique_ptr<recorder> recorder_;
+};
+
+
+/// Returns whether a trace is currently being recorded.
+bool tracing_enabled() noexcept;
+
+
+/**
+ *  Records an event with a duration on the current thread.
+ *
+ *  `category` must be a string literal.  `args`, if nonempty, must be a
+ *  JSON object with additional information about the event.
+ */
+void trace_complete(
+    const char* category,
+    std::string name,
+    std::chrono::steady_clock::time_point start,
+    std::chrono::steady_clock::time_point end,
+    std::string args = {});
+
+
+/// Records an instantaneous event on the current thread.
+void trace_instant(
+    const char* category,
+    std::string name,
+    std::string args = {});
+
+
+/**
+ *  Records an event which lasts for the lifetime of this object, or
+ *  until `end()` is called.  `category` and `name` must be string
+ *  literals.  Does nothing if no trace is being recorded.
+ */
+class trace_span
+{
+public:
+    trace_span(const char* category, const char* name) noexcept;
+
+    trace_span(const trace_span&) = delete;
+    trace_span& operator=(const trace_span&) = delete;
+
+    ~trace_span() noexcept;
+
+    /// Ends the event.
+    void end() noexcept;
+
+private:
+    const char* category_;
+    const char* name_;
+    std::optional<std::chrono::steady_clock::time_point> start_;
+};
+
+
+#endif